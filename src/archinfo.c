@@ -47,9 +47,11 @@ char *cryptalgostr(int algo)
 {
     switch (algo)
     {
-        case ENCRYPT_NONE:     return "none";
-        case ENCRYPT_BLOWFISH: return "blowfish";
-        default:               return "unknown";
+        case ENCRYPT_NONE:      return "none";
+        case ENCRYPT_BLOWFISH:  return "blowfish";
+        case ENCRYPT_AES256GCM: return "aes256-gcm";
+        case ENCRYPT_CHACHA20:  return "chacha20-poly1305";
+        default:                return "unknown";
     }
 }
 
@@ -30,8 +30,10 @@
 #include "fsarchiver.h"
 #include "dico.h"
 #include "common.h"
+#include "checksum.h"
 #include "options.h"
 #include "archreader.h"
+#include "objhead.h"
 #include "queue.h"
 #include "comp_gzip.h"
 #include "comp_bzip2.h"
@@ -153,6 +155,17 @@ int archreader_read_data(carchreader *ai, void *data, u64 size)
     
     assert(ai);
 
+    if (ai->metadata!=NULL) // the headers of a metadata block are parsed
+    {
+        if (size > (u64)(ai->metasize-ai->metapos))
+        {   errprintf("cannot read %ld bytes at the end of the metadata block\n", (long)size);
+            return -1;
+        }
+        memcpy(data, ai->metadata+ai->metapos, size);
+        ai->metapos+=(u32)size;
+        return 0;
+    }
+    
     if ((lres=read(ai->archfd, (char*)data, (long)size))!=(long)size)
     {   sysprintf("read failed: read(size=%ld)=%ld\n", (long)size, lres);
         return -1;
@@ -161,6 +174,25 @@ int archreader_read_data(carchreader *ai, void *data, u64 size)
     return 0;
 }
 
+// the headers which follow are read from the uncompressed contents of a metadata block
+// until it is reset with a NULL pointer: each metadata block starts with a full path
+int archreader_set_metablock(carchreader *ai, u8 *data, u32 size)
+{
+    assert(ai);
+    ai->metadata=data;
+    ai->metasize=(data!=NULL)?size:0;
+    ai->metapos=0;
+    ai->objpath.valid=false;
+    return 0;
+}
+
+u32 archreader_metablock_left(carchreader *ai)
+{
+    assert(ai);
+    return ai->metasize-ai->metapos;
+}
+
+// the dico is a view over the buffer read from the archive: the data of the items are not copied
 int archreader_read_dico(carchreader *ai, cdico *d)
 {
     u16 size;
@@ -169,6 +201,7 @@ int archreader_read_dico(carchreader *ai, cdico *d)
     u32 newsum;
     u8 *buffer;
     u8 *bufpos;
+    u8 *bufend;
     u16 temp16;
     u32 temp32;
     u8 section;
@@ -202,34 +235,37 @@ int archreader_read_dico(carchreader *ai, cdico *d)
             return OLDERR_FATAL;
     }
     
-    bufpos=buffer=malloc(headerlen);
+    // read the header data and the checksum which follows in a single call
+    bufpos=buffer=malloc(headerlen+sizeof(temp32));
     if (!buffer)
     {   errprintf("cannot allocate memory for header\n");
         return FSAERR_ENOMEM;
     }
     
-    if (archreader_read_data(ai, buffer, headerlen)!=0)
+    if (archreader_read_data(ai, buffer, headerlen+sizeof(temp32))!=0)
     {   errprintf("cannot read header data\n");
         free(buffer);
         return OLDERR_FATAL;
     }
-    
-    if (archreader_read_data(ai, &temp32, sizeof(temp32))!=0)
-    {   errprintf("cannot read header checksum\n");
-        free(buffer);
-        return OLDERR_FATAL;
-    }
+    memcpy(&temp32, buffer+headerlen, sizeof(temp32));
     origsum=le32_to_cpu(temp32);
     
     // check header-data integrity using checksum    
     newsum=fletcher32(buffer, headerlen);
     
-    if (newsum!=origsum)
+    if (newsum!=origsum || headerlen<sizeof(temp16))
     {   errprintf("bad checksum for header\n");
         free(buffer);
         return OLDERR_MINOR; // header corrupt --> skip file
     }
     
+    // the dico owns the buffer from now
+    if (dico_attach_data(d, (char*)buffer, headerlen)!=0)
+    {   free(buffer);
+        return OLDERR_FATAL;
+    }
+    bufend=buffer+headerlen;
+    
     // read count from buffer
     memcpy(&temp16, bufpos, sizeof(temp16));
     bufpos+=sizeof(temp16);
@@ -238,13 +274,16 @@ int archreader_read_dico(carchreader *ai, cdico *d)
     // read items
     for (i=0; i < count; i++)
     {
+        if (bufpos+2*sizeof(u8)+2*sizeof(u16) > bufend)
+        {   errprintf("header is truncated: item %d is outside of the header\n", i);
+            return OLDERR_MINOR;
+        }
+        
         // a. read type from buffer
-        memcpy(&type, bufpos, sizeof(type));
-        bufpos+=sizeof(section);
+        type=*bufpos++;
         
         // b. read section from buffer
-        memcpy(&section, bufpos, sizeof(section));
-        bufpos+=sizeof(section);
+        section=*bufpos++;
         
         // c. read key from buffer
         memcpy(&temp16, bufpos, sizeof(temp16));
@@ -256,13 +295,65 @@ int archreader_read_dico(carchreader *ai, cdico *d)
         bufpos+=sizeof(temp16);
         size=le16_to_cpu(temp16);
         
-        // e. add item to dico
-        if (dico_add_generic(d, section, key, bufpos, size, type)!=0)
-            return OLDERR_FATAL;
+        // e. add item to dico (data remain in the buffer)
+        if (dico_add_ref(d, section, key, bufpos-buffer, size, type)!=0)
+            return OLDERR_MINOR;
         bufpos+=size;
     }
     
+    return FSAERR_SUCCESS;
+}
+
+// read a compact object header (FSA_MAGIC_OBJC) which is returned as a normal object header
+static int archreader_read_objhead(carchreader *ai, char *magic, cdico *d, u16 *fsid)
+{
+    u32 payloadlen;
+    u32 origsum;
+    u32 newsum;
+    u8 *buffer;
+    u32 temp32;
+    int res;
+    
+    if (archreader_read_data(ai, &temp32, sizeof(temp32))!=0)
+    {   errprintf("cannot read the length of the object header\n");
+        return OLDERR_FATAL;
+    }
+    payloadlen=le32_to_cpu(temp32);
+    if (payloadlen > OBJHEAD_MAXSIZE)
+    {   errprintf("object header is too large: payloadlen=%ld\n", (long)payloadlen);
+        return OLDERR_MINOR;
+    }
+    
+    // read the payload and the checksum which follows in a single call
+    if ((buffer=malloc(payloadlen+sizeof(temp32)))==NULL)
+    {   errprintf("cannot allocate memory for header\n");
+        return FSAERR_ENOMEM;
+    }
+    if (archreader_read_data(ai, buffer, payloadlen+sizeof(temp32))!=0)
+    {   errprintf("cannot read header data\n");
+        free(buffer);
+        return OLDERR_FATAL;
+    }
+    memcpy(&temp32, buffer+payloadlen, sizeof(temp32));
+    origsum=le32_to_cpu(temp32);
+    
+    // the archive id is mixed with the checksum: headers of nested archives are rejected
+    newsum=fletcher32(buffer, payloadlen)^ai->archid;
+    if (newsum!=origsum)
+    {   errprintf("bad checksum for object header\n");
+        ai->objpath.valid=false;
+        free(buffer);
+        return OLDERR_MINOR; // header corrupt --> skip file
+    }
+    
+    res=objhead_decode(d, fsid, &ai->objpath, buffer, buffer+payloadlen);
     free(buffer);
+    if (res!=0)
+    {   msgprintf(MSG_STACK, "objhead_decode() failed\n");
+        return OLDERR_MINOR;
+    }
+    
+    memcpy(magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC);
     return FSAERR_SUCCESS;
 }
 
@@ -317,6 +408,10 @@ int archreader_read_header(carchreader *ai, char *magic, cdico **d, bool allowse
         }
     }
     
+    // object headers have their own compact format
+    if (memcmp(magic, FSA_MAGIC_OBJC, FSA_SIZEOF_MAGIC)==0)
+        return archreader_read_objhead(ai, magic, *d, fsid);
+    
     // read the archive id
     if ((res=archreader_read_data(ai, &temp32, sizeof(temp32)))!=FSAERR_SUCCESS)
     {   msgprintf(MSG_STACK, "cannot read archive-id in header: res=%d\n", res);
@@ -432,7 +527,51 @@ archio_read_volheader_error:
     return ret;
 }
 
-int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock, int *out_sumok, struct s_blockinfo *out_blkinfo)
+// read the payload of the identical block which is referenced by a deduplicated block: it is
+// always in the same volume, and the archive is read from the current position after that
+static int archreader_read_blockref(carchreader *ai, cdico *in_blkdico, int *out_sumok, struct s_blockinfo *out_blkinfo)
+{
+    char magic[FSA_SIZEOF_MAGIC];
+    cdico *refdico=NULL;
+    u64 refoffset;
+    u32 refflags;
+    s64 curpos;
+    u16 fsid;
+    int res=-1;
+    
+    if (dico_get_u64(in_blkdico, 0, BLOCKHEADITEMKEY_REFOFFSET, &refoffset)!=0)
+    {   errprintf("cannot get BLOCKHEADITEMKEY_REFOFFSET from block-header\n");
+        return -1;
+    }
+    
+    if ((curpos=lseek64(ai->archfd, 0, SEEK_CUR))<0 || lseek64(ai->archfd, (off64_t)refoffset, SEEK_SET)<0)
+    {   sysprintf("cannot seek to the block referenced at offset=%lld\n", (long long)refoffset);
+        return -1;
+    }
+    
+    if (archreader_read_header(ai, magic, &refdico, false, &fsid)==FSAERR_SUCCESS &&
+        memcmp(magic, FSA_MAGIC_BLKH, FSA_SIZEOF_MAGIC)==0 &&
+        (dico_get_u32(refdico, 0, BLOCKHEADITEMKEY_FLAGS, &refflags)!=0 || !(refflags&(FSA_BLKFLAGS_DEDUP|FSA_BLKFLAGS_ZERO))))
+    {
+        res=archreader_read_block(ai, refdico, fsid, false, out_sumok, out_blkinfo); // the dictionary is the one of that block
+    }
+    dico_destroy(refdico);
+    
+    if (lseek64(ai->archfd, curpos, SEEK_SET)<0)
+    {   sysprintf("lseek64(pos=%lld, SEEK_SET) failed\n", (long long)curpos);
+        free(out_blkinfo->blkdata);
+        return -1;
+    }
+    
+    if (res!=0)
+    {   errprintf("cannot read the block referenced at offset=%lld\n", (long long)refoffset);
+        memset(out_blkinfo, 0, sizeof(struct s_blockinfo));
+        *out_sumok=false;
+    }
+    return 0;
+}
+
+int archreader_read_block(carchreader *ai, cdico *in_blkdico, u16 in_fsid, int in_skipblock, int *out_sumok, struct s_blockinfo *out_blkinfo)
 {
     u32 arblockcsumorig;
     u32 arblockcsumcalc;
@@ -442,6 +581,11 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
     u16 cryptalgo; // encryption algo used
     u32 finalsize; // compressed  block size
     u32 compsize;
+    u32 blkflags;
+    u16 csumalgo;
+    u16 digestalgo;
+    u32 segment;
+    u32 segpos;
     u8 *buffer;
     
     assert(ai);
@@ -458,7 +602,7 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
         return -1;
     }
     
-    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_REALSIZE, &curblocksize)!=0 || curblocksize>FSA_MAX_BLKSIZE)
+    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_REALSIZE, &curblocksize)!=0 || curblocksize>FSA_MAX_LARGEBLKSIZE)
     {   msgprintf(3, "cannot get blocksize from block-header\n");
         return -1;
     }
@@ -488,6 +632,30 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
         return -1;
     }
     
+    // BLOCKHEADITEMKEY_FLAGS has been introduced in fsarchiver-0.8.6: don't fail if missing
+    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_FLAGS, &blkflags)!=0)
+        blkflags=0;
+    
+    // BLOCKHEADITEMKEY_CSUMALGO has been introduced in fsarchiver-0.8.6: blocks used fletcher32 before
+    if (dico_get_u16(in_blkdico, 0, BLOCKHEADITEMKEY_CSUMALGO, &csumalgo)!=0)
+        csumalgo=CSUM_FLETCHER32;
+    if (csumalgo!=CSUM_FLETCHER32 && csumalgo!=CSUM_CRC32C)
+    {   errprintf("block at offset=%ld uses an unsupported checksum algorithm: %d\n", (long)blockoffset, (int)csumalgo);
+        return -1;
+    }
+    
+    // BLOCKHEADITEMKEY_DIGESTALGO is set when the block is part of the tree hash of a file
+    if (dico_get_u16(in_blkdico, 0, BLOCKHEADITEMKEY_DIGESTALGO, &digestalgo)!=0)
+        digestalgo=DIGEST_NULL;
+    if (digestalgo!=DIGEST_NULL && digestalgo!=DIGEST_BLAKE2B && digestalgo!=DIGEST_SHA256)
+    {   errprintf("block at offset=%ld uses an unsupported digest algorithm: %d\n", (long)blockoffset, (int)digestalgo);
+        return -1;
+    }
+    
+    // BLOCKHEADITEMKEY_SEGMENT is set when the block is part of a solid segment (option --solid)
+    if (dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_SEGMENT, &segment)!=0 || dico_get_u32(in_blkdico, 0, BLOCKHEADITEMKEY_SEGMENTPOS, &segpos)!=0)
+        segment=segpos=0;
+    
     if (in_skipblock==true) // the main thread does not need that block (block belongs to a filesys we want to skip)
     {
         if (lseek64(ai->archfd, (long)finalsize, SEEK_CUR)<0)
@@ -497,6 +665,45 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
         return 0;
     }
     
+    // zero blocks have no payload: the data are recreated when the file is restored
+    if (blkflags&FSA_BLKFLAGS_ZERO)
+    {
+        if (finalsize!=0)
+        {   errprintf("zero block has an unexpected payload at offset=%ld, finalsize=%ld\n", (long)blockoffset, (long)finalsize);
+            return -1;
+        }
+        out_blkinfo->blkdata=NULL;
+        out_blkinfo->blkrealsize=curblocksize;
+        out_blkinfo->blkoffset=blockoffset;
+        out_blkinfo->blkflags=blkflags;
+        *out_sumok=true;
+        return 0;
+    }
+    
+    // the payload of a deduplicated block is the one of the block it references
+    if (blkflags&FSA_BLKFLAGS_DEDUP)
+    {
+        if (archreader_read_blockref(ai, in_blkdico, out_sumok, out_blkinfo)!=0)
+            return -1;
+        if (*out_sumok==true && out_blkinfo->blkrealsize!=curblocksize)
+        {   errprintf("the block referenced at offset=%ld has a different size\n", (long)blockoffset);
+            *out_sumok=false;
+        }
+        out_blkinfo->blkcryptoffset=out_blkinfo->blkoffset;
+        if (*out_sumok!=true) // restored as zeros like the other corrupt blocks
+        {   free(out_blkinfo->blkdata);
+            if ((out_blkinfo->blkdata=calloc(1, curblocksize))==NULL)
+            {   errprintf("cannot allocate block: calloc(%d) failed\n", curblocksize);
+                return FSAERR_ENOMEM;
+            }
+        }
+        out_blkinfo->blkrealsize=curblocksize;
+        out_blkinfo->blkoffset=blockoffset;
+        out_blkinfo->blkflags=blkflags|(out_blkinfo->blkflags&FSA_BLKFLAGS_ZSTDDICT);
+        out_blkinfo->blkdigestalgo=digestalgo;
+        return 0;
+    }
+    
     // ---- allocate memory
     if ((buffer=malloc(finalsize))==NULL)
     {   errprintf("cannot allocate block: malloc(%d) failed\n", finalsize);
@@ -513,14 +720,20 @@ int archreader_read_block(carchreader *ai, cdico *in_blkdico, int in_skipblock,
     out_blkinfo->blkdata=(char*)buffer;
     out_blkinfo->blkrealsize=curblocksize;
     out_blkinfo->blkoffset=blockoffset;
+    out_blkinfo->blkflags=blkflags;
     out_blkinfo->blkarcsum=arblockcsumorig;
+    out_blkinfo->blkcsumalgo=csumalgo;
+    out_blkinfo->blkdigestalgo=digestalgo;
     out_blkinfo->blkcompalgo=compalgo;
     out_blkinfo->blkcryptalgo=cryptalgo;
     out_blkinfo->blkarsize=finalsize;
     out_blkinfo->blkcompsize=compsize;
+    out_blkinfo->blkfsid=in_fsid;
+    out_blkinfo->blksegment=segment;
+    out_blkinfo->blksegpos=segpos;
     
     // ---- checksum
-    arblockcsumcalc=fletcher32(buffer, finalsize);
+    arblockcsumcalc=block_checksum(csumalgo, buffer, finalsize);
     if (arblockcsumcalc!=arblockcsumorig) // bad checksum
     {
         errprintf("block is corrupt at offset=%ld, blksize=%ld\n", (long)blockoffset, (long)curblocksize);
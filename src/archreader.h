@@ -19,6 +19,7 @@
 #define __ARCHREADER_H__
 
 #include <limits.h>
+#include "objhead.h"
 
 struct s_blockinfo;
 struct s_headinfo;
@@ -46,6 +47,10 @@ struct s_archreader
     char   label[FSA_MAX_LABELLEN]; // archive label defined by the user
     char   basepath[PATH_MAX]; // path of the first volume of an archive
     char   volpath[PATH_MAX]; // path of the current volume of an archive
+    cobjpathref objpath; // path of the last object header which has been read
+    u8     *metadata; // headers are read from this metadata block instead of the archive file when it is set
+    u32    metasize; // size of the uncompressed metadata block
+    u32    metapos; // position of the next header in the metadata block
 };
 
 int archreader_init(carchreader *ai);
@@ -55,9 +60,11 @@ int archreader_close(carchreader *ai);
 int archreader_incvolume(carchreader *ai, bool waitkeypress);
 int archreader_volpath(carchreader *ai);
 int archreader_read_data(carchreader *ai, void *data, u64 size);
+int archreader_set_metablock(carchreader *ai, u8 *data, u32 size);
+u32 archreader_metablock_left(carchreader *ai);
 int archreader_read_dico(carchreader *ai, struct s_dico *d);
 int archreader_read_volheader(carchreader *ai);
 int archreader_read_header(carchreader *ai, char *magic, struct s_dico **d, bool allowseek, u16 *fsid);
-int archreader_read_block(carchreader *ai, struct s_dico *in_blkdico, int in_skipblock, int *out_sumok, struct s_blockinfo *out_blkinfo);
+int archreader_read_block(carchreader *ai, struct s_dico *in_blkdico, u16 in_fsid, int in_skipblock, int *out_sumok, struct s_blockinfo *out_blkinfo);
 
 #endif // __ARCHREADER_H__
@@ -34,6 +34,7 @@
 #include "archwriter.h"
 #include "queue.h"
 #include "writebuf.h"
+#include "thread_comp.h"
 #include "comp_gzip.h"
 #include "comp_bzip2.h"
 #include "error.h"
@@ -46,6 +47,7 @@ int archwriter_init(carchwriter *ai)
     assert(ai);
     memset(ai, 0, sizeof(struct s_archwriter));
     strlist_init(&ai->vollist);
+    dedup_init(&ai->dedupmap);
     ai->newarch=false;
     ai->archfd=-1;
     ai->archid=0;
@@ -57,6 +59,7 @@ int archwriter_destroy(carchwriter *ai)
 {
     assert(ai);
     strlist_destroy(&ai->vollist);
+    dedup_destroy(&ai->dedupmap);
     return 0;
 }
 
@@ -147,8 +150,7 @@ int archwriter_close(carchwriter *ai)
 
 int archwriter_remove(carchwriter *ai)
 {
-    char volpath[PATH_MAX];
-    int count;
+    char *volpath;
     int i;
     
     assert(ai);
@@ -160,16 +162,12 @@ int archwriter_remove(carchwriter *ai)
     
     if (ai->newarch==true)
     {
-        count=strlist_count(&ai->vollist);
-        for (i=0; i < count; i++)
+        for (i=0; (volpath=strlist_get(&ai->vollist, i))!=NULL; i++)
         {
-            if (strlist_getitem(&ai->vollist, i, volpath, sizeof(volpath))==0)
-            {
-                if (unlink(volpath)==0)
-                    msgprintf(MSG_FORCE, "removed %s\n", volpath);
-                else
-                    errprintf("cannot remove %s\n", volpath);
-            }
+            if (unlink(volpath)==0)
+                msgprintf(MSG_FORCE, "removed %s\n", volpath);
+            else
+                errprintf("cannot remove %s\n", volpath);
         }
     }
     return 0;
@@ -356,6 +354,7 @@ int archwriter_split_if_necessary(carchwriter *ai, struct s_writebuf *wb)
         }
         archwriter_close(ai);
         archwriter_incvolume(ai, false);
+        dedup_empty(&ai->dedupmap); // a volume must not depend on the previous ones
         msgprintf(MSG_VERB2, "Creating new volume: [%s]\n", ai->volpath);
         if (archwriter_create(ai)!=0)
         {   msgprintf(MSG_STACK, "archwriter_create() failed\n");
@@ -369,12 +368,65 @@ int archwriter_split_if_necessary(carchwriter *ai, struct s_writebuf *wb)
     return 0;
 }
 
+// a block which is identical to a block of the current volume is written as a reference
+// to it: returns 1 when the reference has been written and 0 when the block must be stored
+static int archwriter_dowrite_blockref(carchwriter *ai, struct s_blockinfo *blkinfo)
+{
+    struct s_blockinfo refinfo;
+    struct s_writebuf *wb=NULL;
+    s64 refoffset;
+    int ret=0;
+    
+    if ((refoffset=dedup_lookup(&ai->dedupmap, blkinfo->blkfprint))<0)
+        return 0;
+    
+    refinfo=*blkinfo;
+    refinfo.blkflags|=FSA_BLKFLAGS_DEDUP;
+    refinfo.blkrefoffset=(u64)refoffset;
+    refinfo.blkarsize=0;
+    
+    if ((wb=writebuf_alloc())==NULL)
+    {   errprintf("writebuf_alloc() failed\n");
+        return -1;
+    }
+    if (writebuf_add_block(wb, &refinfo, ai->archid, blkinfo->blkfsid)!=0)
+    {   msgprintf(MSG_STACK, "writebuf_add_block() failed\n");
+        ret=-1;
+    }
+    else if (archwriter_split_check(ai, wb)==false) // references never point to another volume
+    {
+        if (archwriter_write_buffer(ai, wb)!=0)
+        {   msgprintf(MSG_STACK, "archwriter_write_buffer() failed\n");
+            ret=-1;
+        }
+        else
+        {   ret=1;
+        }
+    }
+    writebuf_destroy(wb);
+    return ret;
+}
+
 int archwriter_dowrite_block(carchwriter *ai, struct s_blockinfo *blkinfo)
 {
     struct s_writebuf *wb=NULL;
+    s64 blkpos;
+    int res;
     
     assert(ai);
 
+    if (blkinfo->blkhasfprint==true)
+    {
+        if ((res=archwriter_dowrite_blockref(ai, blkinfo))!=0)
+            return (res>0)?0:-1;
+        // the compression threads have left the block uncompressed because they had seen
+        // the same data before, but the first copy has not been written in this volume
+        if (blkinfo->blkarsize==0 && compress_block_data(blkinfo)!=0)
+        {   msgprintf(MSG_STACK, "compress_block_data() failed\n");
+            return -1;
+        }
+    }
+
     if ((wb=writebuf_alloc())==NULL)
     {   errprintf("writebuf_alloc() failed\n");
         return -1;
@@ -390,10 +442,14 @@ int archwriter_dowrite_block(carchwriter *ai, struct s_blockinfo *blkinfo)
         return -1;
     }
     
+    blkpos=archwriter_get_currentpos(ai);
     if (archwriter_write_buffer(ai, wb)!=0)
     {   msgprintf(MSG_STACK, "archwriter_write_buffer() failed\n");
         return -1;
     }
+    
+    if (blkinfo->blkhasfprint==true && blkpos>=0)
+        dedup_insert(&ai->dedupmap, blkinfo->blkfprint, blkpos);
 
     writebuf_destroy(wb);
     return 0;
@@ -402,6 +458,7 @@ int archwriter_dowrite_block(carchwriter *ai, struct s_blockinfo *blkinfo)
 int archwriter_dowrite_header(carchwriter *ai, struct s_headinfo *headinfo)
 {
     struct s_writebuf *wb=NULL;
+    int res;
     
     assert(ai);
 
@@ -410,7 +467,11 @@ int archwriter_dowrite_header(carchwriter *ai, struct s_headinfo *headinfo)
         return -1;
     }
     
-    if (writebuf_add_header(wb, headinfo->dico, headinfo->magic, ai->archid, headinfo->fsid)!=0)
+    if (memcmp(headinfo->magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)==0) // object headers use a compact encoding
+        res=writebuf_add_objhead(wb, headinfo->dico, ai->archid, headinfo->fsid, &ai->objpath);
+    else
+        res=writebuf_add_header(wb, headinfo->dico, headinfo->magic, ai->archid, headinfo->fsid);
+    if (res!=0)
     {   msgprintf(MSG_STACK, "archio_write_block() failed\n");
         return -1;
     }
@@ -20,6 +20,8 @@
 
 #include <limits.h>
 #include "strlist.h"
+#include "objhead.h"
+#include "dedup.h"
 
 struct s_writebuf;
 struct s_blockinfo;
@@ -40,6 +42,8 @@ struct s_archwriter
     char   basepath[PATH_MAX]; // path of the first volume of an archive
     char   volpath[PATH_MAX]; // path of the current volume of an archive
     cstrlist vollist; // paths to all volumes of an archive
+    cobjpathref objpath; // path of the last object header which has been written
+    cdeduptable dedupmap; // position of the blocks written in the current volume (option -D)
 };
 
 int archwriter_init(carchwriter *ai);
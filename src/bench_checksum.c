@@ -0,0 +1,113 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+// benchmark of the implementations of fletcher32: this program is not installed, it is
+// built with "make bench_checksum" and it takes the size of the buffer in KB as argument
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fsarchiver.h"
+#include "checksum.h"
+
+#define BENCH_DEFSIZE  1024 // size of the buffer in KB: like a data block, it stays in the cache
+#define BENCH_MINTIME  1.0 // each implementation runs for at least one second
+#define BENCH_CHECKS   2000 // random lengths and alignments compared to the scalar version
+
+static double bench_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec+(double)t.tv_nsec/1000000000.0;
+}
+
+// results of the scalar version for the random parts of the buffer
+static int bench_check(u8 *buffer, u32 size, u32 *expected, int impl)
+{
+    u32 off, len;
+    int i;
+    
+    srand(1);
+    for (i=0; i < BENCH_CHECKS; i++)
+    {   off=rand()%64;
+        len=(i < 1024) ? i : rand()%(size-off);
+        if (impl==FLETCHER32_SCALAR)
+            expected[i]=fletcher32(buffer+off, len);
+        else if (fletcher32(buffer+off, len)!=expected[i])
+        {   fprintf(stderr, "%s: fletcher32(offset=%ld, len=%ld)=%.8x instead of %.8x\n", fletcher32_implstr(impl),
+                (long)off, (long)len, (u32)fletcher32(buffer+off, len), expected[i]);
+            return -1;
+        }
+    }
+    if (impl==FLETCHER32_SCALAR)
+        expected[BENCH_CHECKS]=fletcher32(buffer, size);
+    else if (fletcher32(buffer, size)!=expected[BENCH_CHECKS])
+    {   fprintf(stderr, "%s: fletcher32 of the whole buffer does not match\n", fletcher32_implstr(impl));
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    u32 expected[BENCH_CHECKS+1];
+    double start, elapsed;
+    long sizekb=BENCH_DEFSIZE;
+    u8 *buffer;
+    u32 size;
+    u32 i;
+    int impl;
+    int runs;
+    
+    if (argc>1 && ((sizekb=atol(argv[1]))<=0 || sizekb>1024*1024))
+    {   fprintf(stderr, "usage: %s [size-in-kb]\n", argv[0]);
+        return 1;
+    }
+    size=(u32)sizekb*1024;
+    
+    if ((buffer=malloc(size))==NULL)
+    {   fprintf(stderr, "malloc(%ld) failed\n", (long)size);
+        return 1;
+    }
+    srand(0);
+    for (i=0; i < size; i++)
+        buffer[i]=rand();
+    
+    for (impl=FLETCHER32_SCALAR; impl < FLETCHER32_IMPLCOUNT; impl++)
+    {
+        if (fletcher32_select(impl)!=0)
+        {   printf("%-8s not supported\n", fletcher32_implstr(impl));
+            continue;
+        }
+        if (bench_check(buffer, size, expected, impl)!=0)
+            return 1;
+        
+        start=bench_now();
+        for (runs=0; (elapsed=bench_now()-start) < BENCH_MINTIME; runs++)
+            fletcher32(buffer, size);
+        printf("%-8s %6.2f GB/s\n", fletcher32_implstr(impl), (double)size*runs/elapsed/1e9);
+    }
+    
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+
+// benchmark of the table used to detect hard links: this program is not installed,
+// it is built with "make bench_dichl" and it takes the number of items as argument
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+
+#include "fsarchiver.h"
+#include "dichl.h"
+#include "error.h"
+
+#define BENCH_DEFCOUNT 10000000
+#define BENCH_DEV      0x801 // all the inodes belong to the same filesystem
+
+// dichl.c is linked without the rest of the program: the errors are shown as they are
+int fsaprintf(int level, bool showerrno, bool showloc, const char *file, const char *fct, int line, char *format, ...)
+{
+    va_list ap;
+    
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    return 0;
+}
+
+static double bench_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec+(double)t.tv_nsec/1000000000.0;
+}
+
+// the inode numbers are spread like in a real filesystem instead of being consecutive
+static u64 bench_ino(u64 i)
+{
+    return (i*2654435761ULL)%(1ULL<<40);
+}
+
+int main(int argc, char **argv)
+{
+    char path[PATH_MAX];
+    char buf[PATH_MAX];
+    double t0, t1, t2, t3;
+    long count=BENCH_DEFCOUNT;
+    cdichl *d;
+    long i;
+    
+    if (argc>1 && (count=atol(argv[1]))<=0)
+    {   fprintf(stderr, "usage: %s [count]\n", argv[0]);
+        return 1;
+    }
+    
+    if ((d=dichl_alloc())==NULL)
+    {   fprintf(stderr, "dichl_alloc() failed\n");
+        return 1;
+    }
+    
+    t0=bench_now();
+    for (i=0; i < count; i++)
+    {   snprintf(path, sizeof(path), "/home/user/data/dir%.5ld/file%.8ld", i/1000, i);
+        if (dichl_add(d, BENCH_DEV, bench_ino(i), path)!=0)
+        {   fprintf(stderr, "dichl_add(%ld) failed\n", i);
+            return 1;
+        }
+    }
+    
+    t1=bench_now();
+    for (i=0; i < count; i++)
+    {   if (dichl_get(d, BENCH_DEV, bench_ino(i), buf, sizeof(buf))!=0)
+        {   fprintf(stderr, "dichl_get(%ld) failed\n", i);
+            return 1;
+        }
+    }
+    
+    t2=bench_now();
+    for (i=0; i < count; i++)
+    {   if (dichl_get(d, BENCH_DEV+1, bench_ino(i), buf, sizeof(buf))==0)
+        {   fprintf(stderr, "dichl_get(%ld) found an item which has not been added\n", i);
+            return 1;
+        }
+    }
+    t3=bench_now();
+    
+    snprintf(path, sizeof(path), "/home/user/data/dir%.5ld/file%.8ld", (count-1)/1000, count-1);
+    if (dichl_get(d, BENCH_DEV, bench_ino(count-1), buf, sizeof(buf))!=0 || strcmp(buf, path)!=0)
+    {   fprintf(stderr, "dichl_get() returned a wrong path: [%s]\n", buf);
+        return 1;
+    }
+    
+    printf("items:   %ld\n", count);
+    printf("add:     %.3f sec (%.0f ns per item)\n", t1-t0, (t1-t0)*1e9/count);
+    printf("get:     %.3f sec (%.0f ns per item)\n", t2-t1, (t2-t1)*1e9/count);
+    printf("missing: %.3f sec (%.0f ns per item)\n", t3-t2, (t3-t2)*1e9/count);
+    
+    dichl_destroy(d);
+    return 0;
+}
@@ -0,0 +1,484 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "fsarchiver.h"
+#include "checksum.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define FLETCHER32_X86
+#  define CRC32C_X86
+#  include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#  ifdef __ARM_NEON
+#    define FLETCHER32_NEON
+#    include <arm_neon.h>
+#  endif
+#  define CRC32C_ARM64
+#  include <arm_acle.h>
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+#endif
+
+// The archive format uses a fletcher32 which processes the bytes in chunks of
+// up to FLETCHER32_CHUNK bytes and folds both sums to 16 bits after each chunk.
+// For a chunk x[0..n-1] the running sums become:
+//   sum1 = sum1 + S
+//   sum2 = sum2 + n*sum1 + W
+// with S = sum(x[i]) and W = sum((n-i)*x[i]). The vector implementations only
+// compute S and W for each chunk, which gives results identical to the plain
+// byte loop since the folding is done by the same generic code.
+#define FLETCHER32_CHUNK 360
+
+typedef void (*fletcher32_chunk_fct)(u8 *data, u32 len, u32 *bytesum, u32 *weighted);
+
+static void fletcher32_chunk_scalar(u8 *data, u32 len, u32 *bytesum, u32 *weighted)
+{
+    u32 s=0, w=0;
+    u32 i;
+    
+    for (i=0; i < len; i++)
+    {   s+=data[i];
+        w+=s;
+    }
+    *bytesum=s;
+    *weighted=w;
+}
+
+#ifdef FLETCHER32_X86
+
+// sse2: 16 bytes per step, psadbw gives the byte sum, pmaddwd the weighted sum
+__attribute__((target("sse2")))
+static void fletcher32_chunk_sse2(u8 *data, u32 len, u32 *bytesum, u32 *weighted)
+{
+    const __m128i zero=_mm_setzero_si128();
+    const __m128i wlo=_mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i whi=_mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i vsum=zero, vprev=zero, vdot=zero;
+    u32 blocks=len/16;
+    u32 vs[4], vp[4], vd[4];
+    u32 s, p, d, ts, tw;
+    u32 i;
+    
+    for (i=0; i < blocks; i++)
+    {   __m128i v=_mm_loadu_si128((__m128i*)(data+16*i));
+        vprev=_mm_add_epi32(vprev, vsum);
+        vsum=_mm_add_epi32(vsum, _mm_sad_epu8(v, zero));
+        vdot=_mm_add_epi32(vdot, _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), wlo));
+        vdot=_mm_add_epi32(vdot, _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), whi));
+    }
+    _mm_storeu_si128((__m128i*)vs, vsum);
+    _mm_storeu_si128((__m128i*)vp, vprev);
+    _mm_storeu_si128((__m128i*)vd, vdot);
+    s=vs[0]+vs[1]+vs[2]+vs[3];
+    p=vp[0]+vp[1]+vp[2]+vp[3];
+    d=vd[0]+vd[1]+vd[2]+vd[3];
+    fletcher32_chunk_scalar(data+16*blocks, len-16*blocks, &ts, &tw);
+    *bytesum=s+ts;
+    *weighted=16*p+d+(len-16*blocks)*s+tw;
+}
+
+// avx2: 32 bytes per step, pmaddubsw multiplies the bytes by their weight
+__attribute__((target("avx2")))
+static void fletcher32_chunk_avx2(u8 *data, u32 len, u32 *bytesum, u32 *weighted)
+{
+    const __m256i zero=_mm256_setzero_si256();
+    const __m256i ones=_mm256_set1_epi16(1);
+    const __m256i weights=_mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    __m256i vsum=zero, vprev=zero, vdot=zero;
+    u32 blocks=len/32;
+    u32 vs[8], vp[8], vd[8];
+    u32 s=0, p=0, d=0, ts, tw;
+    u32 i;
+    
+    for (i=0; i < blocks; i++)
+    {   __m256i v=_mm256_loadu_si256((__m256i*)(data+32*i));
+        vprev=_mm256_add_epi32(vprev, vsum);
+        vsum=_mm256_add_epi32(vsum, _mm256_sad_epu8(v, zero));
+        vdot=_mm256_add_epi32(vdot, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+    }
+    _mm256_storeu_si256((__m256i*)vs, vsum);
+    _mm256_storeu_si256((__m256i*)vp, vprev);
+    _mm256_storeu_si256((__m256i*)vd, vdot);
+    for (i=0; i < 8; i++)
+    {   s+=vs[i];
+        p+=vp[i];
+        d+=vd[i];
+    }
+    fletcher32_chunk_scalar(data+32*blocks, len-32*blocks, &ts, &tw);
+    *bytesum=s+ts;
+    *weighted=32*p+d+(len-32*blocks)*s+tw;
+}
+
+// avx512bw: same as avx2 with 64 bytes per step
+__attribute__((target("avx512f,avx512bw")))
+static void fletcher32_chunk_avx512(u8 *data, u32 len, u32 *bytesum, u32 *weighted)
+{
+    static const u8 w8[64]={64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49,
+        48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32, 31, 30, 29, 28, 27, 26, 25,
+        24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+    const __m512i zero=_mm512_setzero_si512();
+    const __m512i ones=_mm512_set1_epi16(1);
+    const __m512i weights=_mm512_loadu_si512(w8);
+    __m512i vsum=zero, vprev=zero, vdot=zero;
+    u32 blocks=len/64;
+    u32 s, p, d, tail;
+    u32 i;
+    
+    for (i=0; i < blocks; i++)
+    {   __m512i v=_mm512_loadu_si512(data+64*i);
+        vprev=_mm512_add_epi32(vprev, vsum);
+        vsum=_mm512_add_epi32(vsum, _mm512_sad_epu8(v, zero));
+        vdot=_mm512_add_epi32(vdot, _mm512_madd_epi16(_mm512_maddubs_epi16(v, weights), ones));
+    }
+    // the tail is processed as a block padded with trailing zeros: padding with
+    // pad zeros adds pad*S to the weighted sum, which is subtracted at the end
+    if ((tail=len-64*blocks)>0)
+    {   __m512i v=_mm512_maskz_loadu_epi8((__mmask64)((1ULL<<tail)-1), data+64*blocks);
+        vprev=_mm512_add_epi32(vprev, vsum);
+        vsum=_mm512_add_epi32(vsum, _mm512_sad_epu8(v, zero));
+        vdot=_mm512_add_epi32(vdot, _mm512_madd_epi16(_mm512_maddubs_epi16(v, weights), ones));
+        blocks++;
+    }
+    s=_mm512_reduce_add_epi32(vsum);
+    p=_mm512_reduce_add_epi32(vprev);
+    d=_mm512_reduce_add_epi32(vdot);
+    *bytesum=s;
+    *weighted=64*p+d-(64*blocks-len)*s;
+}
+
+#endif // FLETCHER32_X86
+
+#ifdef FLETCHER32_NEON
+
+// neon: 16 bytes per step, widening multiply-accumulate for the weighted sum
+static void fletcher32_chunk_neon(u8 *data, u32 len, u32 *bytesum, u32 *weighted)
+{
+    static const u8 wlo[8]={16, 15, 14, 13, 12, 11, 10, 9};
+    static const u8 whi[8]={8, 7, 6, 5, 4, 3, 2, 1};
+    const uint8x8_t vwlo=vld1_u8(wlo);
+    const uint8x8_t vwhi=vld1_u8(whi);
+    uint32x4_t vsum=vdupq_n_u32(0), vprev=vdupq_n_u32(0), vdot=vdupq_n_u32(0);
+    u32 blocks=len/16;
+    u32 s, p, d, ts, tw;
+    u32 i;
+    
+    for (i=0; i < blocks; i++)
+    {   uint8x16_t v=vld1q_u8(data+16*i);
+        uint16x8_t prod=vmull_u8(vget_low_u8(v), vwlo);
+        prod=vmlal_u8(prod, vget_high_u8(v), vwhi);
+        vprev=vaddq_u32(vprev, vsum);
+        vsum=vpadalq_u16(vsum, vpaddlq_u8(v));
+        vdot=vpadalq_u16(vdot, prod);
+    }
+    s=vaddvq_u32(vsum);
+    p=vaddvq_u32(vprev);
+    d=vaddvq_u32(vdot);
+    fletcher32_chunk_scalar(data+16*blocks, len-16*blocks, &ts, &tw);
+    *bytesum=s+ts;
+    *weighted=16*p+d+(len-16*blocks)*s+tw;
+}
+
+#endif // FLETCHER32_NEON
+
+// crc32c (castagnoli polynomial, as used by iscsi, ext4 and btrfs): the
+// software version uses slicing-by-8 tables which are built by checksum_init()
+#define CRC32C_POLY 0x82F63B78
+
+// the crc32c instructions have a latency of three cycles but a throughput of one
+// per cycle: large buffers are split in three streams which are combined later
+#define CRC32C_STREAM_MIN 4096
+
+typedef u32 (*crc32c_update_fct)(u32 crc, u8 *data, u32 len);
+
+static u32 crc32c_table[8][256];
+static u32 crc32c_x2n[32]; // x^(2^n) modulo the polynomial
+
+// multiply two polynomials modulo the crc polynomial (bit-reflected representation)
+static u32 crc32c_multmodp(u32 a, u32 b)
+{
+    u32 m=(u32)1<<31, p=0;
+    
+    for (;;)
+    {   if (a & m)
+        {   p^=b;
+            if ((a & (m-1))==0)
+                break;
+        }
+        m>>=1;
+        b=(b & 1) ? (b>>1)^CRC32C_POLY : b>>1;
+    }
+    return p;
+}
+
+#if defined(__x86_64__) || defined(CRC32C_ARM64)
+// returns the crc register obtained after processing len more zero bytes:
+// this allows to combine the crc of consecutive parts computed independently
+static u32 crc32c_shift(u32 crc, u64 len)
+{
+    u32 p=(u32)1<<31; // x^0
+    int k=3; // one byte is x^8 = x^(2^3)
+    
+    for (; len; len>>=1, k++)
+        if (len & 1)
+            p=crc32c_multmodp(crc32c_x2n[k&31], p);
+    return crc32c_multmodp(p, crc);
+}
+#endif
+
+static u32 crc32c_update_sw(u32 crc, u8 *data, u32 len)
+{
+    u32 lo, hi;
+    
+    while (len >= 8)
+    {   lo=crc ^ ((u32)data[0] | (u32)data[1]<<8 | (u32)data[2]<<16 | (u32)data[3]<<24);
+        hi=(u32)data[4] | (u32)data[5]<<8 | (u32)data[6]<<16 | (u32)data[7]<<24;
+        crc=crc32c_table[7][lo&0xff] ^ crc32c_table[6][(lo>>8)&0xff] ^
+            crc32c_table[5][(lo>>16)&0xff] ^ crc32c_table[4][lo>>24] ^
+            crc32c_table[3][hi&0xff] ^ crc32c_table[2][(hi>>8)&0xff] ^
+            crc32c_table[1][(hi>>16)&0xff] ^ crc32c_table[0][hi>>24];
+        data+=8;
+        len-=8;
+    }
+    while (len--)
+        crc=crc32c_table[0][(crc ^ *data++)&0xff] ^ (crc>>8);
+    return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static u32 crc32c_update_sse42(u32 crc, u8 *data, u32 len)
+{
+#ifdef __x86_64__
+    u64 crc0=crc, crc1=0, crc2=0;
+    u64 val0, val1, val2;
+    u32 part, i;
+    
+    if (len >= CRC32C_STREAM_MIN)
+    {   part=(len/3)&~7;
+        for (i=0; i < part; i+=8)
+        {   memcpy(&val0, data+i, 8);
+            memcpy(&val1, data+part+i, 8);
+            memcpy(&val2, data+2*part+i, 8);
+            crc0=_mm_crc32_u64(crc0, val0);
+            crc1=_mm_crc32_u64(crc1, val1);
+            crc2=_mm_crc32_u64(crc2, val2);
+        }
+        crc0=crc32c_shift((u32)crc0, part)^crc1;
+        crc0=crc32c_shift((u32)crc0, part)^crc2;
+        data+=3*part;
+        len-=3*part;
+    }
+    while (len >= 8)
+    {   memcpy(&val0, data, 8);
+        crc0=_mm_crc32_u64(crc0, val0);
+        data+=8;
+        len-=8;
+    }
+    crc=(u32)crc0;
+#endif // __x86_64__
+    u32 val32;
+    while (len >= 4)
+    {   memcpy(&val32, data, 4);
+        crc=_mm_crc32_u32(crc, val32);
+        data+=4;
+        len-=4;
+    }
+    while (len--)
+        crc=_mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif // CRC32C_X86
+
+#ifdef CRC32C_ARM64
+__attribute__((target("+crc")))
+static u32 crc32c_update_arm64(u32 crc, u8 *data, u32 len)
+{
+    u32 crc1=0, crc2=0;
+    u64 val0, val1, val2;
+    u32 part, i;
+    
+    if (len >= CRC32C_STREAM_MIN)
+    {   part=(len/3)&~7;
+        for (i=0; i < part; i+=8)
+        {   memcpy(&val0, data+i, 8);
+            memcpy(&val1, data+part+i, 8);
+            memcpy(&val2, data+2*part+i, 8);
+            crc=__crc32cd(crc, val0);
+            crc1=__crc32cd(crc1, val1);
+            crc2=__crc32cd(crc2, val2);
+        }
+        crc=crc32c_shift(crc, part)^crc1;
+        crc=crc32c_shift(crc, part)^crc2;
+        data+=3*part;
+        len-=3*part;
+    }
+    while (len >= 8)
+    {   memcpy(&val0, data, 8);
+        crc=__crc32cd(crc, val0);
+        data+=8;
+        len-=8;
+    }
+    while (len--)
+        crc=__crc32cb(crc, *data++);
+    return crc;
+}
+#endif // CRC32C_ARM64
+
+static fletcher32_chunk_fct fletcher32_chunk=fletcher32_chunk_scalar;
+static crc32c_update_fct crc32c_update=crc32c_update_sw;
+
+// use one of the implementations of fletcher32: returns -1 when it is not supported
+// by the cpu, the fastest one is selected by checksum_init()
+int fletcher32_select(int impl)
+{
+    fletcher32_chunk_fct fct=NULL;
+    
+#ifdef FLETCHER32_X86
+    __builtin_cpu_init();
+#endif // FLETCHER32_X86
+    switch (impl)
+    {
+        case FLETCHER32_SCALAR:
+            fct=fletcher32_chunk_scalar;
+            break;
+#ifdef FLETCHER32_X86
+        case FLETCHER32_SSE2:
+            if (__builtin_cpu_supports("sse2"))
+                fct=fletcher32_chunk_sse2;
+            break;
+        case FLETCHER32_AVX2:
+            if (__builtin_cpu_supports("avx2"))
+                fct=fletcher32_chunk_avx2;
+            break;
+        case FLETCHER32_AVX512:
+            if (__builtin_cpu_supports("avx512bw"))
+                fct=fletcher32_chunk_avx512;
+            break;
+#endif // FLETCHER32_X86
+#ifdef FLETCHER32_NEON
+        case FLETCHER32_NEON:
+            fct=fletcher32_chunk_neon;
+            break;
+#endif // FLETCHER32_NEON
+    }
+    if (fct==NULL)
+        return -1;
+    fletcher32_chunk=fct;
+    return 0;
+}
+
+char *fletcher32_implstr(int impl)
+{
+    switch (impl)
+    {
+        case FLETCHER32_SCALAR:  return "scalar";
+        case FLETCHER32_SSE2:    return "sse2";
+        case FLETCHER32_AVX2:    return "avx2";
+        case FLETCHER32_AVX512:  return "avx512";
+        case FLETCHER32_NEON:    return "neon";
+        default:                 return "unknown";
+    }
+}
+
+// select the fastest implementation supported by the cpu: must be called
+// once from main() before any thread is started
+void checksum_init()
+{
+    u32 crc;
+    int i, j;
+    
+    for (i=0; i < 256; i++)
+    {   crc=i;
+        for (j=0; j < 8; j++)
+            crc=(crc>>1) ^ ((crc&1) ? CRC32C_POLY : 0);
+        crc32c_table[0][i]=crc;
+    }
+    for (i=0; i < 256; i++)
+        for (j=1; j < 8; j++)
+            crc32c_table[j][i]=(crc32c_table[j-1][i]>>8) ^ crc32c_table[0][crc32c_table[j-1][i]&0xff];
+    crc32c_x2n[0]=(u32)1<<30; // x^1
+    for (i=1; i < 32; i++)
+        crc32c_x2n[i]=crc32c_multmodp(crc32c_x2n[i-1], crc32c_x2n[i-1]);
+    
+    // the implementations of fletcher32 are listed from the slowest to the fastest
+    for (i=FLETCHER32_IMPLCOUNT-1; i > FLETCHER32_SCALAR && fletcher32_select(i)!=0; i--)
+        continue;
+    
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_update=crc32c_update_sse42;
+#endif // CRC32C_X86
+#ifdef CRC32C_ARM64
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+        crc32c_update=crc32c_update_arm64;
+#endif // CRC32C_ARM64
+}
+
+u32 fletcher32(u8 *data, u32 len)
+{
+    u32 sum1 = 0xffff, sum2 = 0xffff;
+    u32 tlen, bytesum, weighted;
+    
+    while (len)
+    {
+        tlen = len > FLETCHER32_CHUNK ? FLETCHER32_CHUNK : len;
+        fletcher32_chunk(data, tlen, &bytesum, &weighted);
+        sum2 += tlen * sum1 + weighted;
+        sum1 += bytesum;
+        data += tlen;
+        len -= tlen;
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+    // Second reduction step to reduce sums to 16 bits
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    return sum2 << 16 | sum1;
+}
+
+u32 crc32c(u8 *data, u32 len)
+{
+    return ~crc32c_update(0xffffffff, data, len);
+}
+
+// checksum of a data block as it is stored in the archive
+u32 block_checksum(u16 algo, u8 *data, u32 len)
+{
+    switch (algo)
+    {
+        case CSUM_CRC32C:      return crc32c(data, len);
+        default:               return fletcher32(data, len);
+    }
+}
+
+char *csumalgostr(int algo)
+{
+    switch (algo)
+    {
+        case CSUM_FLETCHER32:  return "fletcher32";
+        case CSUM_CRC32C:      return "crc32c";
+        default:               return "unknown";
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include "types.h"
+
+enum {FLETCHER32_SCALAR=0, FLETCHER32_SSE2, FLETCHER32_AVX2, FLETCHER32_AVX512, FLETCHER32_NEON, FLETCHER32_IMPLCOUNT};
+
+void checksum_init();
+int fletcher32_select(int impl);
+char *fletcher32_implstr(int impl);
+u32 fletcher32(u8 *data, u32 len);
+u32 crc32c(u8 *data, u32 len);
+u32 block_checksum(u16 algo, u8 *data, u32 len);
+char *csumalgostr(int algo);
+
+#endif // __CHECKSUM_H__
@@ -30,7 +30,6 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <wordexp.h>
-#include <fnmatch.h>
 #include <time.h>
 #include <limits.h>
 
@@ -221,25 +220,43 @@ u32 generate_random_u32_id(void)
     return archid;
 }
 
-u32 fletcher32(u8 *data, u32 len)
+// returns true if the buffer only contains zeros: once the first bytes are known to
+// be zero, comparing the buffer with itself shifted lets memcmp() use vector instructions
+int is_buffer_zero(u8 *data, u64 len)
 {
-    u32 sum1 = 0xffff, sum2 = 0xffff;
+    u64 i;
     
-    while (len)
-    {
-        unsigned tlen = len > 360 ? 360 : len;
-        len -= tlen;
-        do {
-            sum1 += *data++;
-            sum2 += sum1;
-        } while (--tlen);
-        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-    }
-    // Second reduction step to reduce sums to 16 bits
-    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-    return sum2 << 16 | sum1;
+    for (i=0; (i < len) && (i < 16); i++)
+        if (data[i]!=0)
+            return false;
+    
+    return (len <= 16) || (memcmp(data, data+16, len-16)==0);
+}
+
+// estimates if a block is incompressible (media, compressed or encrypted data) from a sample
+// of its bytes: the sum of the squares of the byte counts is close to its minimum (n*n/256)
+// when all the values are equally frequent, and it's much bigger for compressible data
+int is_buffer_incompressible(u8 *data, u64 len)
+{
+    u32 count[256];
+    u64 sumsq=0;
+    u64 step;
+    int i, j;
+    
+    if (len < FSA_PROBE_SLICES*FSA_PROBE_SLICESIZE)
+        return false;
+    
+    memset(count, 0, sizeof(count));
+    step=len/FSA_PROBE_SLICES;
+    for (i=0; i < FSA_PROBE_SLICES; i++)
+        for (j=0; j < FSA_PROBE_SLICESIZE; j++)
+            count[data[i*step+j]]++;
+    
+    for (i=0; i < 256; i++)
+        sumsq+=(u64)count[i]*count[i];
+    
+    // random data gives n*n/256+n on average: 69632 for a sample of 4096 bytes
+    return sumsq < (u64)FSA_PROBE_SLICES*FSA_PROBE_SLICESIZE*FSA_PROBE_SLICES*FSA_PROBE_SLICESIZE/256*5/4;
 }
 
 int regfile_exists(char *filepath)
@@ -576,22 +593,6 @@ int format_stacktrace(char *buffer, int bufsize)
     return 0;
 }
 
-int exclude_check(cstrlist *patlist, char *string)
-{
-    char pattern[1024];
-    int count;
-    int i;
-    
-    count=strlist_count(patlist);
-    for (i=0; i < count; i++)
-    {
-        strlist_getitem(patlist, i, pattern, sizeof(pattern));
-        if (fnmatch(pattern, string, 0)==0)
-            return true;
-    }
-    return false;
-}
-
 int get_path_to_volume(char *newvolbuf, int bufsize, char *basepath, long curvol)
 {
     char prefix[PATH_MAX];
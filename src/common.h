@@ -21,7 +21,6 @@
 #include <stdio.h>
 
 struct timeval;
-struct s_strlist;
 struct s_stats;
 
 int exec_command(char *command, int cmdbufsize, int *exitst, char *stdoutbuf, int stdoutsize, char *stderrbuf, int stderrsize, char *format, ...);
@@ -41,14 +40,14 @@ int mkdir_recursive(char *path);
 char *get_objtype_name(int objtype);
 int is_dir_empty(char *path);
 u32 generate_random_u32_id(void);
-u32 fletcher32(u8 *data, u32 len);
+int is_buffer_zero(u8 *data, u64 len);
+int is_buffer_incompressible(u8 *data, u64 len);
 int regfile_exists(char *filepath);
 int is_magic_valid(char *magic);
 char *strlcatf(char *dest, int destbufsize, char *format, ...) __attribute__ ((format (printf, 3, 4)));
 int format_stacktrace(char *buffer, int bufsize);
 int stats_show(struct s_stats, int fsid);
 u64 stats_errcount(struct s_stats stats);
-int exclude_check(struct s_strlist *patlist, char *string);
 int get_path_to_volume(char *newvolbuf, int bufsize, char *basepath, long curvol);
 s64 get_device_size(char *partition);
 
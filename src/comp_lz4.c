@@ -27,6 +27,8 @@
 
 
 #ifdef OPTION_LZ4_SUPPORT
+// level 0 is the default lz4, negative levels are faster (acceleration 1-level)
+// and positive levels use lz4hc: the data are decompressed the same way
 int compress_block_lz4(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
 {
     int destsize=compbufsize;
@@ -34,10 +36,21 @@ int compress_block_lz4(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u6
 
 #define LZ4_VERSION (LZ4_VERSION_MAJOR*10 + LZ4_VERSION_MINOR)
 #if LZ4_VERSION >= 17
-    res=LZ4_compress_default((const char*)origbuf, (char*)compbuf, (int)origsize, destsize);
-    if (res==0){
-        errprintf("LZ4_compress_default(): failed.\n");
-        return FSAERR_UNKNOWN;
+    if (level>0)
+    {
+        res=LZ4_compress_HC((const char*)origbuf, (char*)compbuf, (int)origsize, destsize, level);
+        if (res==0){
+            errprintf("LZ4_compress_HC(%d): failed.\n", level);
+            return FSAERR_UNKNOWN;
+        }
+    }
+    else
+    {
+        res=LZ4_compress_fast((const char*)origbuf, (char*)compbuf, (int)origsize, destsize, 1-level);
+        if (res==0){
+            errprintf("LZ4_compress_fast(%d): failed.\n", 1-level);
+            return FSAERR_UNKNOWN;
+        }
     }
 #else
     res=LZ4_compress((const char*)origbuf, (char*)compbuf, (int)origsize);
@@ -22,6 +22,7 @@
 #ifdef OPTION_LZ4_SUPPORT
 
 #include <lz4.h>
+#include <lz4hc.h>
 
 int compress_block_lz4(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
 int uncompress_block_lz4(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
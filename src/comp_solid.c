@@ -0,0 +1,575 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "fsarchiver.h"
+#include "common.h"
+#include "options.h"
+#include "comp_solid.h"
+#include "error.h"
+
+#ifdef OPTION_ZSTD_SUPPORT
+#include <zstd.h>
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZMA_SUPPORT
+#include <lzma.h>
+#endif // OPTION_LZMA_SUPPORT
+
+// a solid segment is a sequence of blocks which are compressed as a single stream: each block
+// is flushed so that it has its own payload, but it can refer to the data of the previous blocks
+// of its segment. The queue gives the blocks of a segment to the compression threads one at a
+// time and in order, and the segments which are in the queue are compressed in parallel.
+struct s_solidseg;
+typedef struct s_solidseg csolidseg;
+
+struct s_solidseg
+{   u32         segid;
+    u16         fsid;
+    u16         compalgo; // COMPRESS_NULL until the first block starts the stream
+    int         level; // compression level of the whole segment
+    bool        encoder;
+    u32         position; // number of blocks which have gone through the stream
+#ifdef OPTION_ZSTD_SUPPORT
+    ZSTD_CCtx   *zcctx;
+    ZSTD_DCtx   *zdctx;
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZMA_SUPPORT
+    lzma_stream lzma;
+#endif // OPTION_LZMA_SUPPORT
+    u64         queued; // number of blocks of the segment which have been put in the queue
+    u64         done; // number of blocks which have gone through the stream or which have been skipped
+    bool        closed; // no more blocks will be put in the queue for this segment
+    bool        broken; // a block is missing or corrupt: the next ones cannot be decompressed
+    csolidseg   *next;
+};
+
+static pthread_mutex_t solidmutex=PTHREAD_MUTEX_INITIALIZER;
+static csolidseg *solidsegs=NULL;
+
+// current segment of each stream (only used by the thread which puts the blocks in the queue)
+static u32 solidnextid=1;
+static u32 solidcursegid[SOLID_STREAM_COUNT];
+static u64 solidcurbytes[SOLID_STREAM_COUNT];
+
+static csolidseg *solidlocked_find(u32 segid)
+{
+    csolidseg *seg;
+    
+    for (seg=solidsegs; (seg!=NULL) && (seg->segid!=segid); seg=seg->next);
+    return seg;
+}
+
+static csolidseg *solidlocked_register(u32 segid, u16 fsid)
+{
+    csolidseg *seg;
+    
+    if ((seg=solidlocked_find(segid))==NULL)
+    {
+        if ((seg=calloc(1, sizeof(csolidseg)))==NULL)
+        {   errprintf("calloc(%ld) failed: out of memory\n", (long)sizeof(csolidseg));
+            return NULL;
+        }
+        seg->segid=segid;
+        seg->fsid=fsid;
+        seg->compalgo=COMPRESS_NULL;
+        seg->next=solidsegs;
+        solidsegs=seg;
+    }
+    seg->queued++;
+    return seg;
+}
+
+// remove the segment from the list when all its blocks have been processed
+static bool solidlocked_unlink_if_finished(csolidseg *seg)
+{
+    csolidseg **prev;
+    
+    if (seg->closed==false || seg->done < seg->queued)
+        return false;
+    for (prev=&solidsegs; (*prev!=NULL) && (*prev!=seg); prev=&(*prev)->next);
+    if (*prev==seg)
+        *prev=seg->next;
+    return true;
+}
+
+static void solid_free(csolidseg *seg)
+{
+#ifdef OPTION_ZSTD_SUPPORT
+    if (seg->zcctx!=NULL)
+        ZSTD_freeCCtx(seg->zcctx);
+    if (seg->zdctx!=NULL)
+        ZSTD_freeDCtx(seg->zdctx);
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZMA_SUPPORT
+    if (seg->compalgo==COMPRESS_LZMA)
+        lzma_end(&seg->lzma);
+#endif // OPTION_LZMA_SUPPORT
+    free(seg);
+}
+
+// called when a block of the segment has been processed (or will never be)
+static void solid_release(csolidseg *seg)
+{
+    bool finished;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    seg->done++;
+    finished=solidlocked_unlink_if_finished(seg);
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    if (finished==true)
+        solid_free(seg);
+}
+
+static void solid_segment_close(u32 segid)
+{
+    csolidseg *seg;
+    bool finished=false;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    if ((seg=solidlocked_find(segid))!=NULL)
+    {   seg->closed=true;
+        finished=solidlocked_unlink_if_finished(seg);
+    }
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    if (finished==true)
+        solid_free(seg);
+}
+
+// returns the segment of the next block of a stream, which is closed once it has the requested size
+u32 solid_segment_assign(int stream, u16 fsid, u32 blksize)
+{
+    u32 segid;
+    
+    if (stream<0 || stream>=SOLID_STREAM_COUNT)
+        return 0;
+    
+    if (solidcursegid[stream]==0)
+    {   solidcursegid[stream]=solidnextid++;
+        solidcurbytes[stream]=0;
+    }
+    segid=solidcursegid[stream];
+    
+    if (solid_segment_queued(segid, fsid)!=0) // the block will be compressed on its own
+        return 0;
+    
+    solidcurbytes[stream]+=blksize;
+    if (solidcurbytes[stream] >= g_options.solidsize)
+    {   solid_segment_close(segid);
+        solidcursegid[stream]=0;
+    }
+    
+    return segid;
+}
+
+// the segments never cross the end of a filesystem so that the others can be restored without it
+void solid_segment_close_streams()
+{
+    int i;
+    
+    for (i=0; i < SOLID_STREAM_COUNT; i++)
+    {
+        if (solidcursegid[i]!=0)
+            solid_segment_close(solidcursegid[i]);
+        solidcursegid[i]=0;
+    }
+}
+
+int solid_segment_queued(u32 segid, u16 fsid)
+{
+    csolidseg *seg;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    seg=solidlocked_register(segid, fsid);
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    return (seg!=NULL)?0:-1;
+}
+
+// a block of the segment is corrupt and it is not decompressed: the next ones cannot be either
+void solid_segment_broken(u32 segid, u16 fsid)
+{
+    csolidseg *seg;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    if ((seg=solidlocked_register(segid, fsid))!=NULL)
+        seg->broken=true;
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    if (seg!=NULL)
+        solid_release(seg);
+}
+
+// the end of a filesystem has been read from the archive: its segments do not have more blocks
+void solid_segment_close_fs(u16 fsid)
+{
+    csolidseg *finished=NULL;
+    csolidseg *seg;
+    csolidseg *next;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    for (seg=solidsegs; seg!=NULL; seg=next)
+    {
+        next=seg->next;
+        if (fsid==FSA_FILESYSID_NULL || seg->fsid==fsid)
+        {   seg->closed=true;
+            if (solidlocked_unlink_if_finished(seg)==true)
+            {   seg->next=finished;
+                finished=seg;
+            }
+        }
+    }
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    for (seg=finished; seg!=NULL; seg=next)
+    {   next=seg->next;
+        solid_free(seg);
+    }
+}
+
+// how many blocks the queue must accept so that each compression thread can work on a segment
+s64 solid_queue_size(u64 solidsize)
+{
+    s64 count;
+    
+    count=(s64)g_options.compressjobs * (s64)((solidsize + g_options.datablocksize - 1) / g_options.datablocksize);
+    return max(count, FSA_MAX_QUEUESIZE);
+}
+
+// the block is not compressed (incompressible data): it does not go through the stream
+void solid_segment_skip(u32 segid)
+{
+    csolidseg *seg;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    seg=solidlocked_find(segid);
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    if (seg!=NULL)
+        solid_release(seg);
+}
+
+void solid_destroy_all()
+{
+    csolidseg *seg;
+    csolidseg *next;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    for (seg=solidsegs; seg!=NULL; seg=next)
+    {   next=seg->next;
+        solid_free(seg);
+    }
+    solidsegs=NULL;
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    solidnextid=1;
+    memset(solidcursegid, 0, sizeof(solidcursegid));
+}
+
+#ifdef OPTION_ZSTD_SUPPORT
+// the window must cover the whole segment so that its last block can refer to the first one
+static int solid_window_log()
+{
+    int windowlog;
+    
+    for (windowlog=FSA_SOLID_MINWINDOWLOG; (windowlog < FSA_SOLID_MAXWINDOWLOG) && ((1ULL<<windowlog) < g_options.solidsize); windowlog++);
+    return windowlog;
+}
+
+static int solid_start_zstd(csolidseg *seg, bool encoder, int level)
+{
+    size_t res=0;
+    
+    if (encoder==true)
+    {
+        if ((seg->zcctx=ZSTD_createCCtx())==NULL)
+            return FSAERR_ENOMEM;
+        // long distance matching finds the repetitions which are far from each other in the window
+        if (ZSTD_isError((res=ZSTD_CCtx_setParameter(seg->zcctx, ZSTD_c_compressionLevel, level))) ||
+            ZSTD_isError((res=ZSTD_CCtx_setParameter(seg->zcctx, ZSTD_c_windowLog, solid_window_log()))) ||
+            ZSTD_isError((res=ZSTD_CCtx_setParameter(seg->zcctx, ZSTD_c_enableLongDistanceMatching, 1))))
+        {   errprintf("ZSTD_CCtx_setParameter() failed: res=%s\n", ZSTD_getErrorName(res));
+            return FSAERR_UNKNOWN;
+        }
+    }
+    else
+    {
+        if ((seg->zdctx=ZSTD_createDCtx())==NULL)
+            return FSAERR_ENOMEM;
+        if (ZSTD_isError((res=ZSTD_DCtx_setParameter(seg->zdctx, ZSTD_d_windowLogMax, FSA_SOLID_MAXWINDOWLOG))))
+        {   errprintf("ZSTD_DCtx_setParameter() failed: res=%s\n", ZSTD_getErrorName(res));
+            return FSAERR_UNKNOWN;
+        }
+    }
+    return FSAERR_SUCCESS;
+}
+
+static int solid_compress_zstd(csolidseg *seg, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize)
+{
+    ZSTD_inBuffer in={origbuf, origsize, 0};
+    ZSTD_outBuffer out={compbuf, compbufsize, 0};
+    size_t res;
+    
+    // ZSTD_e_flush writes all the data of the block without ending the frame
+    do
+    {
+        if (ZSTD_isError((res=ZSTD_compressStream2(seg->zcctx, &out, &in, ZSTD_e_flush))))
+        {   errprintf("ZSTD_compressStream2(): failed: res=%s\n", ZSTD_getErrorName(res));
+            return FSAERR_UNKNOWN;
+        }
+    } while ((res > 0) && (out.pos < out.size));
+    
+    if (res > 0)
+    {   errprintf("ZSTD_compressStream2(): the output buffer is too small\n");
+        return FSAERR_UNKNOWN;
+    }
+    *compsize=(u64)out.pos;
+    return FSAERR_SUCCESS;
+}
+
+static int solid_uncompress_zstd(csolidseg *seg, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+{
+    ZSTD_inBuffer in={compbuf, compsize, 0};
+    ZSTD_outBuffer out={origbuf, origbufsize, 0};
+    size_t inpos, outpos;
+    size_t res;
+    
+    do
+    {   inpos=in.pos;
+        outpos=out.pos;
+        if (ZSTD_isError((res=ZSTD_decompressStream(seg->zdctx, &out, &in))))
+        {   errprintf("ZSTD_decompressStream(): failed: res=%s\n", ZSTD_getErrorName(res));
+            return FSAERR_UNKNOWN;
+        }
+    } while ((in.pos < in.size || out.pos < out.size) && (in.pos!=inpos || out.pos!=outpos));
+    
+    *origsize=(u64)out.pos;
+    return (in.pos==in.size && out.pos==out.size)?FSAERR_SUCCESS:FSAERR_UNKNOWN;
+}
+#endif // OPTION_ZSTD_SUPPORT
+
+#ifdef OPTION_LZMA_SUPPORT
+static int solid_start_lzma(csolidseg *seg, bool encoder, int level)
+{
+    lzma_stream init=LZMA_STREAM_INIT;
+    u64 memlimit=3ULL*1024ULL*1024ULL*1024ULL;
+    lzma_options_lzma opt;
+    lzma_filter filters[2];
+    int res;
+    
+    seg->lzma=init;
+    if (encoder==true)
+    {
+        if (lzma_lzma_preset(&opt, level))
+        {   errprintf("lzma_lzma_preset(%d) failed\n", level);
+            return FSAERR_EINVAL;
+        }
+        // the dictionary must cover the whole segment like the window of zstd
+        opt.dict_size=max(opt.dict_size, (u32)min(g_options.solidsize, FSA_MAX_SOLIDSIZE));
+        filters[0].id=LZMA_FILTER_LZMA2;
+        filters[0].options=&opt;
+        filters[1].id=LZMA_VLI_UNKNOWN;
+        filters[1].options=NULL;
+        res=lzma_stream_encoder(&seg->lzma, filters, LZMA_CHECK_NONE); // the blocks have their own checksum
+    }
+    else
+    {
+        res=lzma_stream_decoder(&seg->lzma, memlimit, 0);
+    }
+    
+    switch (res)
+    {
+        case LZMA_OK:
+            return FSAERR_SUCCESS;
+        case LZMA_MEM_ERROR:
+            errprintf("lzma_stream_%scoder(%d) failed with an out of memory error\n", encoder?"en":"de", level);
+            return FSAERR_ENOMEM;
+        default:
+            errprintf("lzma_stream_%scoder(%d) failed with res=%d\n", encoder?"en":"de", level, res);
+            return FSAERR_UNKNOWN;
+    }
+}
+
+static int solid_compress_lzma(csolidseg *seg, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize)
+{
+    int res;
+    
+    seg->lzma.next_in=origbuf;
+    seg->lzma.avail_in=origsize;
+    seg->lzma.next_out=compbuf;
+    seg->lzma.avail_out=compbufsize;
+    
+    // LZMA_SYNC_FLUSH writes all the data of the block without ending the stream
+    while (((res=lzma_code(&seg->lzma, LZMA_SYNC_FLUSH))==LZMA_OK) && (seg->lzma.avail_out > 0));
+    if (res!=LZMA_STREAM_END)
+    {   errprintf("lzma_code(LZMA_SYNC_FLUSH) failed with res=%d\n", res);
+        return FSAERR_UNKNOWN;
+    }
+    *compsize=compbufsize-seg->lzma.avail_out;
+    return FSAERR_SUCCESS;
+}
+
+static int solid_uncompress_lzma(csolidseg *seg, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+{
+    int res=LZMA_OK;
+    
+    seg->lzma.next_in=compbuf;
+    seg->lzma.avail_in=compsize;
+    seg->lzma.next_out=origbuf;
+    seg->lzma.avail_out=origbufsize;
+    
+    // lzma_code() returns LZMA_BUF_ERROR when it cannot make any progress
+    while ((seg->lzma.avail_in > 0 || seg->lzma.avail_out > 0) && ((res=lzma_code(&seg->lzma, LZMA_RUN))==LZMA_OK));
+    
+    *origsize=origbufsize-seg->lzma.avail_out;
+    if (seg->lzma.avail_in > 0 || seg->lzma.avail_out > 0)
+    {   errprintf("lzma_code(LZMA_RUN) failed with res=%d\n", res);
+        return FSAERR_UNKNOWN;
+    }
+    return FSAERR_SUCCESS;
+}
+#endif // OPTION_LZMA_SUPPORT
+
+static int solid_start(csolidseg *seg, u16 compalgo, bool encoder, int level)
+{
+    int res;
+    
+    switch (compalgo)
+    {
+#ifdef OPTION_ZSTD_SUPPORT
+        case COMPRESS_ZSTD:
+            res=solid_start_zstd(seg, encoder, level);
+            break;
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZMA_SUPPORT
+        case COMPRESS_LZMA:
+            res=solid_start_lzma(seg, encoder, level);
+            break;
+#endif // OPTION_LZMA_SUPPORT
+        default:
+            errprintf("compression algorithm %d cannot be used in solid mode\n", (int)compalgo);
+            return FSAERR_EINVAL;
+    }
+    
+    // the stream is released by solid_free() even if it has not been started completely
+    seg->compalgo=compalgo;
+    seg->encoder=encoder;
+    seg->level=level;
+    return res;
+}
+
+int compress_block_solid(u32 segid, u32 *segpos, u16 compalgo, int *level, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize)
+{
+    csolidseg *seg;
+    int res=FSAERR_SUCCESS;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    seg=solidlocked_find(segid);
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    if (seg==NULL)
+    {   errprintf("solid segment %ld is unknown\n", (long)segid);
+        return FSAERR_ENOENT;
+    }
+    
+    // the first block of the segment chooses the level of all the others
+    if (seg->compalgo==COMPRESS_NULL)
+        res=solid_start(seg, compalgo, true, *level);
+    else if (seg->compalgo!=compalgo || seg->encoder==false)
+        res=FSAERR_EINVAL;
+    *level=seg->level;
+    
+    if (res==FSAERR_SUCCESS)
+    {
+        switch (compalgo)
+        {
+#ifdef OPTION_ZSTD_SUPPORT
+            case COMPRESS_ZSTD:
+                res=solid_compress_zstd(seg, origsize, compsize, origbuf, compbuf, compbufsize);
+                break;
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZMA_SUPPORT
+            case COMPRESS_LZMA:
+                res=solid_compress_lzma(seg, origsize, compsize, origbuf, compbuf, compbufsize);
+                break;
+#endif // OPTION_LZMA_SUPPORT
+        }
+    }
+    *segpos=seg->position++; // written in the header so that missing blocks are detected
+    
+    solid_release(seg);
+    return res;
+}
+
+int uncompress_block_solid(u32 segid, u32 segpos, u16 compalgo, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+{
+    csolidseg *seg;
+    int res=FSAERR_SUCCESS;
+    
+    assert(pthread_mutex_lock(&solidmutex)==0);
+    seg=solidlocked_find(segid);
+    assert(pthread_mutex_unlock(&solidmutex)==0);
+    
+    *origsize=0;
+    if (seg==NULL)
+    {   errprintf("solid segment %ld is unknown\n", (long)segid);
+        return FSAERR_ENOENT;
+    }
+    
+    if (seg->broken==true || segpos!=seg->position)
+    {   errprintf("cannot decompress the block: a previous block of its solid segment is missing or corrupt\n");
+        res=FSAERR_UNKNOWN;
+    }
+    else if (seg->compalgo==COMPRESS_NULL)
+        res=solid_start(seg, compalgo, false, 0);
+    else if (seg->compalgo!=compalgo || seg->encoder==true)
+        res=FSAERR_EINVAL;
+    
+    if (res==FSAERR_SUCCESS)
+    {
+        switch (compalgo)
+        {
+#ifdef OPTION_ZSTD_SUPPORT
+            case COMPRESS_ZSTD:
+                res=solid_uncompress_zstd(seg, compsize, origsize, origbuf, origbufsize, compbuf);
+                break;
+#endif // OPTION_ZSTD_SUPPORT
+#ifdef OPTION_LZMA_SUPPORT
+            case COMPRESS_LZMA:
+                res=solid_uncompress_lzma(seg, compsize, origsize, origbuf, origbufsize, compbuf);
+                break;
+#endif // OPTION_LZMA_SUPPORT
+        }
+    }
+    seg->position++;
+    
+    // the history of the stream is lost: the next blocks of the segment cannot be decompressed
+    if (res!=FSAERR_SUCCESS)
+        seg->broken=true;
+    
+    solid_release(seg);
+    return res;
+}
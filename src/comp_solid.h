@@ -0,0 +1,39 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __COMPRESS_SOLID_H__
+#define __COMPRESS_SOLID_H__
+
+// the reader has two independent streams of blocks which are split in segments (option --solid)
+enum {SOLID_STREAM_LARGEFILES=0, SOLID_STREAM_SMALLFILES, SOLID_STREAM_COUNT};
+
+// functions used by the thread which puts the blocks in the queue
+u32  solid_segment_assign(int stream, u16 fsid, u32 blksize);
+void solid_segment_close_streams();
+int  solid_segment_queued(u32 segid, u16 fsid);
+void solid_segment_broken(u32 segid, u16 fsid);
+void solid_segment_close_fs(u16 fsid);
+s64  solid_queue_size(u64 solidsize);
+
+// functions used by the compression threads
+void solid_segment_skip(u32 segid);
+int  compress_block_solid(u32 segid, u32 *segpos, u16 compalgo, int *level, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize);
+int  uncompress_block_solid(u32 segid, u32 segpos, u16 compalgo, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+
+void solid_destroy_all();
+
+#endif // __COMPRESS_SOLID_H__
@@ -20,11 +20,22 @@
 #  include "config.h"
 #endif
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <pthread.h>
+
 #include "fsarchiver.h"
 #include "common.h"
 #include "comp_zstd.h"
 #include "error.h"
 
+#ifdef OPTION_ZSTD_SUPPORT
+#include <zdict.h>
+#endif // OPTION_ZSTD_SUPPORT
 
 #ifdef OPTION_ZSTD_SUPPORT
 int compress_block_zstd(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
@@ -54,4 +65,248 @@ int uncompress_block_zstd(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufs
         return FSAERR_SUCCESS;
     }
 }
+
+// dictionary of each filesystem used for the blocks of small files: the compression
+// threads digest it once for each level which is used (ZSTD_CDict) and the
+// decompression threads once (ZSTD_DDict)
+struct s_zstddict
+{   u8         *data; // NULL when the filesystem has no dictionary
+    u32        size;
+    ZSTD_CDict *cdict[FSA_ZSTDDICT_MAXLEVELS];
+    int        cdictlevel[FSA_ZSTDDICT_MAXLEVELS];
+    int        cdictcount;
+    ZSTD_DDict *ddict;
+};
+
+static struct s_zstddict zstddicts[FSA_MAX_FSPERARCH];
+static pthread_mutex_t zstddictmutex=PTHREAD_MUTEX_INITIALIZER;
+
+int zstd_dict_set(u16 fsid, u8 *data, u32 size)
+{
+    struct s_zstddict *dict;
+    
+    if (fsid>=FSA_MAX_FSPERARCH || size==0)
+    {   errprintf("invalid param: fsid=%d, size=%ld\n", (int)fsid, (long)size);
+        return -1;
+    }
+    
+    assert(pthread_mutex_lock(&zstddictmutex)==0);
+    dict=&zstddicts[fsid];
+    if (dict->data==NULL && (dict->data=malloc(size))!=NULL)
+    {   memcpy(dict->data, data, size);
+        dict->size=size;
+    }
+    assert(pthread_mutex_unlock(&zstddictmutex)==0);
+    
+    if (dict->data==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)size);
+        return -1;
+    }
+    return 0;
+}
+
+bool zstd_dict_exists(u16 fsid)
+{
+    bool exists;
+    
+    if (fsid>=FSA_MAX_FSPERARCH)
+        return false;
+    assert(pthread_mutex_lock(&zstddictmutex)==0);
+    exists=(zstddicts[fsid].data!=NULL);
+    assert(pthread_mutex_unlock(&zstddictmutex)==0);
+    return exists;
+}
+
+void zstd_dict_destroy_all()
+{
+    struct s_zstddict *dict;
+    int i, j;
+    
+    assert(pthread_mutex_lock(&zstddictmutex)==0);
+    for (i=0; i < FSA_MAX_FSPERARCH; i++)
+    {
+        dict=&zstddicts[i];
+        for (j=0; j < dict->cdictcount; j++)
+            ZSTD_freeCDict(dict->cdict[j]);
+        if (dict->ddict!=NULL)
+            ZSTD_freeDDict(dict->ddict);
+        free(dict->data);
+        memset(dict, 0, sizeof(struct s_zstddict));
+    }
+    assert(pthread_mutex_unlock(&zstddictmutex)==0);
+}
+
+static ZSTD_CDict *zstd_dict_get_cdict(u16 fsid, int level)
+{
+    struct s_zstddict *dict;
+    ZSTD_CDict *cdict=NULL;
+    int i;
+    
+    assert(pthread_mutex_lock(&zstddictmutex)==0);
+    dict=&zstddicts[fsid];
+    for (i=0; (i < dict->cdictcount) && (cdict==NULL); i++)
+        if (dict->cdictlevel[i]==level)
+            cdict=dict->cdict[i];
+    if (cdict==NULL && dict->data!=NULL && dict->cdictcount<FSA_ZSTDDICT_MAXLEVELS)
+    {   if ((cdict=ZSTD_createCDict(dict->data, dict->size, level))!=NULL)
+        {   dict->cdictlevel[dict->cdictcount]=level;
+            dict->cdict[dict->cdictcount++]=cdict;
+        }
+    }
+    assert(pthread_mutex_unlock(&zstddictmutex)==0);
+    return cdict;
+}
+
+static ZSTD_DDict *zstd_dict_get_ddict(u16 fsid)
+{
+    struct s_zstddict *dict;
+    ZSTD_DDict *ddict;
+    
+    assert(pthread_mutex_lock(&zstddictmutex)==0);
+    dict=&zstddicts[fsid];
+    if (dict->ddict==NULL && dict->data!=NULL)
+        dict->ddict=ZSTD_createDDict(dict->data, dict->size);
+    ddict=dict->ddict;
+    assert(pthread_mutex_unlock(&zstddictmutex)==0);
+    return ddict;
+}
+
+int compress_block_zstd_dict(u16 fsid, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level)
+{
+    ZSTD_CDict *cdict;
+    ZSTD_CCtx *cctx;
+    size_t res;
+    
+    if (fsid>=FSA_MAX_FSPERARCH || (cdict=zstd_dict_get_cdict(fsid, level))==NULL)
+        return FSAERR_ENOMEM;
+    
+    if ((cctx=ZSTD_createCCtx())==NULL)
+        return FSAERR_ENOMEM;
+    res=ZSTD_compress_usingCDict(cctx, compbuf, compbufsize, origbuf, origsize, cdict);
+    ZSTD_freeCCtx(cctx);
+    if (ZSTD_isError(res))
+    {   errprintf("ZSTD_compress_usingCDict(): failed: res=%s\n", ZSTD_getErrorName(res));
+        return FSAERR_UNKNOWN;
+    }
+    *compsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
+
+int uncompress_block_zstd_dict(u16 fsid, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf)
+{
+    ZSTD_DDict *ddict;
+    ZSTD_DCtx *dctx;
+    size_t res;
+    
+    if (fsid>=FSA_MAX_FSPERARCH || (ddict=zstd_dict_get_ddict(fsid))==NULL)
+    {   errprintf("the block has been compressed with the dictionary of filesystem %d which is missing\n", (int)fsid);
+        return FSAERR_UNKNOWN;
+    }
+    
+    if ((dctx=ZSTD_createDCtx())==NULL)
+        return FSAERR_ENOMEM;
+    res=ZSTD_decompress_usingDDict(dctx, origbuf, origbufsize, compbuf, compsize, ddict);
+    ZSTD_freeDCtx(dctx);
+    if (ZSTD_isError(res))
+    {   errprintf("ZSTD_decompress_usingDDict(): failed: res=%s\n", ZSTD_getErrorName(res));
+        return FSAERR_UNKNOWN;
+    }
+    *origsize=(u64)res;
+    return FSAERR_SUCCESS;
+}
+
+void zstd_samples_init(czstdsamples *s)
+{
+    memset(s, 0, sizeof(czstdsamples));
+    s->rand=0x9E3779B97F4A7C15ULL;
+}
+
+void zstd_samples_destroy(czstdsamples *s)
+{
+    int i;
+    
+    for (i=0; i < s->count; i++)
+        free(s->data[i]);
+    memset(s, 0, sizeof(czstdsamples));
+}
+
+// consider a small file for the samples: it is only read when it is selected
+int zstd_samples_add(czstdsamples *s, char *fullpath, u64 filesize)
+{
+    u64 slot;
+    s64 res;
+    u32 size;
+    u8 *data;
+    int fd;
+    
+    if (filesize==0)
+        return 0;
+    
+    s->seen++;
+    if (s->count < FSA_ZSTDDICT_SAMPLES)
+    {   slot=s->count;
+    }
+    else
+    {   s->rand^=s->rand<<13, s->rand^=s->rand>>7, s->rand^=s->rand<<17; // xorshift64
+        if ((slot=s->rand%s->seen) >= FSA_ZSTDDICT_SAMPLES)
+            return 0;
+    }
+    
+    size=(u32)min(filesize, FSA_ZSTDDICT_SAMPLESIZE);
+    if ((data=malloc(size))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)size);
+        return -1;
+    }
+    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0 || (res=read(fd, data, size))<=0)
+    {   if (fd>=0)
+            close(fd);
+        free(data); // not an error: the file is skipped and the real backup will report it
+        return 0;
+    }
+    close(fd);
+    
+    if (slot==s->count)
+        s->count++;
+    else
+        free(s->data[slot]);
+    s->data[slot]=data;
+    s->size[slot]=(u32)res;
+    return 0;
+}
+
+int zstd_samples_train(czstdsamples *s, u8 *dict, u32 *dictsize)
+{
+    size_t sizes[FSA_ZSTDDICT_SAMPLES];
+    u64 total=0;
+    u8 *buffer;
+    size_t res;
+    int i;
+    
+    for (i=0; i < s->count; i++)
+        total+=s->size[i];
+    if (s->count < FSA_ZSTDDICT_MINSAMPLES)
+    {   msgprintf(MSG_VERB1, "Not enough small files to train a compression dictionary (%d)\n", s->count);
+        return -1;
+    }
+    
+    if ((buffer=malloc(total))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)total);
+        return -1;
+    }
+    for (i=0, total=0; i < s->count; i++)
+    {   memcpy(buffer+total, s->data[i], s->size[i]);
+        sizes[i]=s->size[i];
+        total+=s->size[i];
+    }
+    
+    res=ZDICT_trainFromBuffer(dict, *dictsize, buffer, sizes, (unsigned)s->count);
+    free(buffer);
+    if (ZDICT_isError(res))
+    {   msgprintf(MSG_VERB1, "Cannot train a compression dictionary: %s\n", ZDICT_getErrorName(res));
+        return -1;
+    }
+    msgprintf(MSG_VERB1, "Compression dictionary of %ld bytes trained from %d small files\n", (long)res, s->count);
+    *dictsize=(u32)res;
+    return 0;
+}
 #endif // OPTION_ZSTD_SUPPORT
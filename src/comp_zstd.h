@@ -23,8 +23,32 @@
 
 #include <zstd.h>
 
+struct s_zstdsamples;
+typedef struct s_zstdsamples czstdsamples;
+
+// beginning of small files selected at random during the analysis to train a dictionary:
+// each file seen has the same probability to be in the samples (reservoir sampling)
+struct s_zstdsamples
+{   u8   *data[FSA_ZSTDDICT_SAMPLES];
+    u32  size[FSA_ZSTDDICT_SAMPLES];
+    int  count; // number of samples in data
+    u64  seen; // number of small files which have been considered
+    u64  rand; // state of the pseudo-random generator
+};
+
 int compress_block_zstd(u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
 int uncompress_block_zstd(u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+int compress_block_zstd_dict(u16 fsid, u64 origsize, u64 *compsize, u8 *origbuf, u8 *compbuf, u64 compbufsize, int level);
+int uncompress_block_zstd_dict(u16 fsid, u64 compsize, u64 *origsize, u8 *origbuf, u64 origbufsize, u8 *compbuf);
+
+int  zstd_dict_set(u16 fsid, u8 *data, u32 size);
+bool zstd_dict_exists(u16 fsid);
+void zstd_dict_destroy_all();
+
+void zstd_samples_init(czstdsamples *s);
+int  zstd_samples_add(czstdsamples *s, char *fullpath, u64 filesize);
+int  zstd_samples_train(czstdsamples *s, u8 *dict, u32 *dictsize);
+void zstd_samples_destroy(czstdsamples *s);
 
 #endif // OPTION_ZSTD_SUPPORT
 
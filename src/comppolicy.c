@@ -0,0 +1,235 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fsarchiver.h"
+#include "comppolicy.h"
+#include "strlist.h"
+#include "options.h"
+#include "error.h"
+
+int comppolicy_init(ccomppolicy *policy)
+{
+    memset(policy, 0, sizeof(ccomppolicy));
+    return 0;
+}
+
+int comppolicy_destroy(ccomppolicy *policy)
+{
+    int i;
+    
+    for (i=0; i < policy->count; i++)
+    {   strlist_destroy(&policy->rules[i].patterns);
+        exclude_destroy(&policy->rules[i].match);
+    }
+    free(policy->rules);
+    memset(policy, 0, sizeof(ccomppolicy));
+    return 0;
+}
+
+// convert the name and the optional level of a codec such as "zstd:19"
+int comppolicy_parse_codec(char *codec, u16 *compalgo, int *complevel)
+{
+    char name[64];
+    char *level;
+    int minlevel;
+    int maxlevel;
+    
+    snprintf(name, sizeof(name), "%s", codec);
+    if ((level=strchr(name, ':'))!=NULL)
+        *level++=0;
+    
+    if (strcmp(name, "none")==0)
+    {   *compalgo=COMPRESS_NONE;
+        *complevel=0;
+    }
+#ifdef OPTION_LZO_SUPPORT
+    else if (strcmp(name, "lzo")==0)
+    {   *compalgo=COMPRESS_LZO;
+        *complevel=3;
+    }
+#endif // OPTION_LZO_SUPPORT
+    else if (strcmp(name, "gzip")==0)
+    {   *compalgo=COMPRESS_GZIP;
+        *complevel=6;
+    }
+    else if (strcmp(name, "bzip2")==0)
+    {   *compalgo=COMPRESS_BZIP2;
+        *complevel=5;
+    }
+#ifdef OPTION_LZMA_SUPPORT
+    else if (strcmp(name, "lzma")==0)
+    {   *compalgo=COMPRESS_LZMA;
+        *complevel=6;
+    }
+#endif // OPTION_LZMA_SUPPORT
+#ifdef OPTION_LZ4_SUPPORT
+    else if (strcmp(name, "lz4")==0)
+    {   *compalgo=COMPRESS_LZ4;
+        *complevel=0;
+    }
+#endif // OPTION_LZ4_SUPPORT
+#ifdef OPTION_ZSTD_SUPPORT
+    else if (strcmp(name, "zstd")==0)
+    {   *compalgo=COMPRESS_ZSTD;
+        *complevel=FSA_DEF_ZSTD_LEVEL;
+    }
+#endif // OPTION_ZSTD_SUPPORT
+    else
+    {   errprintf("compression algorithm [%s] is not supported or has been disabled at compilation time\n", name);
+        return -1;
+    }
+    
+    if (level!=NULL)
+    {
+        if (options_get_compress_levels(*compalgo, &minlevel, &maxlevel)!=0)
+        {   errprintf("compression algorithm [%s] does not accept a compression level\n", name);
+            return -1;
+        }
+        *complevel=atoi(level);
+        if (*complevel<minlevel || *complevel>maxlevel)
+        {   errprintf("invalid compression level for %s: %s, it must be between %d and %d\n", name, level, minlevel, maxlevel);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// convert a magic pattern such as "magic:ffd8ff" to the bytes it represents
+static int comppolicy_parse_magic(ccomprule *rule, char *hex)
+{
+    int len=strlen(hex);
+    unsigned int byte;
+    int i;
+    
+    if (rule->magiccount>=FSA_MAX_POLICYMAGICS)
+    {   errprintf("too many magic patterns in the same rule: the maximum is %d\n", FSA_MAX_POLICYMAGICS);
+        return -1;
+    }
+    if (len==0 || len%2!=0 || len/2>FSA_MAX_POLICYMAGICLEN)
+    {   errprintf("invalid magic pattern [%s]: it must be an even number of hex digits (%d bytes max)\n", hex, FSA_MAX_POLICYMAGICLEN);
+        return -1;
+    }
+    for (i=0; i < len/2; i++)
+    {   if (!isxdigit((unsigned char)hex[2*i]) || !isxdigit((unsigned char)hex[2*i+1]) || sscanf(hex+2*i, "%2x", &byte)!=1)
+        {   errprintf("invalid magic pattern [%s]: it must be an even number of hex digits\n", hex);
+            return -1;
+        }
+        rule->magic[rule->magiccount][i]=(u8)byte;
+    }
+    rule->magiclen[rule->magiccount++]=len/2;
+    return 0;
+}
+
+// add a rule such as "*.jpg|*.gz=none" or "*.txt|*.log=zstd:19" at the end of the policy
+int comppolicy_add(ccomppolicy *policy, char *text)
+{
+    ccomprule *rules;
+    ccomprule *rule;
+    cstrlist items;
+    char *codec;
+    char *item;
+    int ret=-1;
+    int i;
+    
+    if ((codec=strrchr(text, '='))==NULL || codec==text)
+    {   errprintf("invalid compression rule [%s]: expected <patterns>=<algo>[:<level>]\n", text);
+        return -1;
+    }
+    
+    if ((rules=realloc(policy->rules, (policy->count+1)*sizeof(ccomprule)))==NULL)
+    {   errprintf("realloc(%ld) failed: out of memory\n", (long)((policy->count+1)*sizeof(ccomprule)));
+        return -1;
+    }
+    policy->rules=rules;
+    rule=&policy->rules[policy->count];
+    memset(rule, 0, sizeof(ccomprule));
+    strlist_init(&rule->patterns);
+    exclude_init(&rule->match);
+    strlist_init(&items);
+    
+    if (comppolicy_parse_codec(codec+1, &rule->compalgo, &rule->complevel)!=0)
+        goto comppolicy_add_error;
+    
+    *codec=0; // only split the patterns
+    i=strlist_split(&items, text, '|');
+    *codec='=';
+    if (i!=0)
+        goto comppolicy_add_error;
+    
+    for (i=0; (item=strlist_get(&items, i))!=NULL; i++)
+    {
+        if (strncmp(item, "magic:", 6)==0)
+        {   if (comppolicy_parse_magic(rule, item+6)!=0)
+                goto comppolicy_add_error;
+        }
+        else if (strlist_add(&rule->patterns, item)!=0)
+        {   goto comppolicy_add_error;
+        }
+    }
+    
+    if (exclude_compile(&rule->match, &rule->patterns)!=0)
+    {   errprintf("cannot compile the patterns of the compression rule [%s]\n", text);
+        goto comppolicy_add_error;
+    }
+    
+    policy->count++;
+    ret=0;
+    
+comppolicy_add_error:
+    if (ret!=0)
+    {   strlist_destroy(&rule->patterns);
+        exclude_destroy(&rule->match);
+    }
+    strlist_destroy(&items);
+    return ret;
+}
+
+// find the algo and level to use for a file: the name and path are matched against the
+// patterns and data is the beginning of the file for the magic patterns
+bool comppolicy_select(ccomppolicy *policy, char *relpath, u8 *data, u32 datasize, u16 *compalgo, int *complevel)
+{
+    ccomprule *rule;
+    char *name;
+    int i, j;
+    
+    name=((name=strrchr(relpath, '/'))!=NULL) ? name+1 : relpath;
+    for (i=0; i < policy->count; i++)
+    {
+        rule=&policy->rules[i];
+        for (j=0; j < rule->magiccount; j++)
+            if (datasize>=rule->magiclen[j] && memcmp(data, rule->magic[j], rule->magiclen[j])==0)
+                break;
+        if (j < rule->magiccount || (strlist_count(&rule->patterns)>0 && 
+            (exclude_match(&rule->match, name)==true || exclude_match(&rule->match, relpath)==true)))
+        {   *compalgo=rule->compalgo;
+            *complevel=rule->complevel;
+            return true;
+        }
+    }
+    
+    return false;
+}
@@ -0,0 +1,59 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __COMPPOLICY_H__
+#define __COMPPOLICY_H__
+
+#include "types.h"
+#include "strlist.h"
+#include "exclude.h"
+
+#define FSA_MAX_POLICYMAGICS     8              // max number of magic patterns in a rule
+#define FSA_MAX_POLICYMAGICLEN   16             // max length of a magic pattern in bytes
+
+struct s_comprule;
+typedef struct s_comprule ccomprule;
+
+struct s_comppolicy;
+typedef struct s_comppolicy ccomppolicy;
+
+// rule such as "*.jpg|*.gz|magic:fd377a585a=none": the file is compressed with
+// that algo and level when its name or path matches one of the patterns, or
+// when its data start with one of the magic byte sequences
+struct s_comprule
+{   cstrlist patterns; // glob patterns matched like the exclusion patterns
+    cexclude match; // compiled version of patterns
+    u8       magic[FSA_MAX_POLICYMAGICS][FSA_MAX_POLICYMAGICLEN];
+    int      magiclen[FSA_MAX_POLICYMAGICS];
+    int      magiccount;
+    u16      compalgo; // COMPRESS_XXX
+    int      complevel;
+};
+
+// rules are checked in the order they were given: the first one which matches wins
+struct s_comppolicy
+{   ccomprule *rules;
+    int       count;
+};
+
+int  comppolicy_init(ccomppolicy *policy);
+int  comppolicy_add(ccomppolicy *policy, char *rule);
+int  comppolicy_parse_codec(char *codec, u16 *compalgo, int *complevel);
+bool comppolicy_select(ccomppolicy *policy, char *relpath, u8 *data, u32 datasize, u16 *compalgo, int *complevel);
+int  comppolicy_destroy(ccomppolicy *policy);
+
+#endif // __COMPPOLICY_H__
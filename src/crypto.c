@@ -33,6 +33,11 @@
 // required for safety with multi-threading in gcrypt
 GCRY_THREAD_OPTION_PTHREAD_IMPL;
 
+// key of the aead algorithms: it is derived from the password once and used by all the threads
+static u8 aeadkey[FSA_AEAD_KEYSIZE];
+static u32 aeadarchid; // authenticated with all the encrypted buffers
+static bool aeadkeyset=false;
+
 int crypto_init()
 {
     // init gcrypt for multi-threading
@@ -56,6 +61,9 @@ int crypto_init()
 
 int crypto_cleanup()
 {
+    memset(aeadkey, 0, sizeof(aeadkey));
+    aeadarchid=0;
+    aeadkeyset=false;
     return 0;
 }
 
@@ -110,6 +118,137 @@ int crypto_blowfish(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *passwor
     return (res==0)?(0):(-1);
 }
 
+bool crypto_is_aead(int algo)
+{
+    return (algo==ENCRYPT_AES256GCM) || (algo==ENCRYPT_CHACHA20);
+}
+
+// the salt and the number of iterations are written in the main header
+int crypto_derive_key(u8 *password, int passlen, u8 *salt, int saltlen, u32 iterations, u32 archid)
+{
+    gcry_error_t res;
+    
+    if ((password==NULL) || (passlen==0) || (iterations==0))
+        return -1;
+    
+    if ((res=gcry_kdf_derive(password, passlen, GCRY_KDF_PBKDF2, GCRY_MD_SHA256, salt, saltlen, iterations, FSA_AEAD_KEYSIZE, aeadkey))!=0)
+    {
+        errprintf("gcry_kdf_derive() failed: %s\n", gcry_strerror(res));
+        return -1;
+    }
+    
+    aeadarchid=archid;
+    aeadkeyset=true;
+    return 0;
+}
+
+// an encrypted block is made of the nonce, the encrypted data and the tag: the tag
+// authenticates the data, so the decryption fails if the block has been modified
+// the archive id and the aad (the fields of the block header which describe the
+// data) are authenticated as well, so a block moved from another place is rejected
+int crypto_aead(int algo, u8 *aad, int aadlen, u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, int enc)
+{
+    u8 authdata[sizeof(u32)+FSA_AEAD_MAXAADSIZE];
+    gcry_cipher_hd_t hd;
+    u64 datasize;
+    u32 temp32;
+    u8 *nonce;
+    u8 *tag;
+    int cipher;
+    int mode;
+    int res;
+    
+    switch (algo)
+    {
+        case ENCRYPT_AES256GCM: // hardware accelerated by gcrypt when the cpu supports it
+            cipher=GCRY_CIPHER_AES256;
+            mode=GCRY_CIPHER_MODE_GCM;
+            break;
+        case ENCRYPT_CHACHA20: // faster than aes on the cpus without aes instructions
+            cipher=GCRY_CIPHER_CHACHA20;
+            mode=GCRY_CIPHER_MODE_POLY1305;
+            break;
+        default:
+            errprintf("invalid encryption algorithm: %d\n", algo);
+            return -1;
+    }
+    
+    if (aeadkeyset==false)
+    {
+        errprintf("the encryption key has not been derived from the password\n");
+        return -1;
+    }
+    
+    if ((aadlen<0) || (aadlen>FSA_AEAD_MAXAADSIZE))
+    {   errprintf("invalid parameter: aadlen=%d\n", aadlen);
+        return -1;
+    }
+    temp32=cpu_to_le32(aeadarchid);
+    memcpy(authdata, &temp32, sizeof(temp32));
+    if (aadlen>0)
+        memcpy(authdata+sizeof(temp32), aad, aadlen);
+    
+    switch(enc)
+    {
+        case 1: // encrypt
+            datasize=insize;
+            nonce=outbuf;
+            gcry_create_nonce(nonce, FSA_AEAD_NONCESIZE);
+            break;
+        case 0: // decrypt
+            if (insize<FSA_AEAD_OVERHEAD)
+            {   errprintf("encrypted block is too small: size=%ld\n", (long)insize);
+                return -1;
+            }
+            datasize=insize-FSA_AEAD_OVERHEAD;
+            nonce=inbuf;
+            break;
+        default: // invalid
+            errprintf("invalid parameter: enc=%d\n", (int)enc);
+            return -1;
+    }
+    tag=nonce+FSA_AEAD_NONCESIZE+datasize;
+    
+    if ((res=gcry_cipher_open(&hd, cipher, mode, 0))!=0)
+    {
+        errprintf("gcry_cipher_open() failed\n");
+        return -1;
+    }
+    
+    if (gcry_cipher_setkey(hd, aeadkey, FSA_AEAD_KEYSIZE) || gcry_cipher_setiv(hd, nonce, FSA_AEAD_NONCESIZE))
+    {
+        errprintf("gcry_cipher_setkey() or gcry_cipher_setiv() failed\n");
+        gcry_cipher_close(hd);
+        return -1;
+    }
+    
+    if (gcry_cipher_authenticate(hd, authdata, sizeof(temp32)+aadlen))
+    {
+        errprintf("gcry_cipher_authenticate() failed\n");
+        gcry_cipher_close(hd);
+        return -1;
+    }
+    
+    if (enc==1)
+    {
+        res=gcry_cipher_encrypt(hd, outbuf+FSA_AEAD_NONCESIZE, datasize, inbuf, datasize);
+        if (res==0)
+            res=gcry_cipher_gettag(hd, tag, FSA_AEAD_TAGSIZE);
+        *outsize=datasize+FSA_AEAD_OVERHEAD;
+    }
+    else
+    {
+        res=gcry_cipher_decrypt(hd, outbuf, datasize, inbuf+FSA_AEAD_NONCESIZE, datasize);
+        if (res==0) // fails when the data have been modified or when the key is wrong
+            res=gcry_cipher_checktag(hd, tag, FSA_AEAD_TAGSIZE);
+        *outsize=datasize;
+    }
+    
+    gcry_cipher_close(hd);
+    
+    return (res==0)?(0):(-1);
+}
+
 int crypto_random(u8 *buf, int bufsize)
 {
     memset(buf, 0, bufsize);
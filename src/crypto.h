@@ -22,6 +22,9 @@
 
 int crypto_init();
 int crypto_blowfish(u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, u8 *password, int passlen, int enc);
+bool crypto_is_aead(int algo);
+int crypto_derive_key(u8 *password, int passlen, u8 *salt, int saltlen, u32 iterations, u32 archid);
+int crypto_aead(int algo, u8 *aad, int aadlen, u64 insize, u64 *outsize, u8 *inbuf, u8 *outbuf, int enc);
 int crypto_random(u8 *buf, int bufsize);
 int crypto_cleanup();
 
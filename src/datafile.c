@@ -26,7 +26,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
-#include <gcrypt.h>
+#include <sys/stat.h>
 
 #include "fsarchiver.h"
 #include "datafile.h"
@@ -38,8 +38,8 @@ struct s_datafile
     bool simul; // simulation: don't write anything if true
     bool open; // true when file is open even if simulation
     bool sparse; // true if that's a sparse file
+    u32  fsblksize; // granularity of the holes created in sparse files
     char path[PATH_MAX]; // path to file
-    gcry_md_hd_t md5ctx; // struct for md5
 };
 
 cdatafile *datafile_alloc()
@@ -52,6 +52,7 @@ cdatafile *datafile_alloc()
     f->simul=false;
     f->open=false;
     f->sparse=false;
+    f->fsblksize=FSA_DEF_FSBLKSIZE;
     return f;
 }
 
@@ -60,7 +61,7 @@ int datafile_destroy(cdatafile *f)
     assert(f);
     
     if (f->open)
-        datafile_close(f, NULL, 0);
+        datafile_close(f);
     
     free(f);
     return 0;
@@ -68,6 +69,8 @@ int datafile_destroy(cdatafile *f)
 
 int datafile_open_write(cdatafile *f, char *path, bool simul, bool sparse)
 {
+    struct stat64 st;
+    
     assert(f);
     
     if (f->open)
@@ -90,10 +93,10 @@ int datafile_open_write(cdatafile *f, char *path, bool simul, bool sparse)
         }
     }
     
-    if (gcry_md_open(&f->md5ctx, GCRY_MD_MD5, 0) != GPG_ERR_NO_ERROR)
-    {   errprintf("gcry_md_open() failed\n");
-        return -1;
-    }
+    // holes can only be created for entire blocks of the destination filesystem
+    f->fsblksize=FSA_DEF_FSBLKSIZE;
+    if ((simul==false) && (sparse==true) && (fstat64(f->fd, &st)==0) && (st.st_blksize>=512) && (st.st_blksize<=FSA_MAX_BLKSIZE))
+        f->fsblksize=st.st_blksize;
     
     snprintf(f->path, PATH_MAX, "%s", path);
     f->simul=simul;
@@ -104,19 +107,34 @@ int datafile_open_write(cdatafile *f, char *path, bool simul, bool sparse)
 
 int datafile_is_block_zero(cdatafile *f, char *data, u64 len)
 {
-    bool zero=true;
-    u64 pos;
+    return is_buffer_zero((u8*)data, len);
+}
+
+static int datafile_write_data(cdatafile *f, char *data, u64 len)
+{
+    s64 lres;
     
-    for (pos=0; (pos<len) && (zero==true); pos++)
-        if (data[pos]!=0)
-            zero=false;
+    errno=0;
+    if ((lres=write(f->fd, data, len))!=len) // error
+    {
+        if ((errno==ENOSPC) || ((lres>0) && (lres < len)))
+        {   sysprintf("Can't write file [%s]: no space left on device\n", f->path);
+            return FSAERR_ENOSPC;
+        }
+        else // another error
+        {   sysprintf("cannot write %s: size=%ld\n", f->path, (long)len);
+            return FSAERR_WRITE;
+        }
+    }
     
-    return zero;
+    return FSAERR_SUCCESS;
 }
 
 int datafile_write(cdatafile *f, char *data, u64 len)
 {
-    s64 lres;
+    bool zero;
+    u64 pos, end;
+    int res;
     
     assert(f);
     
@@ -125,64 +143,86 @@ int datafile_write(cdatafile *f, char *data, u64 len)
         return FSAERR_NOTOPEN;
     }
     
-    if (f->simul==false)
+    if (f->simul==true || len==0)
+        return FSAERR_SUCCESS;
+    
+    if (f->sparse==false)
+        return datafile_write_data(f, data, len);
+    
+    // sparse file: the data are split into runs of filesystem blocks which are either all
+    // zero (skipped with lseek64() so that they become holes) or not (written normally)
+    zero=datafile_is_block_zero(f, data, min(f->fsblksize, len));
+    for (pos=0; pos < len; pos=end, zero=!zero)
     {
-        if ((f->sparse==true) && (datafile_is_block_zero(f, data, len)))
+        for (end=min(pos+f->fsblksize, len); end < len; end=min(end+f->fsblksize, len))
+            if (datafile_is_block_zero(f, data+end, min(f->fsblksize, len-end))!=zero)
+                break;
+        
+        if (zero==true)
         {
-            if (lseek64(f->fd, len, SEEK_CUR)<0)
+            if (lseek64(f->fd, end-pos, SEEK_CUR)<0)
             {   sysprintf("Can't lseek64() in file [%s]\n", f->path);
                 return FSAERR_SEEK;
             }
         }
-        else
+        else if ((res=datafile_write_data(f, data+pos, end-pos))!=FSAERR_SUCCESS)
         {
-            errno=0;
-            if ((lres=write(f->fd, data, len))!=len) // error
-            {
-                if ((errno==ENOSPC) || ((lres>0) && (lres < len)))
-                {   sysprintf("Can't write file [%s]: no space left on device\n", f->path);
-                    return FSAERR_ENOSPC;
-                }
-                else // another error
-                {   sysprintf("cannot write %s: size=%ld\n", f->path, (long)len);
-                    return FSAERR_WRITE;
-                }
-            }
+            return res;
         }
     }
     
-    gcry_md_write(f->md5ctx, data, len);
-    
     return FSAERR_SUCCESS;
 }
 
-int datafile_close(cdatafile *f, u8 *md5bufdat, int md5bufsize)
+// recreate a hole or a zero block which has not been stored in the archive (not part of the file digest)
+// this is done using lseek() for sparse files, and zeros are written for other files
+int datafile_write_hole(cdatafile *f, u64 len)
 {
-    char md5store[16];
-    u8 *md5tmp;
-    int res=0;
+    char zeros[65536];
+    u64 pos;
+    s64 lres;
     
     assert(f);
     
     if (!f->open)
     {   errprintf("File is not open\n");
-        return -1;
+        return FSAERR_NOTOPEN;
     }
     
-    if ((md5tmp=gcry_md_read(f->md5ctx, GCRY_MD_MD5))==NULL)
-    {   errprintf("gcry_md_read() failed\n");
-        return -1;
+    if (f->simul==true)
+        return FSAERR_SUCCESS;
+    
+    if (f->sparse==true)
+    {
+        if (lseek64(f->fd, len, SEEK_CUR)<0)
+        {   sysprintf("Can't lseek64() in file [%s]\n", f->path);
+            return FSAERR_SEEK;
+        }
+        return FSAERR_SUCCESS;
     }
-    memcpy(md5store, md5tmp, 16);
-    gcry_md_close(f->md5ctx);
     
-    if (md5bufdat!=NULL)
+    memset(zeros, 0, sizeof(zeros));
+    for (pos=0; pos < len; pos+=lres)
     {
-        if (md5bufsize < 16)
-        {   errprintf("Buffer too small for md5 checksum\n");
-            return -1;
+        errno=0;
+        if ((lres=write(f->fd, zeros, min(len-pos, sizeof(zeros))))<=0)
+        {   sysprintf("cannot write %s: size=%ld\n", f->path, (long)len);
+            return (errno==ENOSPC) ? FSAERR_ENOSPC : FSAERR_WRITE;
         }
-        memcpy(md5bufdat, md5store, 16);
+    }
+    
+    return FSAERR_SUCCESS;
+}
+
+int datafile_close(cdatafile *f)
+{
+    int res=0;
+    
+    assert(f);
+    
+    if (!f->open)
+    {   errprintf("File is not open\n");
+        return -1;
     }
     
     if ((f->open==true) && (f->simul==false))
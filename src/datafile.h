@@ -27,6 +27,7 @@ cdatafile *datafile_alloc();
 int       datafile_destroy(cdatafile *f);
 int       datafile_open_write(cdatafile *f, char *path, bool simul, bool sparse);
 int       datafile_write(cdatafile *f, char *data, u64 len);
-int       datafile_close(cdatafile *f, u8 *md5bufdat, int md5bufsize);
+int       datafile_write_hole(cdatafile *f, u64 len);
+int       datafile_close(cdatafile *f);
 
 #endif // __DATAFILE_H__
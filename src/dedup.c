@@ -0,0 +1,161 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "dedup.h"
+#include "digest.h"
+#include "queue.h"
+#include "error.h"
+
+#define DEDUP_MINSIZE 1024
+
+int dedup_init(cdeduptable *t)
+{
+    assert(t);
+    t->entries=NULL;
+    t->size=0;
+    t->count=0;
+    if (pthread_mutex_init(&t->mutex, NULL)!=0)
+    {   errprintf("pthread_mutex_init() failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int dedup_destroy(cdeduptable *t)
+{
+    assert(t);
+    free(t->entries);
+    t->entries=NULL;
+    t->size=0;
+    t->count=0;
+    pthread_mutex_destroy(&t->mutex);
+    return 0;
+}
+
+int dedup_empty(cdeduptable *t)
+{
+    assert(t);
+    assert(pthread_mutex_lock(&t->mutex)==0);
+    if (t->entries!=NULL)
+        memset(t->entries, 0, t->size*sizeof(cdedupentry));
+    t->count=0;
+    assert(pthread_mutex_unlock(&t->mutex)==0);
+    return 0;
+}
+
+// the leaf digest of the tree hash is reused when it is a blake2b digest
+int dedup_fingerprint(struct s_blockinfo *blkinfo, u8 *fprint)
+{
+    assert(blkinfo);
+    if (blkinfo->blkdigestalgo==DIGEST_BLAKE2B)
+    {   memcpy(fprint, blkinfo->blkdigest, DEDUP_FPRINTLEN);
+        return 0;
+    }
+    return digest_leaf(DIGEST_BLAKE2B, fprint, (u8*)blkinfo->blkdata, blkinfo->blkrealsize);
+}
+
+// the fingerprints are cryptographic digests: their first bytes are already well distributed
+static cdedupentry *dedup_find(cdedupentry *entries, u32 size, u8 *fprint)
+{
+    u32 pos;
+    
+    memcpy(&pos, fprint, sizeof(pos));
+    for (pos&=(size-1); entries[pos].used==true; pos=(pos+1) & (size-1))
+    {
+        if (memcmp(entries[pos].fprint, fprint, DEDUP_FPRINTLEN)==0)
+            break;
+    }
+    return &entries[pos];
+}
+
+// the table is never more than half full
+static int dedup_grow(cdeduptable *t)
+{
+    cdedupentry *entries;
+    cdedupentry *entry;
+    u32 size;
+    u32 i;
+    
+    size=max(2*t->size, DEDUP_MINSIZE);
+    if ((entries=calloc(size, sizeof(cdedupentry)))==NULL)
+    {   errprintf("calloc(%ld) failed: out of memory\n", (long)size*sizeof(cdedupentry));
+        return -1;
+    }
+    for (i=0; i < t->size; i++)
+    {
+        if (t->entries[i].used==true)
+        {   entry=dedup_find(entries, size, t->entries[i].fprint);
+            *entry=t->entries[i];
+        }
+    }
+    free(t->entries);
+    t->entries=entries;
+    t->size=size;
+    return 0;
+}
+
+// returns the value associated with the fingerprint or -1 if it is unknown
+s64 dedup_lookup(cdeduptable *t, u8 *fprint)
+{
+    cdedupentry *entry;
+    s64 value=-1;
+    
+    assert(t);
+    assert(pthread_mutex_lock(&t->mutex)==0);
+    if (t->count>0)
+    {   entry=dedup_find(t->entries, t->size, fprint);
+        if (entry->used==true)
+            value=entry->value;
+    }
+    assert(pthread_mutex_unlock(&t->mutex)==0);
+    return value;
+}
+
+// adds the fingerprint if it is unknown: returns the value of the existing entry or -1
+s64 dedup_insert(cdeduptable *t, u8 *fprint, s64 value)
+{
+    cdedupentry *entry;
+    s64 res=-1;
+    
+    assert(t);
+    assert(pthread_mutex_lock(&t->mutex)==0);
+    if (2*(t->count+1) > t->size && dedup_grow(t)!=0)
+    {   assert(pthread_mutex_unlock(&t->mutex)==0);
+        return -1; // the block will just be stored again
+    }
+    entry=dedup_find(t->entries, t->size, fprint);
+    if (entry->used==true)
+    {   res=entry->value;
+    }
+    else
+    {   memcpy(entry->fprint, fprint, DEDUP_FPRINTLEN);
+        entry->value=value;
+        entry->used=true;
+        t->count++;
+    }
+    assert(pthread_mutex_unlock(&t->mutex)==0);
+    return res;
+}
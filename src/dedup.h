@@ -0,0 +1,56 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <pthread.h>
+#include "types.h"
+
+#define DEDUP_FPRINTLEN 32 // blake2b-256 of the uncompressed data of a block
+
+struct s_blockinfo;
+
+struct s_dedupentry;
+typedef struct s_dedupentry cdedupentry;
+
+struct s_deduptable;
+typedef struct s_deduptable cdeduptable;
+
+struct s_dedupentry
+{   u8   fprint[DEDUP_FPRINTLEN]; // fingerprint of the block
+    s64  value; // position of the block in the archive (or zero when only the fingerprint matters)
+    bool used; // false for the free entries
+};
+
+// hash table of the fingerprints of the data blocks, protected by a mutex
+// because the compression threads share the same table
+struct s_deduptable
+{   cdedupentry     *entries; // open addressing table (allocated on the first insertion)
+    u32             size; // number of entries (power of two)
+    u32             count; // number of entries which are used
+    pthread_mutex_t mutex;
+};
+
+int dedup_init(cdeduptable *t);
+int dedup_destroy(cdeduptable *t);
+int dedup_empty(cdeduptable *t);
+int dedup_fingerprint(struct s_blockinfo *blkinfo, u8 *fprint);
+s64 dedup_lookup(cdeduptable *t, u8 *fprint);
+s64 dedup_insert(cdeduptable *t, u8 *fprint, s64 value);
+
+#endif // __DEDUP_H__
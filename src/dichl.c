@@ -27,31 +27,108 @@
 #include "common.h"
 #include "error.h"
 
+#define DICHL_MINTABSIZE    1024
+#define DICHL_CHUNKSIZE     65536
+
+static u64 dichl_hash(u64 key1, u64 key2)
+{
+    u64 h=key1*0x9E3779B97F4A7C15ULL ^ key2;
+    
+    // final mix from murmurhash3 so that consecutive inodes are spread in the table
+    h^=h>>33;
+    h*=0xFF51AFD7ED558CCDULL;
+    h^=h>>33;
+    h*=0xC4CEB9FE1A85EC53ULL;
+    h^=h>>33;
+    return h;
+}
+
+// returns the slot where the key is stored, or the free slot where it would be stored
+static cdichlitem *dichl_lookup(cdichlitem *table, u64 tabsize, u64 key1, u64 key2)
+{
+    u64 pos;
+    
+    for (pos=dichl_hash(key1, key2) & (tabsize-1); table[pos].str!=NULL; pos=(pos+1) & (tabsize-1))
+        if (table[pos].key1==key1 && table[pos].key2==key2)
+            break;
+    
+    return &table[pos];
+}
+
+static int dichl_grow(cdichl *d)
+{
+    cdichlitem *newtab;
+    cdichlitem *slot;
+    u64 newsize;
+    u64 i;
+    
+    newsize=(d->tabsize==0) ? DICHL_MINTABSIZE : (2*d->tabsize);
+    if ((newtab=calloc(newsize, sizeof(cdichlitem)))==NULL)
+    {   errprintf("calloc(%lld) failed: out of memory\n", (long long)newsize);
+        return -1;
+    }
+    
+    for (i=0; i < d->tabsize; i++)
+    {
+        if (d->table[i].str!=NULL)
+        {   slot=dichl_lookup(newtab, newsize, d->table[i].key1, d->table[i].key2);
+            *slot=d->table[i];
+        }
+    }
+    
+    free(d->table);
+    d->table=newtab;
+    d->tabsize=newsize;
+    return 0;
+}
+
+// copy the string to the arena: strings are never freed before the whole dichl
+static char *dichl_strdup(cdichl *d, char *str)
+{
+    cdichlchunk *chunk;
+    u32 len=strlen(str)+1;
+    char *res;
+    
+    if (d->arena==NULL || d->arena->size - d->arena->used < len)
+    {
+        if ((chunk=malloc(sizeof(cdichlchunk)+max(len, DICHL_CHUNKSIZE)))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)(sizeof(cdichlchunk)+max(len, DICHL_CHUNKSIZE)));
+            return NULL;
+        }
+        chunk->size=max(len, DICHL_CHUNKSIZE);
+        chunk->used=0;
+        chunk->next=d->arena;
+        d->arena=chunk;
+    }
+    
+    res=d->arena->data + d->arena->used;
+    memcpy(res, str, len);
+    d->arena->used+=len;
+    return res;
+}
+
 cdichl *dichl_alloc()
 {
     cdichl *d;
     if ((d=malloc(sizeof(cdichl)))==NULL)
         return NULL;
-    d->head=NULL;
+    memset(d, 0, sizeof(cdichl));
     return d;
 }
 
 int dichl_destroy(cdichl *d)
 {
-    cdichlitem *item, *next;
+    cdichlchunk *chunk, *next;
     
     if (d==NULL)
         return -1;
     
-    item=d->head;
-    while (item!=NULL)
-    {
-        next=item->next;
-        free(item->str);
-        free(item);
-        item=next;
+    for (chunk=d->arena; chunk!=NULL; chunk=next)
+    {   next=chunk->next;
+        free(chunk);
     }
     
+    free(d->table);
     free(d);
     
     return 0;
@@ -59,59 +136,35 @@ int dichl_destroy(cdichl *d)
 
 int dichl_add(cdichl *d, u64 key1, u64 key2, char *str)
 {
-    cdichlitem *item, *lnew, *last;
-    int len;
+    cdichlitem *slot;
     
     if (d==NULL || !str)
     {   errprintf("invalid parameters\n");
         return -1;
     }
-    len=strlen(str);
     
-    // allocate object
-    lnew=malloc(sizeof(cdichlitem));
-    if (!lnew)
-    {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(cdichlitem));
+    // keep the load factor under 75% so that the probe sequences remain short
+    if ((d->count+1)*4 > d->tabsize*3 && dichl_grow(d)!=0)
         return -1;
-    }
-    memset(lnew, 0, sizeof(cdichlitem));
-    lnew->str=malloc(len+1);
-    if (!lnew->str)
-    {   
-        free(lnew);
-        errprintf("malloc(%ld) failed: out of memory\n", (long)len+1);
+    
+    slot=dichl_lookup(d->table, d->tabsize, key1, key2);
+    if (slot->str!=NULL)
+    {   errprintf("dichl_add_internal(): item with key1=%ld and key2=%ld is already in dico\n", (long)key1, (long)key2);
         return -1;
     }
     
-    memcpy(lnew->str, str, len+1);
-    lnew->key1=key1;
-    lnew->key2=key2;
-    lnew->next=NULL;
-    
-    // go to the end of the item and check for duplicates
-    if (d->head==NULL) // item is empty
-    {   
-        d->head=lnew;
-    }
-    else // item is not empty
-    {   
-        for (item=d->head; item!=NULL; item=item->next)
-        {   
-            last=item;
-            if (item->key1==key1 && item->key2==key2)
-            {   errprintf("dichl_add_internal(): item with key1=%ld and key2=%ld is already in dico\n", (long)item->key1, (long)item->key2);
-                return -1;
-            }
-        }
-        last->next=lnew;
-    }
+    if ((slot->str=dichl_strdup(d, str))==NULL)
+        return -1;
+    slot->key1=key1;
+    slot->key2=key2;
+    d->count++;
     
     return 0;
 }
 
 int dichl_get(cdichl *d, u64 key1, u64 key2, char *buf, int bufsize)
 {
-    cdichlitem *item;
+    cdichlitem *slot;
     int len;
     
     if (d==NULL || !buf)
@@ -119,17 +172,16 @@ int dichl_get(cdichl *d, u64 key1, u64 key2, char *buf, int bufsize)
         return -1;
     }
     
-    for (item=d->head; item!=NULL; item=item->next)
-    {   
-        if ((item!=NULL) && (item->key1==key1) && (item->key2==key2))
-        {
-            len=strlen(item->str);
-            if (bufsize<len+1)
-                return -2;
-            snprintf(buf, bufsize, "%s", item->str);
-            return 0;
-        }
-    }
+    if (d->count==0)
+        return -3; // not found
     
-    return -3; // not found
+    slot=dichl_lookup(d->table, d->tabsize, key1, key2);
+    if (slot->str==NULL)
+        return -3; // not found
+    
+    len=strlen(slot->str);
+    if (bufsize<len+1)
+        return -2;
+    snprintf(buf, bufsize, "%s", slot->str);
+    return 0;
 }
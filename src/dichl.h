@@ -26,16 +26,29 @@ typedef struct s_dichl cdichl;
 struct s_dichlitem;
 typedef struct s_dichlitem cdichlitem;
 
+struct s_dichlchunk;
+typedef struct s_dichlchunk cdichlchunk;
+
+// open-addressing hash table: an item where str==NULL is a free slot
 struct s_dichl
 {
-    cdichlitem *head;
+    cdichlitem  *table; // array of tabsize items
+    u64         tabsize; // always a power of two
+    u64         count; // how many items are used in the table
+    cdichlchunk *arena; // chunks where the strings are stored
 };
 
 struct s_dichlitem
 {   u64         key1;
     u64         key2;
     char        *str;
-    cdichlitem  *next;
+};
+
+struct s_dichlchunk
+{   cdichlchunk *next;
+    u32         size; // size of data
+    u32         used; // how many bytes of data are used
+    char        data[];
 };
 
 cdichl *dichl_alloc();
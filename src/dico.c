@@ -33,30 +33,84 @@
 cdico *dico_alloc()
 {
     cdico *d;
+    int i;
+    
     if ((d=malloc(sizeof(cdico)))==NULL)
         return NULL;
-    d->head=NULL;
+    d->items=d->inlitems;
+    d->count=0;
+    d->maxitems=DICO_INLINE_ITEMS;
+    d->data=d->inldata;
+    d->datused=0;
+    d->datsize=DICO_INLINE_DATA;
+    for (i=0; i < DICO_FAST_KEYS; i++)
+        d->fastidx[i]=-1;
     return d;
 }
 
 int dico_destroy(cdico *d)
 {
-    cdicoitem *item, *next;
-    
     if (d==NULL)
         return -1;
     
-    item=d->head;
-    while (item!=NULL)
+    if (d->items!=d->inlitems)
+        free(d->items);
+    if (d->data!=d->inldata)
+        free(d->data);
+    free(d);
+    
+    return 0;
+}
+
+// returns the index of the item or -1 if it's not in the dico
+static int dico_find(cdico *d, u8 section, u16 key)
+{
+    u32 i;
+    
+    if (section==0 && key<DICO_FAST_KEYS)
+        return d->fastidx[key];
+    
+    for (i=0; i < d->count; i++)
+        if (d->items[i].key==key && d->items[i].section==section)
+            return i;
+    
+    return -1;
+}
+
+// make sure there is space for one more item and for size more bytes of data
+static int dico_reserve(cdico *d, u32 size)
+{
+    cdicoitem *newitems;
+    char *newdata;
+    u32 newsize;
+    
+    if (d->count >= d->maxitems)
     {
-        next=item->next;
-        if (item->data!=NULL)
-            free(item->data);
-        free(item);
-        item=next;
+        newsize=2*d->maxitems;
+        if ((newitems=malloc(newsize*sizeof(cdicoitem)))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)(newsize*sizeof(cdicoitem)));
+            return -1;
+        }
+        memcpy(newitems, d->items, d->count*sizeof(cdicoitem));
+        if (d->items!=d->inlitems)
+            free(d->items);
+        d->items=newitems;
+        d->maxitems=newsize;
     }
     
-    free(d);
+    if (d->datused+size > d->datsize)
+    {
+        for (newsize=max(2*d->datsize, DICO_INLINE_DATA); newsize < d->datused+size; newsize*=2);
+        if ((newdata=malloc(newsize))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)newsize);
+            return -1;
+        }
+        memcpy(newdata, d->data, d->datused);
+        if (d->data!=d->inldata)
+            free(d->data);
+        d->data=newdata;
+        d->datsize=newsize;
+    }
     
     return 0;
 }
@@ -69,55 +123,89 @@ int dico_add_data(cdico *d, u8 section, u16 key, const void *data, u16 size)
 // add an item to the dico, fails if an item with that (section,key) already exists
 int dico_add_generic(cdico *d, u8 section, u16 key, const void *data, u16 size, u8 type)
 {
-    cdicoitem *item, *lnew, *last;
+    cdicoitem *lnew;
     
     assert (d);
     
-    // allocate object
-    lnew=malloc(sizeof(cdicoitem));
-    if (!lnew)
-    {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(cdicoitem));
+    if (dico_find(d, section, key)>=0)
+    {   errprintf("dico_add_generic(): item with key=%ld is already in dico\n", (long)key);
         return -3;
     }
-    memset(lnew, 0, sizeof(cdicoitem));
     
-    // go to the end of the item and check for duplicates
-    if (d->head==NULL) // item is empty
-    {   
-        d->head=lnew;
-    }
-    else // item is not empty
-    {   
-        for (item=d->head; item!=NULL; item=item->next)
-        {   last=item;
-            if (item->section==section && item->key==key)
-            {   errprintf("dico_add_generic(): item with key=%ld is already in dico\n", (long)item->key);
-                return -3;
-            }
-        }
-        last->next=lnew;
-    }
+    if (dico_reserve(d, size)!=0)
+        return -3;
     
     // copy key
+    lnew=&d->items[d->count];
     lnew->key=key;
     lnew->section=section;
     lnew->size=size;
     lnew->type=type;
-    lnew->data=NULL;
+    lnew->offset=d->datused;
     
-    // allocate memory for data
+    // copy data
     if (size > 0)
-    {
-        lnew->data=malloc(size);
-        if (!lnew->data)
-        {   errprintf("malloc(%ld) failed: out of memory\n", (long)size);
-            return -3;
-        }
-        
-        // copy data
-        memcpy(lnew->data, data, size);
+    {   memcpy(d->data+d->datused, data, size);
+        d->datused+=size;
+    }
+    
+    if (section==0 && key<DICO_FAST_KEYS)
+        d->fastidx[key]=d->count;
+    d->count++;
+    
+    return 0;
+}
+
+// use a buffer allocated by the caller as the arena of an empty dico (the dico will free it)
+// the items which are in this buffer can then be added without copying them using dico_add_ref()
+int dico_attach_data(cdico *d, char *buffer, u32 size)
+{
+    assert(d);
+    
+    if (d->count>0 || d->datused>0)
+    {   errprintf("dico_attach_data(): dico is not empty\n");
+        return -3;
     }
     
+    if (d->data!=d->inldata)
+        free(d->data);
+    d->data=buffer;
+    d->datused=size;
+    d->datsize=size;
+    return 0;
+}
+
+// add an item which refers to data which are already in the arena
+int dico_add_ref(cdico *d, u8 section, u16 key, u32 offset, u16 size, u8 type)
+{
+    cdicoitem *lnew;
+    
+    assert (d);
+    
+    if ((u64)offset+(u64)size > (u64)d->datused)
+    {   errprintf("dico_add_ref(): item with key=%ld is outside of the arena\n", (long)key);
+        return -3;
+    }
+    
+    if (dico_find(d, section, key)>=0)
+    {   errprintf("dico_add_ref(): item with key=%ld is already in dico\n", (long)key);
+        return -3;
+    }
+    
+    if (dico_reserve(d, 0)!=0)
+        return -3;
+    
+    lnew=&d->items[d->count];
+    lnew->key=key;
+    lnew->section=section;
+    lnew->size=size;
+    lnew->type=type;
+    lnew->offset=offset;
+    
+    if (section==0 && key<DICO_FAST_KEYS)
+        d->fastidx[key]=d->count;
+    d->count++;
+    
     return 0;
 }
 
@@ -129,6 +217,7 @@ int dico_get_data(cdico *d, u8 section, u16 key, void *data, u16 maxsize, u16 *s
 int dico_get_generic(cdico *d, u8 section, u16 key, void *data, u16 maxsize, u16 *size)
 {
     cdicoitem *item;
+    int index;
     
     assert(d);
     assert(data);
@@ -137,7 +226,7 @@ int dico_get_generic(cdico *d, u8 section, u16 key, void *data, u16 maxsize, u16
     if (size!=NULL)
         *size=0;
     
-    if (d->head==NULL)
+    if (d->count==0)
     {   msgprintf(MSG_DEBUG1, "dico is empty\n");
         return -1;
     }
@@ -147,36 +236,33 @@ int dico_get_generic(cdico *d, u8 section, u16 key, void *data, u16 maxsize, u16
         return -3;
     }
     
-    for (item=d->head; item!=NULL; item=item->next)
-    {
-        if ((item!=NULL) && (item->key==key && item->section==section))
-        {
-            if (item->size > maxsize) // item is too big
-            {   msgprintf(MSG_DEBUG1, "case2: (item->size > maxsize): item->size =%d, maxsize=%d\n", item->size, maxsize);
-                return -4;
-            }
-            if ((item->size>0) && (item->data!=NULL)) // there may be no data (size==0)
-                memcpy(data, item->data, item->size);
-            if (size!=NULL)
-                *size=item->size;
-            return 0;
-        }
+    if ((index=dico_find(d, section, key))<0)
+    {   msgprintf(MSG_DEBUG1, "case3: not found\n");
+        return -5; // not found
     }
     
-    msgprintf(MSG_DEBUG1, "case3: not found\n");
-    return -5; // not found
+    item=&d->items[index];
+    if (item->size > maxsize) // item is too big
+    {   msgprintf(MSG_DEBUG1, "case2: (item->size > maxsize): item->size =%d, maxsize=%d\n", item->size, maxsize);
+        return -4;
+    }
+    if (item->size>0) // there may be no data (size==0)
+        memcpy(data, dico_item_data(d, item), item->size);
+    if (size!=NULL)
+        *size=item->size;
+    return 0;
 }
 
 int dico_count_one_section(cdico *d, u8 section)
 {
-    cdicoitem *item;
     int count;
+    u32 i;
     
     assert(d);
     
     count=0;
-    for (item=d->head; item!=NULL; item=item->next)
-        if (item->section==section)
+    for (i=0; i < d->count; i++)
+        if (d->items[i].section==section)
             count++;
     
     return count;
@@ -184,16 +270,8 @@ int dico_count_one_section(cdico *d, u8 section)
 
 int dico_count_all_sections(cdico *d)
 {
-    cdicoitem *item;
-    int count;
-    
     assert(d);
-    
-    count=0;
-    for (item=d->head; item!=NULL; item=item->next)
-        count++;
-    
-    return count;
+    return d->count;
 }
 
 int dico_add_u16(cdico *d, u8 section, u16 key, u16 data)
@@ -290,14 +368,16 @@ int dico_show(cdico *d, u8 section, char *debugtxt)
     char buffer[2048];
     char text[2048];
     cdicoitem *item;
+    u32 i;
     
     assert(d);
     msgprintf(MSG_FORCE, "\n-----------------debug-dico-begin(%s)---------------\n", debugtxt);
     
-    if (d->head)
+    if (d->count>0)
     {
-        for (item=d->head; item!=NULL; item=item->next)
+        for (i=0; i < d->count; i++)
         {
+            item=&d->items[i];
             if (item->section==section)
             {
                 snprintf(buffer, sizeof(buffer), "key=[%ld], sizeof(data)=[%d], ", (long)item->key, (int)item->size);
@@ -317,7 +397,7 @@ int dico_show(cdico *d, u8 section, char *debugtxt)
                         snprintf(text, sizeof(text), "type=u64, size=[%d]", (int)item->size);
                         break;
                     case DICTYPE_STRING:
-                        snprintf(text, sizeof(text), "type=str, size=[%d], data=[%s]", (int)item->size, (char*)item->data);
+                        snprintf(text, sizeof(text), "type=str, size=[%d], data=[%s]", (int)item->size, dico_item_data(d, item));
                         break;
                     case DICTYPE_DATA:
                         snprintf(text, sizeof(text), "type=dat, size=[%d]", (int)item->size);
@@ -29,20 +29,35 @@ struct s_dicoitem;
 typedef struct s_dico cdico;
 typedef struct s_dicoitem cdicoitem;
 
-struct s_dico
-{
-    struct s_dicoitem *head; 
-};
+#define DICO_INLINE_ITEMS    16   // items stored in the dico itself before an array is allocated
+#define DICO_INLINE_DATA     512  // bytes of data stored in the dico itself before an arena is allocated
+#define DICO_FAST_KEYS       32   // keys of section zero below that value are found in constant time
 
 struct s_dicoitem
 {   u8         type;
     u8         section;
     u16        key;
     u16        size;
-    char       *data;
-    cdicoitem  *next;
+    u32        offset; // offset of the data in the arena of the dico
+};
+
+// the items are stored in an array in the order they have been added, and all their
+// data are copied in a single arena, so that a dico only needs one malloc() in general
+struct s_dico
+{
+    cdicoitem  *items; // either inlitems or an allocated array
+    u32        count; // how many items are used
+    u32        maxitems; // how many items the array can store
+    char       *data; // either inldata or an allocated arena (which can be a buffer read from the archive)
+    u32        datused; // how many bytes are used in the arena
+    u32        datsize; // size of the arena
+    s32        fastidx[DICO_FAST_KEYS]; // index of the item for (section=0, key) or -1
+    cdicoitem  inlitems[DICO_INLINE_ITEMS];
+    char       inldata[DICO_INLINE_DATA];
 };
 
+#define dico_item_data(d, item)    ((d)->data + (item)->offset)
+
 cdico *dico_alloc();
 int   dico_destroy(cdico *d);
 int   dico_show(cdico *d, u8 section, char *debugtxt);
@@ -50,6 +65,8 @@ int   dico_count_all_sections(cdico *d);
 int   dico_count_one_section(cdico *d, u8 section);
 int   dico_add_data(cdico *d, u8 section, u16 key, const void *data, u16 size);
 int   dico_add_generic(cdico *d, u8 section, u16 key, const void *data, u16 size, u8 type);
+int   dico_attach_data(cdico *d, char *buffer, u32 size);
+int   dico_add_ref(cdico *d, u8 section, u16 key, u32 offset, u16 size, u8 type);
 int   dico_get_generic(cdico *d, u8 section, u16 key, void *data, u16 maxsize, u16 *size);
 int   dico_get_data(cdico *d, u8 section, u16 key, void *data, u16 maxsize, u16 *size);
 int   dico_add_u16(cdico *d, u8 section, u16 key, u16 data);
@@ -0,0 +1,171 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "digest.h"
+#include "error.h"
+
+// The tree hash of a file is the digest of the list of its leaves, where each
+// entry is made of the offset (le64) and size (le32) of the block followed by
+// the digest of its contents. Only the blocks stored with a payload are part of
+// the list: holes and zero blocks are not, as it was already the case with md5.
+
+static int digest_gcryalgo(u16 algo)
+{
+    switch (algo)
+    {
+        case DIGEST_MD5:       return GCRY_MD_MD5;
+        case DIGEST_BLAKE2B:   return GCRY_MD_BLAKE2B_256;
+        case DIGEST_SHA256:    return GCRY_MD_SHA256;
+        default:               return GCRY_MD_NONE;
+    }
+}
+
+char *digestalgostr(int algo)
+{
+    switch (algo)
+    {
+        case DIGEST_MD5:       return "md5";
+        case DIGEST_BLAKE2B:   return "blake2b";
+        case DIGEST_SHA256:    return "sha256";
+        default:               return "unknown";
+    }
+}
+
+int digest_size(u16 algo)
+{
+    int gcryalgo;
+    
+    if ((gcryalgo=digest_gcryalgo(algo))==GCRY_MD_NONE)
+        return -1;
+    return gcry_md_get_algo_dlen(gcryalgo);
+}
+
+// digest of a single data block: this is called by the compression threads
+int digest_leaf(u16 algo, u8 *leaf, u8 *data, u64 len)
+{
+    int gcryalgo;
+    
+    if (algo==DIGEST_MD5 || (gcryalgo=digest_gcryalgo(algo))==GCRY_MD_NONE)
+    {   errprintf("digest algorithm %d cannot be used as a tree hash\n", (int)algo);
+        return -1;
+    }
+    gcry_md_hash_buffer(gcryalgo, leaf, data, len);
+    return 0;
+}
+
+// digest of a whole file which is in memory (small files)
+int digest_buffer(u16 algo, u8 *digest, u8 *data, u64 len)
+{
+    cfiledigest fd;
+    
+    if (filedigest_open(&fd, algo)!=0)
+        return -1;
+    if (filedigest_add_data(&fd, 0, data, len)!=0)
+    {   filedigest_close(&fd, NULL, 0);
+        return -1;
+    }
+    return filedigest_close(&fd, digest, FSA_MAX_DIGESTLEN);
+}
+
+int filedigest_open(cfiledigest *fd, u16 algo)
+{
+    int gcryalgo;
+    
+    assert(fd);
+    
+    if ((gcryalgo=digest_gcryalgo(algo))==GCRY_MD_NONE)
+    {   errprintf("unsupported digest algorithm: %d\n", (int)algo);
+        return -1;
+    }
+    if (gcry_md_open(&fd->ctx, gcryalgo, 0) != GPG_ERR_NO_ERROR)
+    {   errprintf("gcry_md_open() failed\n");
+        return -1;
+    }
+    fd->algo=algo;
+    return 0;
+}
+
+int filedigest_add_data(cfiledigest *fd, u64 offset, u8 *data, u64 len)
+{
+    u8 leaf[FSA_MAX_DIGESTLEN];
+    
+    assert(fd);
+    
+    if (fd->algo==DIGEST_MD5)
+    {   gcry_md_write(fd->ctx, data, len);
+        return 0;
+    }
+    if (digest_leaf(fd->algo, leaf, data, len)!=0)
+        return -1;
+    return filedigest_add_leaf(fd, offset, len, leaf);
+}
+
+int filedigest_add_leaf(cfiledigest *fd, u64 offset, u64 len, u8 *leaf)
+{
+    u64 offset64;
+    u32 len32;
+    
+    assert(fd);
+    
+    if (fd->algo==DIGEST_MD5)
+    {   errprintf("md5 is not computed as a tree hash\n");
+        return -1;
+    }
+    offset64=cpu_to_le64(offset);
+    len32=cpu_to_le32((u32)len);
+    gcry_md_write(fd->ctx, &offset64, sizeof(offset64));
+    gcry_md_write(fd->ctx, &len32, sizeof(len32));
+    gcry_md_write(fd->ctx, leaf, digest_size(fd->algo));
+    return 0;
+}
+
+// returns the size of the digest or -1 on error: the context is always released
+int filedigest_close(cfiledigest *fd, u8 *digest, int digestsize)
+{
+    int gcryalgo;
+    int size;
+    u8 *tmp;
+    
+    assert(fd);
+    
+    gcryalgo=digest_gcryalgo(fd->algo);
+    size=digest_size(fd->algo);
+    if (digest!=NULL)
+    {
+        if (digestsize < size)
+        {   errprintf("buffer too small for the digest\n");
+            gcry_md_close(fd->ctx);
+            return -1;
+        }
+        if ((tmp=gcry_md_read(fd->ctx, gcryalgo))==NULL)
+        {   errprintf("gcry_md_read() failed\n");
+            gcry_md_close(fd->ctx);
+            return -1;
+        }
+        memcpy(digest, tmp, size);
+    }
+    gcry_md_close(fd->ctx);
+    return size;
+}
@@ -0,0 +1,44 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __DIGEST_H__
+#define __DIGEST_H__
+
+#include <gcrypt.h>
+#include "types.h"
+
+struct s_filedigest;
+typedef struct s_filedigest cfiledigest;
+
+// digest of the contents of a regular file: md5 is computed over the data as
+// a stream, the other algorithms are computed as a tree hash where each data
+// block has its own digest (leaf) which can be computed by any thread
+struct s_filedigest
+{   u16          algo; // DIGEST_XXX
+    gcry_md_hd_t ctx;
+};
+
+int  digest_size(u16 algo);
+int  digest_leaf(u16 algo, u8 *leaf, u8 *data, u64 len);
+int  digest_buffer(u16 algo, u8 *digest, u8 *data, u64 len);
+char *digestalgostr(int algo);
+int  filedigest_open(cfiledigest *fd, u16 algo);
+int  filedigest_add_data(cfiledigest *fd, u64 offset, u8 *data, u64 len);
+int  filedigest_add_leaf(cfiledigest *fd, u64 offset, u64 len, u8 *leaf);
+int  filedigest_close(cfiledigest *fd, u8 *digest, int digestsize);
+
+#endif // __DIGEST_H__
@@ -29,21 +29,24 @@
 #include "options.h"
 #include "logfile.h"
 
+int g_msglevel=MSG_FORCE;
+
 int fsaprintf(int level, bool showerrno, bool showloc, const char *file, const char *fct, int line, char *format, ...)
 {
     char buffer[8192];
-    char temp[1024];
     bool msgscreen;
     bool msglogfile;
     va_list ap;
+    int len;
     
     // init
-    memset(buffer, 0, sizeof(buffer));
     msgscreen=(level <= g_options.verboselevel);
     msglogfile=(level <= g_options.debuglevel);
     
     if (msgscreen || msglogfile)
     {
+        buffer[0]=0;
+        
         // 1. format errno and its meaning
         if (showerrno)
             strlcatf(buffer, sizeof(buffer), "[errno=%d, %s]: ", errno, strerror(errno));
@@ -53,10 +56,10 @@ int fsaprintf(int level, bool showerrno, bool showloc, const char *file, const c
             strlcatf(buffer, sizeof(buffer), "%s#%d,%s(): ", file, line, fct);
         
         // 3. format text message
+        len=strlen(buffer);
         va_start(ap, format);
-        vsnprintf(temp, sizeof(temp), format, ap);
+        vsnprintf(buffer+len, sizeof(buffer)-len, format, ap);
         va_end(ap);
-        strlcatf(buffer, sizeof(buffer), "%s", temp);
         
         // 4. show message on screen
         if (msgscreen)
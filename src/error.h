@@ -58,7 +58,15 @@ char *error_int_to_string(s64 err);
 // use errprintf to print an error that does not come from a libc function
 #define errprintf(fmt, args...) fsaprintf(0, false, true, __FILE__, __FUNCTION__, __LINE__, fmt, ## args)
 
-// use msgprintf with a level to show normal messages or debug messages
-#define msgprintf(level, fmt, args...) fsaprintf(level, false, level>=3, __FILE__, __FUNCTION__, __LINE__, fmt, ## args)
+// highest level of the messages which are shown on screen or written in the logfile
+extern int g_msglevel;
+
+// true if messages of that level are shown: use it to skip the code which only prepares messages
+#define msglevel_enabled(level) ((level)<=g_msglevel)
+
+// use msgprintf with a level to show normal messages or debug messages: the arguments
+// are not evaluated when the level is not enabled so it costs nothing on the hot paths
+#define msgprintf(level, fmt, args...) \
+    do { if (msglevel_enabled(level)) fsaprintf(level, false, (level)>=3, __FILE__, __FUNCTION__, __LINE__, fmt, ## args); } while (0)
 
 #endif // __ERROR_H__
@@ -0,0 +1,287 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fnmatch.h>
+
+#include "fsarchiver.h"
+#include "exclude.h"
+#include "strlist.h"
+#include "error.h"
+
+// Each pattern is classified when it is compiled:
+// - "literal" matches only that string: flag exact on the node of the prefix trie
+// - "literal*" matches strings which start with literal: flag any on the node
+// - "*literal" matches strings which end with literal (such as "*.iso"): it
+//   is stored in the suffix trie where the string is walked from its end
+// - other patterns are matched with fnmatch() but only when the string starts
+//   with their literal prefix, which is found while walking the prefix trie
+// The strings are then matched by walking each trie once.
+
+struct s_exclnode
+{   cexclnode *child; // first child
+    cexclnode *next; // next sibling
+    char      c; // character which leads to this node
+    bool      exact; // a literal pattern ends on this node
+    bool      any; // a pattern matches whatever follows this node
+    char      **globs; // patterns whose literal prefix ends on this node
+    int       globcount;
+};
+
+static cexclnode *exclnode_alloc(char c)
+{
+    cexclnode *node;
+    
+    if ((node=malloc(sizeof(cexclnode)))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(cexclnode));
+        return NULL;
+    }
+    memset(node, 0, sizeof(cexclnode));
+    node->c=c;
+    return node;
+}
+
+static void exclnode_destroy(cexclnode *node)
+{
+    cexclnode *child, *next;
+    int i;
+    
+    if (node==NULL)
+        return;
+    for (child=node->child; child!=NULL; child=next)
+    {   next=child->next;
+        exclnode_destroy(child);
+    }
+    for (i=0; i < node->globcount; i++)
+        free(node->globs[i]);
+    free(node->globs);
+    free(node);
+}
+
+static cexclnode *exclnode_child(cexclnode *node, char c)
+{
+    cexclnode *child;
+    
+    for (child=node->child; child!=NULL; child=child->next)
+        if (child->c==c)
+            return child;
+    return NULL;
+}
+
+// walk the trie along str (forwards or backwards) and create the missing nodes
+static cexclnode *exclnode_insert(cexclnode *root, char *str, int len, bool reverse)
+{
+    cexclnode *node=root;
+    cexclnode *child;
+    char c;
+    int i;
+    
+    for (i=0; i < len; i++)
+    {
+        c=reverse ? str[len-1-i] : str[i];
+        if ((child=exclnode_child(node, c))==NULL)
+        {   if ((child=exclnode_alloc(c))==NULL)
+                return NULL;
+            child->next=node->child;
+            node->child=child;
+        }
+        node=child;
+    }
+    return node;
+}
+
+static int exclude_add_glob(char ***globs, int *globcount, char *pattern)
+{
+    char **newglobs;
+    
+    if ((newglobs=realloc(*globs, (*globcount+1)*sizeof(char*)))==NULL)
+    {   errprintf("realloc() failed: out of memory\n");
+        return -1;
+    }
+    *globs=newglobs;
+    if ((newglobs[*globcount]=strdup(pattern))==NULL)
+    {   errprintf("strdup() failed: out of memory\n");
+        return -1;
+    }
+    (*globcount)++;
+    return 0;
+}
+
+int exclude_init(cexclude *ex)
+{
+    assert(ex);
+    memset(ex, 0, sizeof(cexclude));
+    return 0;
+}
+
+int exclude_destroy(cexclude *ex)
+{
+    int i;
+    
+    assert(ex);
+    exclnode_destroy(ex->prefixtrie);
+    exclnode_destroy(ex->suffixtrie);
+    for (i=0; i < ex->globcount; i++)
+        free(ex->globs[i]);
+    free(ex->globs);
+    memset(ex, 0, sizeof(cexclude));
+    return 0;
+}
+
+static int exclude_add_pattern(cexclude *ex, char *pattern)
+{
+    cexclnode *node;
+    int litlen; // length of the literal prefix
+    int len;
+    
+    len=strlen(pattern);
+    litlen=strcspn(pattern, "*?[\\");
+    
+    if (litlen==len) // no wildcard at all
+    {   if ((node=exclnode_insert(ex->prefixtrie, pattern, len, false))==NULL)
+            return -1;
+        node->exact=true;
+    }
+    else if (pattern[litlen]=='*' && litlen==len-1) // "literal*"
+    {   if ((node=exclnode_insert(ex->prefixtrie, pattern, litlen, false))==NULL)
+            return -1;
+        node->any=true;
+    }
+    else if (litlen==0 && pattern[0]=='*' && strcspn(pattern+1, "*?[\\")==len-1) // "*literal"
+    {   if ((node=exclnode_insert(ex->suffixtrie, pattern+1, len-1, true))==NULL)
+            return -1;
+        node->any=true;
+    }
+    else if (litlen > 0) // only try patterns whose literal prefix matches
+    {   if ((node=exclnode_insert(ex->prefixtrie, pattern, litlen, false))==NULL)
+            return -1;
+        if (exclude_add_glob(&node->globs, &node->globcount, pattern)!=0)
+            return -1;
+    }
+    else // pattern starting with a wildcard: always tried
+    {   if (exclude_add_glob(&ex->globs, &ex->globcount, pattern)!=0)
+            return -1;
+    }
+    
+    ex->patcount++;
+    return 0;
+}
+
+int exclude_compile(cexclude *ex, cstrlist *patterns)
+{
+    char *pattern;
+    int i;
+    
+    assert(ex);
+    assert(patterns);
+    
+    exclude_destroy(ex);
+    if ((ex->prefixtrie=exclnode_alloc(0))==NULL || (ex->suffixtrie=exclnode_alloc(0))==NULL)
+        return -1;
+    
+    for (i=0; (pattern=strlist_get(patterns, i))!=NULL; i++)
+    {   if (exclude_add_pattern(ex, pattern)!=0)
+        {   errprintf("cannot compile exclusion pattern [%s]\n", pattern);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// returns true if string matches one of the patterns
+bool exclude_match(cexclude *ex, char *string)
+{
+    cexclnode *node;
+    int len;
+    int i;
+    
+    assert(ex);
+    
+    if (ex->patcount==0)
+        return false;
+    
+    for (node=ex->prefixtrie, i=0; node!=NULL; node=exclnode_child(node, string[i++]))
+    {
+        if (node->any==true)
+            return true;
+        for (len=0; len < node->globcount; len++)
+            if (fnmatch(node->globs[len], string, 0)==0)
+                return true;
+        if (string[i]==0)
+        {   if (node->exact==true)
+                return true;
+            break;
+        }
+    }
+    
+    len=strlen(string);
+    for (node=ex->suffixtrie, i=len-1; (i>=0) && ((node=exclnode_child(node, string[i]))!=NULL); i--)
+        if (node->any==true)
+            return true;
+    
+    for (i=0; i < ex->globcount; i++)
+        if (fnmatch(ex->globs[i], string, 0)==0)
+            return true;
+    
+    return false;
+}
+
+// returns true if a parent directory of relpath is excluded (either its name or its path): the
+// result for the last parent directory is cached since the objects of a directory are consecutive
+bool exclude_match_parents(cexclude *ex, char *relpath)
+{
+    char dirpath[PATH_MAX];
+    char *sep;
+    bool excl=false;
+    
+    assert(ex);
+    
+    if (ex->patcount==0)
+        return false;
+    
+    snprintf(dirpath, sizeof(dirpath), "%s", relpath);
+    if ((sep=strrchr(dirpath, '/'))==NULL)
+        return false;
+    *sep=0;
+    if (strcmp(dirpath, ex->lastdir)==0)
+        return ex->lastdirexcl;
+    
+    snprintf(ex->lastdir, sizeof(ex->lastdir), "%s", dirpath);
+    while ((excl==false) && (strlen(dirpath)>1))
+    {
+        sep=strrchr(dirpath, '/');
+        if ((sep!=NULL) && (sep[1]!=0) && (exclude_match(ex, sep+1)==true))
+            excl=true;
+        else if (exclude_match(ex, dirpath)==true)
+            excl=true;
+        else if (sep==NULL)
+            break;
+        else
+            *sep=0;
+    }
+    ex->lastdirexcl=excl;
+    
+    return excl;
+}
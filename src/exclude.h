@@ -0,0 +1,50 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __EXCLUDE_H__
+#define __EXCLUDE_H__
+
+#include <limits.h>
+#include "types.h"
+
+struct s_strlist;
+
+struct s_exclnode;
+typedef struct s_exclnode cexclnode;
+
+struct s_exclude;
+typedef struct s_exclude cexclude;
+
+// exclusion patterns compiled once: the patterns are matched with the same
+// rules as fnmatch(pattern, string, 0) but most of them never call fnmatch
+struct s_exclude
+{   cexclnode *prefixtrie; // literal part at the beginning of each pattern
+    cexclnode *suffixtrie; // patterns such as "*.ext" stored in reverse order
+    char      **globs; // patterns starting with a wildcard which are not simple suffixes
+    int       globcount;
+    int       patcount;
+    char      lastdir[PATH_MAX]; // last parent directory checked by exclude_match_parents()
+    bool      lastdirexcl; // true if lastdir or one of its parents is excluded
+};
+
+int  exclude_init(cexclude *ex);
+int  exclude_compile(cexclude *ex, struct s_strlist *patterns);
+bool exclude_match(cexclude *ex, char *string);
+bool exclude_match_parents(cexclude *ex, char *relpath);
+int  exclude_destroy(cexclude *ex);
+
+#endif // __EXCLUDE_H__
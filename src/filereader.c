@@ -0,0 +1,635 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <fcntl.h>
+
+#include "fsarchiver.h"
+#include "filereader.h"
+#include "dico.h"
+#include "common.h"
+#include "error.h"
+#include "digest.h"
+
+// The data blocks of a large file are read with pread() by several threads
+// so that a single large file is not limited by the speed of one read() loop.
+// Each reader thread takes the next block number, and stores the result in
+// the slot (blknum % slotcnt). The consumer gets the blocks back in the
+// order of the offsets, and the readers never run more than slotcnt blocks
+// ahead of the consumer so that the memory usage is bounded. The blocks
+// which are entirely in a hole of a sparse file are not read at all.
+
+struct s_frslot;
+typedef struct s_frslot cfrslot;
+
+struct s_frslot
+{   bool   ready;      // true when the block has been read and is waiting for the consumer
+    u8     *data;      // buffer with the block contents (padded with zeros after readsize)
+    s64    readsize;   // how many bytes have been read from the file (-1 if read failed)
+    int    readerr;    // errno of the failed read
+};
+
+struct s_filereader
+{   int             fd;
+    u64             filesize;
+    u32             blksize;
+    u64             blkcount;
+    u64             nextread;   // number of the next block to be read by a reader thread
+    u64             nextcons;   // number of the next block to be returned to the consumer
+    u64             *holes;     // pairs of (offset, length) of the holes aligned on blksize
+    int             holecount;
+    int             readhole;   // first hole after nextread
+    int             conshole;   // first hole after nextcons
+    bool            stop;
+    int             jobs;
+    int             slotcnt;
+    cfrslot         *slots;
+    pthread_t       *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+};
+
+static u32 filereader_blocksize(cfilereader *fr, u64 blknum)
+{
+    return (u32)min(fr->filesize - blknum*(u64)fr->blksize, (u64)fr->blksize);
+}
+
+// returns the first block >= blknum which is not entirely in a hole
+static u64 filereader_skip_holes(cfilereader *fr, u64 blknum, int *holeidx)
+{
+    u64 offset=blknum*(u64)fr->blksize;
+    u64 holeend;
+    
+    while (*holeidx < fr->holecount && offset < fr->filesize)
+    {
+        holeend=fr->holes[2*(*holeidx)] + fr->holes[2*(*holeidx)+1];
+        if (holeend <= offset) // hole is before the current block
+        {   (*holeidx)++;
+        }
+        else if (fr->holes[2*(*holeidx)] <= offset) // current block is in the hole
+        {   offset=holeend;
+            (*holeidx)++;
+        }
+        else // next hole is after the current block
+        {   break;
+        }
+    }
+    
+    return (offset + fr->blksize - 1) / fr->blksize;
+}
+
+static int filereader_readblock(cfilereader *fr, u64 blknum, cfrslot *slot)
+{
+    u32 size=filereader_blocksize(fr, blknum);
+    u64 offset=blknum*(u64)fr->blksize;
+    s64 done=0;
+    ssize_t res;
+    
+    slot->readerr=0;
+    if ((slot->data=malloc(size))==NULL)
+    {   slot->readsize=-1;
+        slot->readerr=ENOMEM;
+        return -1;
+    }
+    
+    while (done < size)
+    {
+        res=pread(fr->fd, slot->data+done, size-done, offset+done);
+        if (res<0 && errno==EINTR)
+            continue;
+        if (res<0)
+        {   slot->readerr=errno;
+            slot->readsize=-1;
+            return -1;
+        }
+        if (res==0) // file has been truncated
+            break;
+        done+=res;
+    }
+    
+    if (done < size)
+        memset(slot->data+done, 0, size-done);
+    slot->readsize=done;
+    return 0;
+}
+
+static void *filereader_thread_fct(void *args)
+{
+    cfilereader *fr=(cfilereader*)args;
+    cfrslot slot;
+    u64 blknum;
+    
+    while (true)
+    {
+        assert(pthread_mutex_lock(&fr->mutex)==0);
+        while (!fr->stop && fr->nextread < fr->blkcount && fr->nextread >= fr->nextcons+fr->slotcnt)
+            pthread_cond_wait(&fr->cond, &fr->mutex);
+        if (fr->stop || fr->nextread >= fr->blkcount)
+        {   assert(pthread_mutex_unlock(&fr->mutex)==0);
+            break;
+        }
+        blknum=fr->nextread;
+        fr->nextread=filereader_skip_holes(fr, blknum+1, &fr->readhole);
+        assert(pthread_mutex_unlock(&fr->mutex)==0);
+        
+        memset(&slot, 0, sizeof(slot));
+        filereader_readblock(fr, blknum, &slot);
+        slot.ready=true;
+        
+        assert(pthread_mutex_lock(&fr->mutex)==0);
+        fr->slots[blknum % fr->slotcnt]=slot;
+        pthread_cond_broadcast(&fr->cond);
+        assert(pthread_mutex_unlock(&fr->mutex)==0);
+    }
+    
+    return NULL;
+}
+
+// find the ranges of blocks which are entirely in a hole of a sparse file
+// holes[2*i] is the offset of hole i and holes[2*i+1] is its length: both are
+// multiples of blksize except the end of the last hole which can be filesize
+// returns how many holes have been found (0 if the filesystem can't tell)
+int filereader_find_holes(int fd, u64 filesize, u32 blksize, u64 *holes, int maxholes)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    u64 holestart;
+    u64 holeend;
+    s64 datapos;
+    s64 holepos;
+    u64 pos=0;
+    int count=0;
+    
+    while (pos < filesize && count < maxholes)
+    {
+        if ((datapos=lseek64(fd, pos, SEEK_DATA))<0)
+        {   if (errno!=ENXIO) // SEEK_DATA not supported by the filesystem
+                return 0;
+            datapos=filesize; // no more data after pos
+        }
+        datapos=min((u64)datapos, filesize);
+        
+        // only keep the blocks which are entirely in the hole [pos, datapos)
+        holestart=((pos + blksize - 1) / blksize) * blksize;
+        holeend=((u64)datapos>=filesize) ? filesize : ((datapos / blksize) * blksize);
+        if (holeend > holestart)
+        {
+            if (count>0 && holes[2*(count-1)] + holes[2*(count-1)+1] == holestart)
+            {   holes[2*(count-1)+1]+=holeend-holestart;
+            }
+            else
+            {   holes[2*count]=holestart;
+                holes[2*count+1]=holeend-holestart;
+                count++;
+            }
+        }
+        
+        if ((u64)datapos >= filesize)
+            break;
+        if ((holepos=lseek64(fd, datapos, SEEK_HOLE))<0)
+            return 0;
+        pos=holepos;
+    }
+    
+    return count;
+#else
+    return 0;
+#endif
+}
+
+cfilereader *filereader_alloc(int fd, u64 filesize, u32 blksize, int jobs, u64 *holes, int holecount)
+{
+    cfilereader *fr;
+    int i;
+    
+    if (fd<0 || blksize==0 || (holecount>0 && holes==NULL))
+    {   errprintf("invalid param\n");
+        return NULL;
+    }
+    
+    if ((fr=malloc(sizeof(cfilereader)))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(cfilereader));
+        return NULL;
+    }
+    memset(fr, 0, sizeof(cfilereader));
+    fr->fd=fd;
+    fr->filesize=filesize;
+    fr->blksize=blksize;
+    fr->blkcount=(filesize + blksize - 1) / blksize;
+    if (holecount>0)
+    {   if ((fr->holes=malloc(2*holecount*sizeof(u64)))==NULL)
+        {   errprintf("malloc() failed: out of memory\n");
+            free(fr);
+            return NULL;
+        }
+        memcpy(fr->holes, holes, 2*holecount*sizeof(u64));
+        fr->holecount=holecount;
+    }
+    fr->nextcons=filereader_skip_holes(fr, 0, &fr->conshole);
+    fr->nextread=filereader_skip_holes(fr, 0, &fr->readhole);
+    fr->jobs=max(0, min(jobs, FSA_MAX_READJOBS));
+    if (fr->jobs<=1 || fr->blkcount<=1) // not worth using threads
+        fr->jobs=0;
+    if (fr->jobs==0)
+        return fr;
+    
+    fr->slotcnt=2*fr->jobs;
+    fr->slots=calloc(fr->slotcnt, sizeof(cfrslot));
+    fr->threads=calloc(fr->jobs, sizeof(pthread_t));
+    if (!fr->slots || !fr->threads)
+    {   errprintf("calloc() failed: out of memory\n");
+        free(fr->slots);
+        free(fr->threads);
+        free(fr->holes);
+        free(fr);
+        return NULL;
+    }
+    pthread_mutex_init(&fr->mutex, NULL);
+    pthread_cond_init(&fr->cond, NULL);
+    
+    for (i=0; i < fr->jobs; i++)
+    {
+        if (pthread_create(&fr->threads[i], NULL, filereader_thread_fct, (void*)fr) != 0)
+        {   errprintf("pthread_create(filereader_thread_fct) failed\n");
+            fr->jobs=i; // only wait for the threads which have been created
+            filereader_destroy(fr);
+            return NULL;
+        }
+    }
+    
+    msgprintf(MSG_DEBUG1, "filereader: reading %lld blocks using %d threads\n", (long long)fr->blkcount, fr->jobs);
+    return fr;
+}
+
+// returns 0 when a block has been returned, 1 when all blocks have been read, -1 on error
+// the caller owns *data and must free it (directly or by passing it to the queue)
+int filereader_next(cfilereader *fr, u8 **data, u32 *size, u64 *offset, s64 *readsize, int *readerr)
+{
+    cfrslot slot;
+    cfrslot *cur;
+    
+    if (!fr || !data || !size || !offset || !readsize || !readerr)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    if (fr->nextcons >= fr->blkcount)
+        return 1; // no more blocks
+    
+    if (fr->jobs==0) // read the block in the current thread
+    {
+        memset(&slot, 0, sizeof(slot));
+        filereader_readblock(fr, fr->nextcons, &slot);
+    }
+    else // wait for the reader threads to provide the next block
+    {
+        assert(pthread_mutex_lock(&fr->mutex)==0);
+        cur=&fr->slots[fr->nextcons % fr->slotcnt];
+        while (cur->ready==false)
+            pthread_cond_wait(&fr->cond, &fr->mutex);
+        slot=*cur;
+        memset(cur, 0, sizeof(cfrslot));
+        assert(pthread_mutex_unlock(&fr->mutex)==0);
+    }
+    
+    *data=slot.data;
+    *size=filereader_blocksize(fr, fr->nextcons);
+    *offset=fr->nextcons*(u64)fr->blksize;
+    *readsize=slot.readsize;
+    *readerr=slot.readerr;
+    
+    if (fr->jobs>0)
+    {   assert(pthread_mutex_lock(&fr->mutex)==0);
+        fr->nextcons=filereader_skip_holes(fr, fr->nextcons+1, &fr->conshole);
+        pthread_cond_broadcast(&fr->cond); // a slot is free: wake up readers
+        assert(pthread_mutex_unlock(&fr->mutex)==0);
+    }
+    else
+    {   fr->nextcons=filereader_skip_holes(fr, fr->nextcons+1, &fr->conshole);
+    }
+    
+    return 0;
+}
+
+int filereader_destroy(cfilereader *fr)
+{
+    int i;
+    
+    if (!fr)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    if (fr->threads!=NULL)
+    {
+        assert(pthread_mutex_lock(&fr->mutex)==0);
+        fr->stop=true;
+        pthread_cond_broadcast(&fr->cond);
+        assert(pthread_mutex_unlock(&fr->mutex)==0);
+        
+        for (i=0; i < fr->jobs; i++)
+            if (pthread_join(fr->threads[i], NULL) != 0)
+                errprintf("pthread_join(filereader_thread_fct) failed\n");
+        
+        // release blocks which have been read but not consumed (interrupted or error)
+        for (i=0; i < fr->slotcnt; i++)
+            free(fr->slots[i].data);
+        
+        pthread_cond_destroy(&fr->cond);
+        pthread_mutex_destroy(&fr->mutex);
+        free(fr->threads);
+        free(fr->slots);
+    }
+    
+    free(fr->holes);
+    free(fr);
+    return 0;
+}
+
+// The small files are read by a pool of threads so that the latency of
+// open/read/close does not limit the speed when there are many small files.
+// The items are stored in a ring in the order they have been added, and
+// they are returned in that order so that the archive does not depend on
+// which thread finished first.
+
+enum {FILEPOOL_TODO=1, FILEPOOL_BUSY, FILEPOOL_DONE};
+
+struct s_filepool
+{   cfilepoolitem   *items[FSA_MAX_SMALLREADQUEUE];
+    u64             head;      // oldest item (next one to be returned)
+    u64             nextread;  // next item to be read by a thread
+    u64             tail;      // where the next item will be added
+    bool            stop;
+    int             jobs;
+    u16             digestalgo; // digest of the files computed by the reader threads
+    pthread_t       *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+};
+
+static void filepool_readitem(cfilepoolitem *item)
+{
+    s64 done=0;
+    ssize_t res;
+    int fd;
+    
+    item->readerr=0;
+    item->openfailed=false;
+    if ((item->data=malloc(item->filesize))==NULL)
+    {   item->readsize=-1;
+        item->readerr=ENOMEM;
+        return;
+    }
+    
+    if ((fd=open64(item->fullpath, O_RDONLY|O_LARGEFILE))<0)
+    {   item->readsize=-1;
+        item->readerr=errno;
+        item->openfailed=true;
+        return;
+    }
+    
+    while (done < item->filesize)
+    {
+        res=read(fd, item->data+done, item->filesize-done);
+        if (res<0 && errno==EINTR)
+            continue;
+        if (res<0)
+        {   item->readerr=errno;
+            item->readsize=-1;
+            close(fd);
+            return;
+        }
+        if (res==0) // file has been truncated
+            break;
+        done+=res;
+    }
+    close(fd);
+    
+    if (done < item->filesize)
+        memset(item->data+done, 0, item->filesize-done);
+    item->readsize=done;
+    
+    digest_buffer(item->digestalgo, item->digest, item->data, item->filesize);
+}
+
+static void *filepool_thread_fct(void *args)
+{
+    cfilepool *p=(cfilepool*)args;
+    cfilepoolitem *item;
+    
+    while (true)
+    {
+        assert(pthread_mutex_lock(&p->mutex)==0);
+        while (!p->stop && p->nextread >= p->tail)
+            pthread_cond_wait(&p->cond, &p->mutex);
+        if (p->stop)
+        {   assert(pthread_mutex_unlock(&p->mutex)==0);
+            break;
+        }
+        item=p->items[p->nextread++ % FSA_MAX_SMALLREADQUEUE];
+        item->status=FILEPOOL_BUSY;
+        assert(pthread_mutex_unlock(&p->mutex)==0);
+        
+        filepool_readitem(item);
+        
+        assert(pthread_mutex_lock(&p->mutex)==0);
+        item->status=FILEPOOL_DONE;
+        pthread_cond_broadcast(&p->cond);
+        assert(pthread_mutex_unlock(&p->mutex)==0);
+    }
+    
+    return NULL;
+}
+
+cfilepool *filepool_alloc(int jobs, u16 digestalgo)
+{
+    cfilepool *p;
+    int i;
+    
+    if ((p=malloc(sizeof(cfilepool)))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(cfilepool));
+        return NULL;
+    }
+    memset(p, 0, sizeof(cfilepool));
+    p->jobs=max(0, min(jobs, FSA_MAX_READJOBS));
+    p->digestalgo=digestalgo;
+    if (p->jobs<=1) // files are read in the current thread
+    {   p->jobs=0;
+        return p;
+    }
+    
+    if ((p->threads=calloc(p->jobs, sizeof(pthread_t)))==NULL)
+    {   errprintf("calloc() failed: out of memory\n");
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    
+    for (i=0; i < p->jobs; i++)
+    {
+        if (pthread_create(&p->threads[i], NULL, filepool_thread_fct, (void*)p) != 0)
+        {   errprintf("pthread_create(filepool_thread_fct) failed\n");
+            p->jobs=i; // only wait for the threads which have been created
+            filepool_destroy(p);
+            return NULL;
+        }
+    }
+    
+    return p;
+}
+
+bool filepool_full(cfilepool *p)
+{
+    return (p->tail - p->head) >= ((p->jobs>0) ? FSA_MAX_SMALLREADQUEUE : 1);
+}
+
+// the pool must not be full: call filepool_get() first to make some space
+int filepool_add(cfilepool *p, struct s_dico *header, char *relpath, char *fullpath, u64 filesize)
+{
+    cfilepoolitem *item;
+    
+    if (!p || !header || !relpath || !fullpath)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    if (filepool_full(p))
+    {   errprintf("the pool is full\n");
+        return -1;
+    }
+    
+    if ((item=malloc(sizeof(cfilepoolitem)))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(cfilepoolitem));
+        return -1;
+    }
+    memset(item, 0, sizeof(cfilepoolitem));
+    item->header=header;
+    item->filesize=filesize;
+    item->digestalgo=p->digestalgo;
+    item->relpath=strdup(relpath);
+    item->fullpath=strdup(fullpath);
+    if (!item->relpath || !item->fullpath)
+    {   errprintf("strdup() failed: out of memory\n");
+        filepool_item_free(item);
+        return -1;
+    }
+    
+    if (p->jobs==0) // read the file in the current thread
+    {
+        filepool_readitem(item);
+        item->status=FILEPOOL_DONE;
+        p->items[p->tail++ % FSA_MAX_SMALLREADQUEUE]=item;
+        return 0;
+    }
+    
+    item->status=FILEPOOL_TODO;
+    assert(pthread_mutex_lock(&p->mutex)==0);
+    p->items[p->tail++ % FSA_MAX_SMALLREADQUEUE]=item;
+    pthread_cond_broadcast(&p->cond);
+    assert(pthread_mutex_unlock(&p->mutex)==0);
+    
+    return 0;
+}
+
+// returns the oldest item when it has been read: 0 if an item is returned, 1 if there
+// is no item ready (or no item at all when wait is true) and -1 in case of an error
+int filepool_get(cfilepool *p, cfilepoolitem **item, bool wait)
+{
+    cfilepoolitem *cur;
+    
+    if (!p || !item)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    if (p->head >= p->tail)
+        return 1; // pool is empty
+    
+    cur=p->items[p->head % FSA_MAX_SMALLREADQUEUE];
+    if (p->jobs>0)
+    {
+        assert(pthread_mutex_lock(&p->mutex)==0);
+        while (wait && cur->status!=FILEPOOL_DONE)
+            pthread_cond_wait(&p->cond, &p->mutex);
+        if (cur->status!=FILEPOOL_DONE)
+        {   assert(pthread_mutex_unlock(&p->mutex)==0);
+            return 1; // oldest item not read yet
+        }
+        assert(pthread_mutex_unlock(&p->mutex)==0);
+    }
+    
+    p->items[p->head++ % FSA_MAX_SMALLREADQUEUE]=NULL;
+    *item=cur;
+    return 0;
+}
+
+int filepool_item_free(cfilepoolitem *item)
+{
+    if (!item)
+        return -1;
+    free(item->relpath);
+    free(item->fullpath);
+    free(item->data);
+    free(item);
+    return 0;
+}
+
+// the items which have not been returned are destroyed with their headers
+int filepool_destroy(cfilepool *p)
+{
+    cfilepoolitem *item;
+    int i;
+    
+    if (!p)
+    {   errprintf("invalid param\n");
+        return -1;
+    }
+    
+    if (p->threads!=NULL)
+    {
+        assert(pthread_mutex_lock(&p->mutex)==0);
+        p->stop=true;
+        pthread_cond_broadcast(&p->cond);
+        assert(pthread_mutex_unlock(&p->mutex)==0);
+        
+        for (i=0; i < p->jobs; i++)
+            if (pthread_join(p->threads[i], NULL) != 0)
+                errprintf("pthread_join(filepool_thread_fct) failed\n");
+        
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->mutex);
+        free(p->threads);
+    }
+    
+    for (; p->head < p->tail; p->head++)
+    {   item=p->items[p->head % FSA_MAX_SMALLREADQUEUE];
+        dico_destroy(item->header);
+        filepool_item_free(item);
+    }
+    
+    free(p);
+    return 0;
+}
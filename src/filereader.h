@@ -0,0 +1,60 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __FILEREADER_H__
+#define __FILEREADER_H__
+
+#include "types.h"
+
+struct s_filereader;
+typedef struct s_filereader cfilereader;
+
+int         filereader_find_holes(int fd, u64 filesize, u32 blksize, u64 *holes, int maxholes);
+cfilereader *filereader_alloc(int fd, u64 filesize, u32 blksize, int jobs, u64 *holes, int holecount);
+int         filereader_next(cfilereader *fr, u8 **data, u32 *size, u64 *offset, s64 *readsize, int *readerr);
+int         filereader_destroy(cfilereader *fr);
+
+struct s_dico;
+
+struct s_filepool;
+typedef struct s_filepool cfilepool;
+
+struct s_filepoolitem;
+typedef struct s_filepoolitem cfilepoolitem;
+
+struct s_filepoolitem
+{   int            status;     // FILEPOOL_TODO/BUSY/DONE
+    struct s_dico  *header;    // object header of the file (owned by the caller once the item is returned)
+    char           *relpath;
+    char           *fullpath;
+    u64            filesize;
+    u8             *data;      // file contents padded with zeros to filesize
+    s64            readsize;   // how many bytes have been read (-1 if open or read failed)
+    int            readerr;    // errno of the failed open/read
+    bool           openfailed; // true if open failed, false if read failed
+    u16            digestalgo; // DIGEST_XXX
+    u8             digest[FSA_MAX_DIGESTLEN]; // digest of the contents (computed by the reader thread)
+};
+
+cfilepool   *filepool_alloc(int jobs, u16 digestalgo);
+int         filepool_add(cfilepool *p, struct s_dico *header, char *relpath, char *fullpath, u64 filesize);
+int         filepool_get(cfilepool *p, cfilepoolitem **item, bool wait);
+bool        filepool_full(cfilepool *p);
+int         filepool_item_free(cfilepoolitem *item);
+int         filepool_destroy(cfilepool *p);
+
+#endif // __FILEREADER_H__
@@ -24,10 +24,12 @@
 #include <signal.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "fsarchiver.h"
 #include "dico.h"
 #include "common.h"
+#include "checksum.h"
 #include "oper_restore.h"
 #include "oper_save.h"
 #include "oper_probe.h"
@@ -43,7 +45,7 @@
 
 char *valid_magic[]={FSA_MAGIC_MAIN, FSA_MAGIC_VOLH, FSA_MAGIC_VOLF,
     FSA_MAGIC_FSIN, FSA_MAGIC_FSYB, FSA_MAGIC_DATF, FSA_MAGIC_OBJT,
-    FSA_MAGIC_BLKH, FSA_MAGIC_FILF, FSA_MAGIC_DIRS, NULL};
+    FSA_MAGIC_BLKH, FSA_MAGIC_FILF, FSA_MAGIC_DIRS, FSA_MAGIC_OBJC, NULL};
 
 void usage(char *progname, bool examples)
 {
@@ -88,13 +90,25 @@ void usage(char *progname, bool examples)
     msgprintf(MSG_FORCE, " -x: enable support for experimental features (they are disabled by default)\n");
     msgprintf(MSG_FORCE, " -e <pattern>: exclude files and directories that match that pattern\n");
     msgprintf(MSG_FORCE, " -L <label>: set the label of the archive (comment about the contents)\n");
-    msgprintf(MSG_FORCE, " -z <level>: legacy compression level from 0 (very fast) to 9 (very good)\n");
+    msgprintf(MSG_FORCE, " -z <level>: legacy compression level from 0 (very fast) to 9 (very good), or <algo>:<level>\n");
+    msgprintf(MSG_FORCE, "             negative levels are lz4 with an acceleration factor (faster than level 0)\n");
 #ifdef OPTION_ZSTD_SUPPORT
-    msgprintf(MSG_FORCE, " -Z <level>: zstd compression level from 1 (very fast) to 22 (very good)\n");
+    msgprintf(MSG_FORCE, " -Z <level>: zstd compression level from 1 (very fast) to 22 (very good), or -1 to %d (fast levels)\n", FSA_MIN_ZSTD_LEVEL);
 #endif // OPTION_ZSTD_SUPPORT
     msgprintf(MSG_FORCE, " -s <mbsize>: split the archive into several files of <mbsize> megabytes each\n");
     msgprintf(MSG_FORCE, " -j <count>: create more than one (de)compression thread. useful on multi-core cpu\n");
     msgprintf(MSG_FORCE, " -c <password>: encrypt/decrypt data in archive, \"-c -\" for interactive password\n");
+    msgprintf(MSG_FORCE, " -E <algo>: encryption algorithm: aes256gcm (default), chacha20 or blowfish\n");
+    msgprintf(MSG_FORCE, " -k <algo>: checksum of the data blocks: crc32c (default) or fletcher32\n");
+    msgprintf(MSG_FORCE, " -H <algo>: digest of the files: blake2b (default), sha256 or md5\n");
+    msgprintf(MSG_FORCE, " -M: group the headers of the files in compressed metadata blocks\n");
+    msgprintf(MSG_FORCE, " -D: store identical data blocks only once in each volume (deduplication)\n");
+    msgprintf(MSG_FORCE, " -P <rule>: compress the files matching <patterns> with <algo>: <patterns>=<algo>[:<level>]\n");
+    msgprintf(MSG_FORCE, " --adapt[=<min>:<max>]: adapt the compression level to the speed of the disks\n");
+    msgprintf(MSG_FORCE, " --solid[=<mbsize>]: compress segments of <mbsize> megabytes as a single stream (zstd or lzma)\n");
+#ifdef OPTION_ZSTD_SUPPORT
+    msgprintf(MSG_FORCE, " -T: compress the small files with a zstd dictionary trained from these files\n");
+#endif // OPTION_ZSTD_SUPPORT
     msgprintf(MSG_FORCE, " -h: show help and information about how to use fsarchiver with examples\n");
     msgprintf(MSG_FORCE, " -V: show program version and exit\n");
     msgprintf(MSG_FORCE, "<information>\n");
@@ -130,6 +144,8 @@ void usage(char *progname, bool examples)
         msgprintf(MSG_FORCE, "   fsarchiver savefs /data/myarchive.fsa --exclude=share\n");
         msgprintf(MSG_FORCE, " * \e[1mabsolute exclude valid for '/usr/share' but not for '/usr/local/share':\e[0m\n");
         msgprintf(MSG_FORCE, "   fsarchiver savefs /data/myarchive.fsa --exclude=/usr/share\n");
+        msgprintf(MSG_FORCE, " * \e[1mstore the files which are already compressed and use zstd-19 for text files:\e[0m\n");
+        msgprintf(MSG_FORCE, "   fsarchiver savefs -P '*.jpg|*.gz|*.zst=none' -P '*.txt|*.log=zstd:19' /data/myarchive.fsa /dev/sda1\n");
         msgprintf(MSG_FORCE, " * \e[1msave a filesystem (/dev/sda1) to an encrypted archive:\e[0m\n");
         msgprintf(MSG_FORCE, "   fsarchiver savefs -c mypassword /data/myarchive1.fsa /dev/sda1\n");
         msgprintf(MSG_FORCE, " * \e[1msame as before but prompt for password in the terminal:\e[0m\n");
@@ -141,6 +157,9 @@ void usage(char *progname, bool examples)
     }
 }
 
+// options which only have a long name
+enum {OPT_ADAPT=256, OPT_SOLID};
+
 static struct option const long_options[] =
 {
     {"overwrite", no_argument, NULL, 'o'},
@@ -155,9 +174,18 @@ static struct option const long_options[] =
     {"version", no_argument, NULL, 'V'},
     {"split", required_argument, NULL, 's'},
     {"cryptpass", required_argument, NULL, 'c'},
+    {"cipher", required_argument, NULL, 'E'},
     {"label", required_argument, NULL, 'L'},
     {"exclude", required_argument, NULL, 'e'},
     {"experimental", no_argument, NULL, 'x'},
+    {"checksum", required_argument, NULL, 'k'},
+    {"digest", required_argument, NULL, 'H'},
+    {"metablocks", no_argument, NULL, 'M'},
+    {"dedup", no_argument, NULL, 'D'},
+    {"policy", required_argument, NULL, 'P'},
+    {"adapt", optional_argument, NULL, OPT_ADAPT},
+    {"solid", optional_argument, NULL, OPT_SOLID},
+    {"zstd-dict", no_argument, NULL, 'T'},
     {NULL, 0, NULL, 0}
 };
 
@@ -172,6 +200,8 @@ int process_cmdline(int argc, char **argv)
     char *archive=NULL;
     char tempbuf[1024];
     char *progname;
+    int minlevel;
+    int maxlevel;
     int fscount;
     int argcok;
     int ret=0;
@@ -192,6 +222,13 @@ int process_cmdline(int argc, char **argv)
     g_options.compressjobs=1;
     g_options.datablocksize=FSA_DEF_BLKSIZE;
     g_options.encryptalgo=ENCRYPT_NONE;
+    g_options.csumalgo=FSA_DEF_CSUM_ALGO;
+    g_options.digestalgo=FSA_DEF_DIGEST_ALGO;
+    g_options.metablocks=false;
+    g_options.dedup=false;
+    g_options.adapt=false;
+    g_options.zstddict=false;
+    g_options.solidsize=0;
     snprintf(g_options.archlabel, sizeof(g_options.archlabel), "<none>");
     g_options.encryptpass[0]=0;
 
@@ -206,7 +243,7 @@ int process_cmdline(int argc, char **argv)
     g_options.compresslevel=FSA_DEF_COMPRESS_LEVEL; // default level for gzip
 #endif // OPTION_ZSTD_SUPPORT
 
-    while ((c = getopt_long(argc, argv, "oaAvdj:hVs:c:L:e:xz:Z:", long_options, NULL)) != EOF)
+    while ((c = getopt_long(argc, argv, "oaAvdj:hVs:c:E:L:e:xz:Z:k:H:MDP:T", long_options, NULL)) != EOF)
     {
         switch (c)
         {
@@ -243,6 +280,37 @@ int process_cmdline(int argc, char **argv)
             case 'e': // exclude files/directories
                 strlist_add(&g_options.exclude, optarg);
                 break;
+            case 'T': // zstd dictionary for the small files
+#ifdef OPTION_ZSTD_SUPPORT
+                g_options.zstddict=true;
+#else
+                errprintf("zstd compression is not available as its support has been disabled at compilation time\n");
+                return -1;
+#endif // OPTION_ZSTD_SUPPORT
+                break;
+            case OPT_ADAPT: // compression level chosen by the compression threads
+                g_options.adapt=true;
+                g_options.adaptminlevel=g_options.adaptmaxlevel=INT_MIN; // chosen when the algorithm is known
+                if (optarg!=NULL && (sscanf(optarg, "%d:%d", &g_options.adaptminlevel, &g_options.adaptmaxlevel)!=2 || g_options.adaptminlevel>g_options.adaptmaxlevel))
+                {   errprintf("argument of option --adapt is invalid (%s). It must be <min>:<max>\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case OPT_SOLID: // large segments compressed as a single stream
+                g_options.solidsize=(optarg!=NULL)?((u64)atoll(optarg))*((u64)1024LL*1024LL):FSA_DEF_SOLIDSIZE;
+                if (g_options.solidsize==0 || g_options.solidsize>FSA_MAX_SOLIDSIZE)
+                {   errprintf("argument of option --solid is invalid (%s). It must be a size between 1 and %d megabytes\n", optarg, FSA_MAX_SOLIDSIZE/(1024*1024));
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case 'P': // compression algo for some types of files
+                if (comppolicy_add(&g_options.comppolicy, optarg)!=0)
+                {   usage(progname, false);
+                    return -1;
+                }
+                break;
             case 's': // split archive into several volumes
                 g_options.splitsize=((u64)atoll(optarg))*((u64)1024LL*1024LL);
                 if (g_options.splitsize==0)
@@ -258,9 +326,19 @@ int process_cmdline(int argc, char **argv)
                 }
                 break;
             case 'z': // legacy compression level
+                if (strchr(optarg, ':')!=NULL) // algorithm and level such as "lz4:9" (lz4hc)
+                {   if (comppolicy_parse_codec(optarg, &g_options.compressalgo, &g_options.compresslevel)!=0)
+                    {   usage(progname, false);
+                        return -1;
+                    }
+                    g_options.fsacomplevel=g_options.compresslevel;
+                    if (g_options.compressalgo==COMPRESS_ZSTD && g_options.compresslevel>19)
+                        g_options.datablocksize=FSA_MAX_BLKSIZE;
+                    break;
+                }
                 g_options.fsacomplevel=atoi(optarg);
-                if (g_options.fsacomplevel<0 || g_options.fsacomplevel>9)
-                {   errprintf("[%s] is not a valid compression level, it must be an integer between 0 and 9.\n", optarg);
+                if (g_options.fsacomplevel<FSA_MIN_LZ4_LEVEL || g_options.fsacomplevel>9)
+                {   errprintf("[%s] is not a valid compression level, it must be an integer between %d and 9.\n", optarg, FSA_MIN_LZ4_LEVEL);
                     usage(progname, false);
                     return -1;
                 }
@@ -280,8 +358,8 @@ int process_cmdline(int argc, char **argv)
                 g_options.compressalgo=COMPRESS_ZSTD;
                 g_options.compresslevel=atoi(optarg);
                 g_options.fsacomplevel=atoi(optarg);
-                if (g_options.compresslevel<1 || g_options.compresslevel>22)
-                {   errprintf("[%s] is not a valid compression level, it must be an integer between 1 and 22.\n", optarg);
+                if (g_options.compresslevel<FSA_MIN_ZSTD_LEVEL || g_options.compresslevel==0 || g_options.compresslevel>FSA_MAX_ZSTD_LEVEL)
+                {   errprintf("[%s] is not a valid compression level, it must be an integer between 1 and %d, or between -1 and %d.\n", optarg, FSA_MAX_ZSTD_LEVEL, FSA_MIN_ZSTD_LEVEL);
                     usage(progname, false);
                     return -1;
                 }
@@ -296,7 +374,8 @@ int process_cmdline(int argc, char **argv)
 #endif // OPTION_ZSTD_SUPPORT
                 break;
             case 'c': // encryption
-                g_options.encryptalgo=ENCRYPT_BLOWFISH;
+                if (g_options.encryptalgo==ENCRYPT_NONE) // unless chosen with -E
+                    g_options.encryptalgo=FSA_DEF_CRYPT_ALGO;
                 if ((strlen(optarg)<FSA_MIN_PASSLEN || strlen(optarg)>FSA_MAX_PASSLEN) && strcmp(optarg, "-")!=0)
                 {   errprintf("the password lenght is incorrect, it must between %d and %d chars, or \"-\" for interactive password prompt.\n", FSA_MIN_PASSLEN, FSA_MAX_PASSLEN);
                     usage(progname, false);
@@ -304,6 +383,49 @@ int process_cmdline(int argc, char **argv)
                 }
                 snprintf((char*)g_options.encryptpass, FSA_MAX_PASSLEN, "%s", optarg);
                 break;
+            case 'E': // encryption algorithm
+                if (strcmp(optarg, "aes256gcm")==0)
+                    g_options.encryptalgo=ENCRYPT_AES256GCM;
+                else if (strcmp(optarg, "chacha20")==0)
+                    g_options.encryptalgo=ENCRYPT_CHACHA20;
+                else if (strcmp(optarg, "blowfish")==0)
+                    g_options.encryptalgo=ENCRYPT_BLOWFISH;
+                else
+                {   errprintf("[%s] is not a valid encryption algorithm, it must be either aes256gcm, chacha20 or blowfish.\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case 'k': // checksum of the data blocks
+                if (strcmp(optarg, "crc32c")==0)
+                    g_options.csumalgo=CSUM_CRC32C;
+                else if (strcmp(optarg, "fletcher32")==0)
+                    g_options.csumalgo=CSUM_FLETCHER32;
+                else
+                {   errprintf("[%s] is not a valid checksum algorithm, it must be either crc32c or fletcher32.\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case 'H': // digest of the regular files
+                if (strcmp(optarg, "blake2b")==0)
+                    g_options.digestalgo=DIGEST_BLAKE2B;
+                else if (strcmp(optarg, "sha256")==0)
+                    g_options.digestalgo=DIGEST_SHA256;
+                else if (strcmp(optarg, "md5")==0)
+                    g_options.digestalgo=DIGEST_MD5;
+                else
+                {   errprintf("[%s] is not a valid digest algorithm, it must be either blake2b, sha256 or md5.\n", optarg);
+                    usage(progname, false);
+                    return -1;
+                }
+                break;
+            case 'M': // group the object headers in metadata blocks
+                g_options.metablocks=true;
+                break;
+            case 'D': // store identical blocks only once
+                g_options.dedup=true;
+                break;
             case 'L': // archive label
                 snprintf(g_options.archlabel, sizeof(g_options.archlabel), "%s", optarg);
                 break;
@@ -319,6 +441,9 @@ int process_cmdline(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
+    // messages above this level are neither shown nor logged
+    g_msglevel=max(g_options.verboselevel, g_options.debuglevel);
+
     // in all cases we need at least 1 parameters
     if (argc < 1)
     {   fprintf(stderr, "No arguments provided, cannot continue\n");
@@ -334,6 +459,55 @@ int process_cmdline(int argc, char **argv)
     g_options.smallfilethresh=min(g_options.datablocksize/4, FSA_MAX_SMALLFILESIZE);
     msgprintf(MSG_DEBUG1, "Files smaller than %ld will be packed with other small files\n", (long)g_options.smallfilethresh);
 
+    // bounds of the level which is chosen for each block when the level adapts to the speed of the disks
+    if (g_options.adapt==true)
+    {
+        if (options_get_compress_levels(g_options.compressalgo, &minlevel, &maxlevel)!=0)
+        {   errprintf("option --adapt requires a compression algorithm which has several levels (zstd, lz4, gzip, bzip2 or lzma)\n");
+            return -1;
+        }
+        // levels >= 20 require a huge amount of memory and the fast levels are only
+        // used when they have been selected: they are never chosen by default
+        if (g_options.adaptminlevel==INT_MIN)
+        {   g_options.adaptminlevel=max(minlevel, min(g_options.compresslevel, 1));
+            g_options.adaptmaxlevel=min(maxlevel, 19);
+        }
+        else if (g_options.adaptminlevel<minlevel || g_options.adaptmaxlevel>maxlevel)
+        {   errprintf("the bounds of option --adapt must be between %d and %d with this compression algorithm\n", minlevel, maxlevel);
+            return -1;
+        }
+        msgprintf(MSG_VERB1, "The compression level will be chosen between %d and %d\n", g_options.adaptminlevel, g_options.adaptmaxlevel);
+    }
+
+    if (g_options.encryptalgo!=ENCRYPT_NONE && g_options.encryptpass[0]==0)
+    {   errprintf("option -E requires a password given with option -c\n");
+        return -1;
+    }
+    
+    // the dictionary is written in clear in the filesystem header and it is made of file contents
+    if (g_options.zstddict==true && g_options.encryptalgo!=ENCRYPT_NONE)
+    {   errprintf("option -T cannot be used with encryption: the dictionary would reveal the contents of files\n");
+        return -1;
+    }
+    if (g_options.zstddict==true && g_options.compressalgo!=COMPRESS_ZSTD)
+        msgprintf(MSG_FORCE, "The zstd dictionary (-T) is only used when the small files are compressed with zstd (-Z)\n");
+
+    // in solid mode the blocks of a segment must go through the same stream in the order of the archive
+    if (g_options.solidsize>0 && g_options.compressalgo!=COMPRESS_ZSTD && g_options.compressalgo!=COMPRESS_LZMA)
+    {   errprintf("option --solid requires zstd or lzma compression\n");
+        return -1;
+    }
+    if (g_options.solidsize>0 && g_options.dedup==true)
+    {   errprintf("option --solid cannot be used with deduplication (-D)\n");
+        return -1;
+    }
+
+    // compile the exclusion patterns once so that each file/dir is matched against all of them at once
+    if (exclude_compile(&g_options.excludematch, &g_options.exclude)!=0)
+    {   errprintf("cannot compile the exclusion patterns\n");
+        return -1;
+    }
+
     // convert commands to integers
     if (strcmp(command, "savefs")==0)
     {   cmd=OPER_SAVEFS;
@@ -495,6 +669,9 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    // select the checksum implementation for this cpu
+    checksum_init();
+
     // init
     options_init();
     queue_init(&g_queue, FSA_MAX_QUEUESIZE);
@@ -44,7 +44,9 @@ enum {VOLUMEFOOTKEY_VOLNUM, VOLUMEFOOTKEY_ARCHID, VOLUMEFOOTKEY_LASTVOL};
 
 // ----------------------------------- algorithms used to process data-------------------------------
 enum {COMPRESS_NULL=0, COMPRESS_NONE, COMPRESS_LZO, COMPRESS_GZIP, COMPRESS_BZIP2, COMPRESS_LZMA, COMPRESS_LZ4, COMPRESS_ZSTD};
-enum {ENCRYPT_NULL=0, ENCRYPT_NONE, ENCRYPT_BLOWFISH};
+enum {ENCRYPT_NULL=0, ENCRYPT_NONE, ENCRYPT_BLOWFISH, ENCRYPT_AES256GCM, ENCRYPT_CHACHA20};
+enum {CSUM_NULL=0, CSUM_FLETCHER32, CSUM_CRC32C};
+enum {DIGEST_NULL=0, DIGEST_MD5, DIGEST_BLAKE2B, DIGEST_SHA256};
 
 // ----------------------------------- dico keys ----------------------------------------------------
 enum {OBJTYPE_NULL=0, OBJTYPE_DIR, OBJTYPE_SYMLINK, OBJTYPE_HARDLINK, OBJTYPE_CHARDEV,
@@ -54,19 +56,23 @@ enum {DISKITEMKEY_NULL=0, DISKITEMKEY_OBJECTID, DISKITEMKEY_PATH, DISKITEMKEY_OB
       DISKITEMKEY_SYMLINK, DISKITEMKEY_HARDLINK, DISKITEMKEY_RDEV, DISKITEMKEY_MODE,
       DISKITEMKEY_SIZE, DISKITEMKEY_UID, DISKITEMKEY_GID, DISKITEMKEY_ATIME, DISKITEMKEY_MTIME,
       DISKITEMKEY_MD5SUM, DISKITEMKEY_MULTIFILESCOUNT, DISKITEMKEY_MULTIFILESOFFSET,
-      DISKITEMKEY_LINKTARGETTYPE, DISKITEMKEY_FLAGS};
+      DISKITEMKEY_LINKTARGETTYPE, DISKITEMKEY_FLAGS, DISKITEMKEY_HOLEMAP,
+      DISKITEMKEY_DIGESTALGO, DISKITEMKEY_DIGEST, DISKITEMKEY_HOLEBLKSIZE};
 
 enum {BLOCKHEADITEMKEY_NULL=0, BLOCKHEADITEMKEY_REALSIZE, BLOCKHEADITEMKEY_BLOCKOFFSET,
       BLOCKHEADITEMKEY_COMPRESSALGO, BLOCKHEADITEMKEY_ENCRYPTALGO, BLOCKHEADITEMKEY_ARSIZE,
-      BLOCKHEADITEMKEY_COMPSIZE, BLOCKHEADITEMKEY_ARCSUM};
+      BLOCKHEADITEMKEY_COMPSIZE, BLOCKHEADITEMKEY_ARCSUM, BLOCKHEADITEMKEY_FLAGS, BLOCKHEADITEMKEY_CSUMALGO,
+      BLOCKHEADITEMKEY_DIGESTALGO, BLOCKHEADITEMKEY_REFOFFSET, BLOCKHEADITEMKEY_COMPLEVEL,
+      BLOCKHEADITEMKEY_SEGMENT, BLOCKHEADITEMKEY_SEGMENTPOS};
 
-enum {BLOCKFOOTITEMKEY_NULL=0, BLOCKFOOTITEMKEY_MD5SUM};
+enum {BLOCKFOOTITEMKEY_NULL=0, BLOCKFOOTITEMKEY_MD5SUM, BLOCKFOOTITEMKEY_DIGEST};
 
 enum {MAINHEADKEY_NULL=0, MAINHEADKEY_FILEFORMATVER, MAINHEADKEY_PROGVERCREAT, MAINHEADKEY_ARCHIVEID,
       MAINHEADKEY_CREATTIME, MAINHEADKEY_ARCHLABEL, MAINHEADKEY_ARCHTYPE, MAINHEADKEY_FSCOUNT,
       MAINHEADKEY_COMPRESSALGO, MAINHEADKEY_COMPRESSLEVEL, MAINHEADKEY_ENCRYPTALGO,
       MAINHEADKEY_BUFCHECKPASSCLEARMD5, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, MAINHEADKEY_FSACOMPLEVEL,
-      MAINHEADKEY_MINFSAVERSION, MAINHEADKEY_HASDIRSINFOHEAD};
+      MAINHEADKEY_MINFSAVERSION, MAINHEADKEY_HASDIRSINFOHEAD, MAINHEADKEY_SOLIDSIZE,
+      MAINHEADKEY_KDFSALT, MAINHEADKEY_KDFITERATIONS};
 
 enum {FSYSHEADKEY_NULL=0, FSYSHEADKEY_FILESYSTEM, FSYSHEADKEY_MNTPATH, FSYSHEADKEY_BYTESTOTAL,
       FSYSHEADKEY_BYTESUSED, FSYSHEADKEY_FSLABEL, FSYSHEADKEY_FSUUID, FSYSHEADKEY_FSINODESIZE,
@@ -82,9 +88,9 @@ enum {FSYSHEADKEY_NULL=0, FSYSHEADKEY_FILESYSTEM, FSYSHEADKEY_MNTPATH, FSYSHEADK
       FSYSHEADKEY_FSINODEBLOCKSPERGROUP, FSYSHEADKEY_FSXFSVERSION,
       FSYSHEADKEY_FSXFSFEATURECOMPAT, FSYSHEADKEY_FSXFSFEATUREROCOMPAT,
       FSYSHEADKEY_FSXFSFEATUREINCOMPAT, FSYSHEADKEY_FSXFSFEATURELOGINCOMPAT,
-      FSYSHEADKEY_FSVFATTYPE, FSYSHEADKEY_FSVFATSERIAL};
+      FSYSHEADKEY_FSVFATTYPE, FSYSHEADKEY_FSVFATSERIAL, FSYSHEADKEY_ZSTDDICT};
 
-enum {DIRSINFOKEY_NULL=0, DIRSINFOKEY_TOTALCOST};
+enum {DIRSINFOKEY_NULL=0, DIRSINFOKEY_TOTALCOST, DIRSINFOKEY_ZSTDDICT};
 
 // -------------------------------- fsarchiver errors ---------------------------------------------
 enum {FSAERR_SUCCESS=0,           // success
@@ -110,7 +116,7 @@ enum {OLDERR_FATAL=1,
 #define FSA_RELDATE              PACKAGE_RELDATE
 #define FSA_FILEFORMAT           PACKAGE_FILEFMT
 
-#define FSA_GCRYPT_VERSION       "1.2.3"
+#define FSA_GCRYPT_VERSION       "1.7.0"
 
 #define FSA_MAX_FILEFMTLEN       32
 #define FSA_MAX_PROGVERLEN       32
@@ -122,14 +128,43 @@ enum {OLDERR_FATAL=1,
 #define FSA_MAX_FSPERARCH        128
 #define FSA_MAX_COMPJOBS         32
 #define FSA_MAX_QUEUESIZE        32
-#define FSA_MAX_BLKSIZE          921600
+#define FSA_MAX_BLKSIZE          921600         // max size of the blocks selected by the compression level and of the shared blocks
 #define FSA_DEF_BLKSIZE          524288
+#define FSA_MAX_LARGEBLKSIZE     4194304        // max size of the blocks of large files (fsarchiver < 0.8.6 cannot read blocks > FSA_MAX_BLKSIZE)
+#define FSA_LARGEBLK_MINCOUNT    64             // the blocks of a file are only made larger if there are still that many of them
+#define FSA_DEF_METABLKSIZE      65536          // uncompressed size of a metadata block: a corrupt block loses its objects
 #define FSA_DEF_COMPRESS_ALGO    COMPRESS_GZIP  // legacy compression is using gzip by default
 #define FSA_DEF_COMPRESS_LEVEL   6              // legacy compression is with "gzip -6" by default
 #define FSA_DEF_ZSTD_LEVEL       8              // default compression level when zstd is used
+#define FSA_MIN_ZSTD_LEVEL       -50            // negative zstd levels are faster and compress less (0 is not a level)
+#define FSA_MAX_ZSTD_LEVEL       22
+#define FSA_MIN_LZ4_LEVEL        -50            // negative lz4 levels use the acceleration factor 1-level
+#define FSA_MAX_LZ4_LEVEL        12             // positive lz4 levels use lz4hc (LZ4HC_CLEVEL_MAX)
+#define FSA_DEF_CSUM_ALGO        CSUM_CRC32C    // checksum of the data blocks (fletcher32 in archives older than 0.8.6)
+#define FSA_DEF_DIGEST_ALGO      DIGEST_BLAKE2B // digest of the regular files (md5 in archives older than 0.8.6)
 #define FSA_MAX_SMALLFILECOUNT   512            // there can be up to FSA_MAX_SMALLFILECOUNT files copied in a single data block
+#define FSA_DEDUP_SMALLFILES     32             // average number of small files in a data block when deduplication is used
+#define FSA_PROBE_SLICES         32             // number of slices of a block which are sampled to detect incompressible data
+#define FSA_PROBE_SLICESIZE      128            // size of each slice which is sampled
+#define FSA_PROBE_FIRSTBLOCKS    2              // the rest of a file is not compressed when its first blocks are incompressible
+#define FSA_PROBE_INTERVAL       4              // ... except one block out of FSA_PROBE_INTERVAL which is probed again
+#define FSA_ADAPT_INTERVAL       8              // the level chosen with --adapt moves by one step at most every 8 blocks
 #define FSA_MAX_SMALLFILESIZE    131072         // files smaller than that will be grouped with other small files in a single data block
 #define FSA_COST_PER_FILE        16384          // how much it cost to copy an empty file/dir/link: used to eval the progress bar
+#define FSA_MAX_READJOBS         8              // max number of threads reading data blocks of a single large file
+#define FSA_MIN_PARREADSIZE      67108864       // files larger than that are read by several threads when using -j
+#define FSA_MAX_SMALLREADQUEUE   256            // max number of small files being read in advance when using -j
+#define FSA_MAX_HOLEMAPCOUNT     4000           // max number of holes recorded in the header of a sparse file
+#define FSA_DEF_FSBLKSIZE        4096           // size of the holes created in sparse files if the fs block size is unknown
+#define FSA_ZSTDDICT_SIZE        65535          // max size of a zstd dictionary: it is stored as a single item in a header
+#define FSA_ZSTDDICT_SAMPLES     1024           // max number of small files used to train a zstd dictionary
+#define FSA_ZSTDDICT_SAMPLESIZE  8192           // only the beginning of the small files is used to train a zstd dictionary
+#define FSA_ZSTDDICT_MINSAMPLES  16             // no dictionary is trained when there are fewer small files than that
+#define FSA_ZSTDDICT_MAXLEVELS   32             // max number of compression levels which can use the dictionary
+#define FSA_DEF_SOLIDSIZE        67108864       // amount of data compressed as a single stream in solid mode (option --solid)
+#define FSA_MAX_SOLIDSIZE        268435456      // max size of a solid segment: the compression window covers the whole segment
+#define FSA_SOLID_MINWINDOWLOG   20             // smallest zstd window used in solid mode
+#define FSA_SOLID_MAXWINDOWLOG   28             // largest zstd window used in solid mode (FSA_MAX_SOLIDSIZE)
 
 #define FSA_MAX_LABELLEN         512
 #define FSA_MIN_PASSLEN          6
@@ -137,8 +172,21 @@ enum {OLDERR_FATAL=1,
 
 #define FSA_FILESYSID_NULL       0xFFFF
 #define FSA_CHECKPASSBUF_SIZE    4096
-
-#define FSA_FILEFLAGS_SPARSE     1<<0           // set when a regfile is a sparse file
+#define FSA_DEF_CRYPT_ALGO       ENCRYPT_AES256GCM // encryption used by option -c (blowfish in archives older than 0.8.6)
+#define FSA_KDF_SALTSIZE         16             // random salt of the key derivation, written in the main header
+#define FSA_KDF_ITERATIONS       200000         // iterations of pbkdf2-sha256 used to derive the key from the password
+#define FSA_AEAD_KEYSIZE         32             // key of aes256-gcm and chacha20-poly1305
+#define FSA_AEAD_NONCESIZE       12             // random nonce written before the encrypted data of each block
+#define FSA_AEAD_TAGSIZE         16             // authentication tag written after the encrypted data of each block
+#define FSA_AEAD_OVERHEAD        (FSA_AEAD_NONCESIZE+FSA_AEAD_TAGSIZE)
+#define FSA_AEAD_MAXAADSIZE      32             // max size of the block fields authenticated with the encrypted data
+#define FSA_MAX_DIGESTLEN        32             // size of the largest file digest (DIGEST_XXX)
+
+#define FSA_FILEFLAGS_SPARSE     (1<<0)         // set when a regfile is a sparse file
+#define FSA_BLKFLAGS_ZERO        (1<<0)         // set when a data block only contains zeros: it has no payload in the archive
+#define FSA_BLKFLAGS_METADATA    (1<<1)         // set when a block contains object headers instead of the data of files
+#define FSA_BLKFLAGS_DEDUP       (1<<2)         // set when the payload is the one of an identical block written before it
+#define FSA_BLKFLAGS_ZSTDDICT    (1<<3)         // set when a block has been compressed with the zstd dictionary of its filesystem
 
 // ----------------------------- fsarchiver magics --------------------------------------------------
 #define FSA_SIZEOF_MAGIC         4
@@ -149,6 +197,7 @@ enum {OLDERR_FATAL=1,
 #define FSA_MAGIC_FSYB           "FsYs" // filesys begin (one per filesystem when the filesys contents start)
 #define FSA_MAGIC_DIRS           "DiRs" // dirs info (one per archive after mainhead before flat dirs/files)
 #define FSA_MAGIC_OBJT           "ObJt" // object header (one per object: regfiles, dirs, symlinks, ...)
+#define FSA_MAGIC_OBJC           "ObJc" // compact object header (replaces FSA_MAGIC_OBJT in new archives)
 #define FSA_MAGIC_BLKH           "BlKh" // datablk header (one per data block, each regfile may have [0-n])
 #define FSA_MAGIC_FILF           "FiLf" // filedat footer (one per regfile, after the list of data blocks)
 #define FSA_MAGIC_DATF           "DaEn" // data footer (one per file system, at the end of its contents, or after the contents of the flatfiles)
@@ -0,0 +1,371 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "fsarchiver.h"
+#include "objhead.h"
+#include "dico.h"
+#include "error.h"
+
+// Compact encoding of the object headers (FSA_MAGIC_OBJC), all the integers are varints:
+// - filesystem id
+// - bitmap of the standard attributes which are present (bit n for key n)
+// - if there is a path: sequence number and number of bytes shared with the previous path
+// - the value of the standard attributes in the order of their keys: integers are stored
+//   as varints and strings/data as their length followed by the bytes (no trailing zero)
+// - count of the other items, then for each: type (u8), section (u8), key, size, data
+
+// type of the standard attributes (DICO_OBJ_SECTION_STDATTR) indexed by their key: this
+// table is part of the file format so new keys can only be appended at the end
+static const u8 objhead_stdtypes[]=
+{   DICTYPE_NULL,   // DISKITEMKEY_NULL
+    DICTYPE_U64,    // DISKITEMKEY_OBJECTID
+    DICTYPE_STRING, // DISKITEMKEY_PATH
+    DICTYPE_U32,    // DISKITEMKEY_OBJTYPE
+    DICTYPE_STRING, // DISKITEMKEY_SYMLINK
+    DICTYPE_STRING, // DISKITEMKEY_HARDLINK
+    DICTYPE_U64,    // DISKITEMKEY_RDEV
+    DICTYPE_U32,    // DISKITEMKEY_MODE
+    DICTYPE_U64,    // DISKITEMKEY_SIZE
+    DICTYPE_U32,    // DISKITEMKEY_UID
+    DICTYPE_U32,    // DISKITEMKEY_GID
+    DICTYPE_U64,    // DISKITEMKEY_ATIME
+    DICTYPE_U64,    // DISKITEMKEY_MTIME
+    DICTYPE_DATA,   // DISKITEMKEY_MD5SUM
+    DICTYPE_U32,    // DISKITEMKEY_MULTIFILESCOUNT
+    DICTYPE_U32,    // DISKITEMKEY_MULTIFILESOFFSET
+    DICTYPE_U64,    // DISKITEMKEY_LINKTARGETTYPE
+    DICTYPE_U64,    // DISKITEMKEY_FLAGS
+    DICTYPE_DATA,   // DISKITEMKEY_HOLEMAP
+    DICTYPE_U16,    // DISKITEMKEY_DIGESTALGO
+    DICTYPE_DATA,   // DISKITEMKEY_DIGEST
+    DICTYPE_U32,    // DISKITEMKEY_HOLEBLKSIZE
+};
+
+#define OBJHEAD_STDCOUNT ((int)(sizeof(objhead_stdtypes)/sizeof(objhead_stdtypes[0])))
+
+static int objhead_intsize(u8 type)
+{
+    switch (type)
+    {
+        case DICTYPE_U16: return sizeof(u16);
+        case DICTYPE_U32: return sizeof(u32);
+        case DICTYPE_U64: return sizeof(u64);
+        default:          return 0;
+    }
+}
+
+static u8 *objhead_put_varint(u8 *bufpos, u64 value)
+{
+    while (value >= 0x80)
+    {   *bufpos++=(u8)(value|0x80);
+        value>>=7;
+    }
+    *bufpos++=(u8)value;
+    return bufpos;
+}
+
+static int objhead_get_varint(u8 **bufpos, u8 *bufend, u64 *value)
+{
+    int shift;
+    u8 *pos;
+    
+    *value=0;
+    for (pos=*bufpos, shift=0; (pos < bufend) && (shift < 64); pos++, shift+=7)
+    {   *value|=((u64)(*pos & 0x7f))<<shift;
+        if ((*pos & 0x80)==0)
+        {   *bufpos=pos+1;
+            return 0;
+        }
+    }
+    return -1; // truncated or too long
+}
+
+// true if the item can be stored at its place in the list of standard attributes
+static bool objhead_is_std(cdico *d, cdicoitem *item)
+{
+    char *data;
+    
+    if ((item->section!=DICO_OBJ_SECTION_STDATTR) || (item->key==DISKITEMKEY_NULL) || (item->key>=OBJHEAD_STDCOUNT))
+        return false;
+    if (item->type!=objhead_stdtypes[item->key])
+        return false;
+    switch (item->type)
+    {
+        case DICTYPE_U16:
+        case DICTYPE_U32:
+        case DICTYPE_U64:
+            return (item->size==objhead_intsize(item->type));
+        case DICTYPE_STRING: // the trailing zero is not stored
+            data=dico_item_data(d, item);
+            return (item->size>0) && (item->size<PATH_MAX) && (memchr(data, 0, item->size)==data+item->size-1);
+        default:
+            return true;
+    }
+}
+
+// max size of the encoded version of that dico
+u64 objhead_maxsize(cdico *d)
+{
+    assert(d);
+    return 5*OBJHEAD_MAXVARINT + d->count*(2*sizeof(u8)+3*OBJHEAD_MAXVARINT) + d->datused;
+}
+
+int objhead_encode(cdico *d, u16 fsid, cobjpathref *ref, u8 *buffer, u8 **bufend)
+{
+    cdicoitem *stditems[OBJHEAD_STDCOUNT];
+    cdicoitem *item;
+    u64 stdmask=0;
+    u64 value;
+    u32 extracount=0;
+    u32 shared=0;
+    u8 *bufpos;
+    u8 *data;
+    char *path;
+    u32 len;
+    int i, j;
+    
+    assert(d);
+    assert(ref);
+    
+    memset(stditems, 0, sizeof(stditems));
+    for (item=d->items; item < d->items+d->count; item++)
+    {   if (objhead_is_std(d, item)==true)
+        {   stditems[item->key]=item;
+            stdmask|=(1ULL<<item->key);
+        }
+        else
+        {   extracount++;
+        }
+    }
+    
+    bufpos=objhead_put_varint(buffer, fsid);
+    bufpos=objhead_put_varint(bufpos, stdmask);
+    
+    // the path is shared with the previous object, except for the first one of a sequence
+    if ((item=stditems[DISKITEMKEY_PATH])!=NULL)
+    {   path=dico_item_data(d, item);
+        if ((ref->valid==true) && (ref->seq+1 < OBJHEAD_FULLPATH_INTERVAL))
+        {   ref->seq++;
+            while (path[shared]!=0 && path[shared]==ref->lastpath[shared])
+                shared++;
+        }
+        else
+        {   ref->seq=0;
+        }
+        memcpy(ref->lastpath, path, item->size);
+        ref->valid=true;
+        bufpos=objhead_put_varint(bufpos, ref->seq);
+        bufpos=objhead_put_varint(bufpos, shared);
+    }
+    
+    for (i=0; i < OBJHEAD_STDCOUNT; i++)
+    {
+        if ((item=stditems[i])==NULL)
+            continue;
+        data=(u8*)dico_item_data(d, item);
+        switch (item->type)
+        {
+            case DICTYPE_U16:
+            case DICTYPE_U32:
+            case DICTYPE_U64: // integers are stored in little endian in the dico
+                for (value=0, j=item->size-1; j>=0; j--)
+                    value=(value<<8)|data[j];
+                bufpos=objhead_put_varint(bufpos, value);
+                break;
+            case DICTYPE_STRING:
+                len=item->size-1;
+                if (i==DISKITEMKEY_PATH)
+                {   data+=shared;
+                    len-=shared;
+                }
+                bufpos=objhead_put_varint(bufpos, len);
+                bufpos=mempcpy(bufpos, data, len);
+                break;
+            default:
+                bufpos=objhead_put_varint(bufpos, item->size);
+                bufpos=mempcpy(bufpos, data, item->size);
+                break;
+        }
+    }
+    
+    // items which are not standard attributes (xattr, winattr, ...)
+    bufpos=objhead_put_varint(bufpos, extracount);
+    for (item=d->items; (extracount>0) && (item < d->items+d->count); item++)
+    {
+        if (objhead_is_std(d, item)==true)
+            continue;
+        *bufpos++=item->type;
+        *bufpos++=item->section;
+        bufpos=objhead_put_varint(bufpos, item->key);
+        bufpos=objhead_put_varint(bufpos, item->size);
+        bufpos=mempcpy(bufpos, dico_item_data(d, item), item->size);
+    }
+    
+    *bufend=bufpos;
+    return 0;
+}
+
+int objhead_decode(cdico *d, u16 *fsid, cobjpathref *ref, u8 *buffer, u8 *bufend)
+{
+    char text[PATH_MAX];
+    u8 intdata[sizeof(u64)];
+    u64 stdmask;
+    u64 shared=0;
+    u64 extracount;
+    u64 value;
+    u64 seq;
+    u64 len;
+    u8 *bufpos=buffer;
+    u8 section;
+    u8 type;
+    u64 key;
+    int size;
+    int i, j;
+    
+    assert(d);
+    assert(fsid);
+    assert(ref);
+    
+    if ((objhead_get_varint(&bufpos, bufend, &value)!=0) || (value>0xFFFF)
+        || (objhead_get_varint(&bufpos, bufend, &stdmask)!=0))
+    {   errprintf("object header is truncated\n");
+        return -1;
+    }
+    if (value>=FSA_MAX_FSPERARCH)
+    {   errprintf("object header has an invalid filesystem id: fsid=%ld\n", (long)value);
+        return -1;
+    }
+    *fsid=(u16)value;
+    
+    if ((stdmask&1) || ((OBJHEAD_STDCOUNT<64) && (stdmask>>OBJHEAD_STDCOUNT)!=0))
+    {   errprintf("object header has unknown attributes: mask=%llx\n", (long long)stdmask);
+        return -1;
+    }
+    
+    if (stdmask&(1ULL<<DISKITEMKEY_PATH))
+    {
+        if ((objhead_get_varint(&bufpos, bufend, &seq)!=0) || (objhead_get_varint(&bufpos, bufend, &shared)!=0))
+        {   errprintf("object header is truncated\n");
+            return -1;
+        }
+        if ((seq>0) && ((ref->valid==false) || (seq!=(u64)ref->seq+1) || (shared>strlen(ref->lastpath))))
+        {   errprintf("the path of the object depends on a previous object which has not been read\n");
+            ref->valid=false;
+            return -1;
+        }
+        if ((seq==0) && (shared>0))
+        {   errprintf("object header is invalid: a full path cannot depend on the previous path\n");
+            ref->valid=false;
+            return -1;
+        }
+        ref->seq=(u32)seq;
+    }
+    
+    for (i=0; i < OBJHEAD_STDCOUNT; i++)
+    {
+        if ((stdmask&(1ULL<<i))==0)
+            continue;
+        type=objhead_stdtypes[i];
+        if (objhead_get_varint(&bufpos, bufend, &value)!=0)
+        {   errprintf("object header is truncated: attribute %d\n", i);
+            return -1;
+        }
+        switch (type)
+        {
+            case DICTYPE_U16:
+            case DICTYPE_U32:
+            case DICTYPE_U64:
+                size=objhead_intsize(type);
+                for (j=0; j < size; j++, value>>=8)
+                    intdata[j]=(u8)value;
+                if (dico_add_generic(d, DICO_OBJ_SECTION_STDATTR, i, intdata, size, type)!=0)
+                    return -1;
+                break;
+            case DICTYPE_STRING:
+                len=value;
+                if ((len > (u64)(bufend-bufpos)) || ((i==DISKITEMKEY_PATH ? shared : 0)+len+1 > sizeof(text)))
+                {   errprintf("object header is invalid: string %d is too long\n", i);
+                    return -1;
+                }
+                if (i==DISKITEMKEY_PATH)
+                {   memcpy(text, ref->lastpath, shared);
+                    memcpy(text+shared, bufpos, len);
+                    len+=shared;
+                }
+                else
+                {   memcpy(text, bufpos, len);
+                }
+                text[len]=0;
+                bufpos+=value;
+                if (i==DISKITEMKEY_PATH)
+                {   memcpy(ref->lastpath, text, len+1);
+                    ref->valid=true;
+                }
+                if (dico_add_generic(d, DICO_OBJ_SECTION_STDATTR, i, text, len+1, type)!=0)
+                    return -1;
+                break;
+            default:
+                len=value;
+                if ((len > (u64)(bufend-bufpos)) || (len > 0xFFFF))
+                {   errprintf("object header is invalid: data %d is too long\n", i);
+                    return -1;
+                }
+                if (dico_add_generic(d, DICO_OBJ_SECTION_STDATTR, i, bufpos, len, type)!=0)
+                    return -1;
+                bufpos+=len;
+                break;
+        }
+    }
+    
+    if (objhead_get_varint(&bufpos, bufend, &extracount)!=0)
+    {   errprintf("object header is truncated\n");
+        return -1;
+    }
+    for (; extracount>0; extracount--)
+    {
+        if (bufpos+2*sizeof(u8) > bufend)
+        {   errprintf("object header is truncated\n");
+            return -1;
+        }
+        type=*bufpos++;
+        section=*bufpos++;
+        if ((objhead_get_varint(&bufpos, bufend, &key)!=0) || (key>0xFFFF)
+            || (objhead_get_varint(&bufpos, bufend, &len)!=0) || (len>0xFFFF) || (len > (u64)(bufend-bufpos)))
+        {   errprintf("object header is truncated\n");
+            return -1;
+        }
+        if (dico_add_generic(d, section, key, bufpos, len, type)!=0)
+            return -1;
+        bufpos+=len;
+    }
+    
+    if (bufpos!=bufend)
+    {   errprintf("object header is invalid: %ld bytes are not used\n", (long)(bufend-bufpos));
+        return -1;
+    }
+    
+    return 0;
+}
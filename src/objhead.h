@@ -0,0 +1,46 @@
+/*
+ * fsarchiver: Filesystem Archiver
+ *
+ * Copyright (C) 2008-2018 Francois Dupoux.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * Homepage: http://www.fsarchiver.org
+ */
+
+#ifndef __OBJHEAD_H__
+#define __OBJHEAD_H__
+
+#include <limits.h>
+#include "types.h"
+
+struct s_dico;
+
+struct s_objpathref;
+typedef struct s_objpathref cobjpathref;
+
+// the path of an object is stored as the number of bytes it shares with the path
+// of the previous object and the rest of the path: the objects are numbered from
+// the last full path so that the reader knows when the previous object is missing
+struct s_objpathref
+{   char lastpath[PATH_MAX]; // path of the previous object
+    u32  seq; // number of objects since the last full path
+    bool valid; // false when the path of the previous object is not known
+};
+
+#define OBJHEAD_MAXVARINT        10  // max size of a u64 stored as a varint
+#define OBJHEAD_FULLPATH_INTERVAL 256 // a full path is stored at least once every N objects
+#define OBJHEAD_MAXSIZE          1048576 // larger object headers are written in the standard format
+
+u64 objhead_maxsize(struct s_dico *d);
+int objhead_encode(struct s_dico *d, u16 fsid, cobjpathref *ref, u8 *buffer, u8 **bufend);
+int objhead_decode(struct s_dico *d, u16 *fsid, cobjpathref *ref, u8 *buffer, u8 *bufend);
+
+#endif // __OBJHEAD_H__
@@ -54,7 +54,10 @@
 #include "crypto.h"
 #include "error.h"
 #include "datafile.h"
+#include "digest.h"
 #include "queue.h"
+#include "comp_zstd.h"
+#include "comp_solid.h"
 
 typedef struct s_extractar
 {   carchreader ai;
@@ -67,41 +70,23 @@ typedef struct s_extractar
 // returns true if this file of a parent directory has been excluded
 int is_filedir_excluded(char *relpath)
 {
-    char dirpath[PATH_MAX];
     char basename[PATH_MAX];
-    int pos;
     
     // check if that particular file has been excluded
     extract_basename(relpath, basename, sizeof(basename));
     
-    if ((exclude_check(&g_options.exclude, basename)==true) // is filename excluded ?
-        || (exclude_check(&g_options.exclude, relpath)==true)) // is filepath excluded ?
+    if ((exclude_match(&g_options.excludematch, basename)==true) // is filename excluded ?
+        || (exclude_match(&g_options.excludematch, relpath)==true)) // is filepath excluded ?
     {
         msgprintf(MSG_VERB2, "file/dir=[%s] excluded because of its own name/path\n", relpath);
         return true;
     }
     
     // check if that file belongs to a directory which has been excluded
-    snprintf(dirpath, sizeof(dirpath), "%s", relpath);
-    for (pos=0; dirpath[pos]; pos++); // go to the end of the string
-    while (pos>0)
+    if (exclude_match_parents(&g_options.excludematch, relpath)==true)
     {
-        // dirpath=parent_directory(dirpath)
-        while ((pos>=0) && (dirpath[pos]!='/'))
-            dirpath[pos--]=0;
-        if ((pos>0) && (dirpath[pos]=='/'))
-            dirpath[pos]=0;
-        extract_basename(dirpath, basename, sizeof(basename));
-        
-        if (strlen(dirpath)>1 && strlen(basename)>0)
-        {
-            if ((exclude_check(&g_options.exclude, basename)==true)
-                || (exclude_check(&g_options.exclude, dirpath)==true))
-            {
-                msgprintf(MSG_VERB2, "file/dir=[%s] excluded because of its parent=[%s]\n", relpath, dirpath);
-                return true; // a parent directory is excluded
-            }
-        }
+        msgprintf(MSG_VERB2, "file/dir=[%s] excluded because of a parent directory\n", relpath);
+        return true; // a parent directory is excluded
     }
     
     return false; // no exclusion found for that file
@@ -171,6 +156,9 @@ int extractar_listing_print_file(cextractar *exar, int objtype, char *relpath)
     char strprogress[256];
     s64 progress;
     
+    if (msglevel_enabled(MSG_VERB1)==false)
+        return 0;
+    
     memset(strprogress, 0, sizeof(strprogress));
     if (exar->cost_global>0)
     {
@@ -593,8 +581,10 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
     struct timeval tv[2];
     struct s_blockinfo blkinfo;
     cregmulti regmulti;
-    u8 md5sumcalc[16];
-    u8 md5sumorig[16];
+    u8 digestcalc[FSA_MAX_DIGESTLEN];
+    u8 digestorig[FSA_MAX_DIGESTLEN];
+    u16 digestalgo;
+    int digestsize;
     int errors;
     u32 filescount;
     u32 tmpobjtype;
@@ -687,8 +677,16 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
             
             extractar_listing_print_file(exar, tmpobjtype, relpath);
             
-            if (dico_get_data(filehead, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MD5SUM, md5sumorig, 16, NULL))
-            {   errprintf("cannot get md5sum from file footer for file=[%s]\n", relpath);
+            // DISKITEMKEY_DIGESTALGO has been introduced in fsarchiver-0.8.6: files had an md5sum before
+            if (dico_get_u16(filehead, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_DIGESTALGO, &digestalgo)!=0)
+                digestalgo=DIGEST_MD5;
+            if ((digestsize=digest_size(digestalgo))<0)
+            {   errprintf("unsupported digest algorithm %d for file=[%s]\n", (int)digestalgo, relpath);
+                goto extractar_restore_obj_regfile_multi_err;
+            }
+            
+            if (dico_get_data(filehead, DICO_OBJ_SECTION_STDATTR, (digestalgo==DIGEST_MD5)?DISKITEMKEY_MD5SUM:DISKITEMKEY_DIGEST, digestorig, sizeof(digestorig), NULL))
+            {   errprintf("cannot get %s digest from file header for file=[%s]\n", digestalgostr(digestalgo), relpath);
                 dico_show(filehead, DICO_OBJ_SECTION_STDATTR, "filehead");
                 goto extractar_restore_obj_regfile_multi_err;
             }
@@ -698,7 +696,7 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
             
             res=datafile_write(datafile, databuf, datsize);
             
-            datafile_close(datafile, md5sumcalc, sizeof(md5sumcalc));
+            datafile_close(datafile);
             
             if (res!=FSAERR_SUCCESS)
             {   errprintf("removing %s\n", fullpath);
@@ -706,7 +704,7 @@ int extractar_restore_obj_regfile_multi(cextractar *exar, char *destdir, cdico *
                 return -1;
             }
             
-            if (memcmp(md5sumcalc, md5sumorig, 16)!=0)
+            if (digest_buffer(digestalgo, digestcalc, (u8*)databuf, datsize)<0 || memcmp(digestcalc, digestorig, digestsize)!=0)
             {   errprintf("cannot restore file %s, the data block (which is shared by multiple files) is corrupt\n", relpath);
                 res=truncate(fullpath, 0); // don't leave corrupt data in the file
                 goto extractar_restore_obj_regfile_multi_err;
@@ -749,14 +747,25 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
     bool minorerr=false; // error for current file only
     bool delfile=false;
     struct timeval tv[2];
-    u8 md5sumcalc[16];
-    u8 md5sumorig[16];
+    cfiledigest filedigest;
+    bool digestopen=false;
+    u8 digestcalc[FSA_MAX_DIGESTLEN];
+    u8 digestorig[FSA_MAX_DIGESTLEN];
+    u16 digestalgo;
+    int digestsize=0;
     int excluded=false;
+    u64 holes[2*FSA_MAX_HOLEMAPCOUNT];
+    u16 holemapsize=0;
+    u32 holeblksize=0;
+    int holecount=0;
+    int curhole=0;
     bool sparse=false;
     u64 filesize=0;
     u64 filepos=0;
     u64 flags=0;
     s64 lres;
+    int res;
+    int i;
     
     // init
     memset(&blkinfo, 0, sizeof(blkinfo));
@@ -770,6 +779,16 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
     
     sparse=((dico_get_u64(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_FLAGS, &flags)==0) && (flags&FSA_FILEFLAGS_SPARSE));
     
+    // DISKITEMKEY_DIGESTALGO has been introduced in fsarchiver-0.8.6: files had an md5sum before
+    if (dico_get_u16(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_DIGESTALGO, &digestalgo)!=0)
+        digestalgo=DIGEST_MD5;
+    if (minorerr==false)
+    {   if (filedigest_open(&filedigest, digestalgo)!=0)
+            minorerr=true;
+        else
+            digestopen=true;
+    }
+    
     // update cost statistics and progress bar
     exar->cost_current+=FSA_COST_PER_FILE; 
     exar->cost_current+=filesize;
@@ -795,9 +814,42 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
     if ((minorerr==false) && (datafile_open_write(datafile, fullpath, excluded, sparse)<0))
         minorerr=true;
     
+    // sparse files may have a list of holes which have not been stored in the archive: the holes
+    // start on a block boundary since the blocks are only restored up to the start of the next hole
+    if (dico_get_data(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_HOLEMAP, holes, sizeof(holes), &holemapsize)==0)
+    {
+        holecount=holemapsize/(2*sizeof(u64));
+        for (i=0; i < 2*holecount; i++)
+            holes[i]=le64_to_cpu(holes[i]);
+        if (dico_get_u32(d, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_HOLEBLKSIZE, &holeblksize)!=0)
+            holeblksize=0;
+        for (i=0; i < holecount; i++)
+        {   if ((holeblksize==0) || (holes[2*i] > filesize) || (holes[2*i+1] > filesize - holes[2*i]) ||
+                (holes[2*i] % holeblksize != 0) || (i>0 && holes[2*i] < holes[2*i-2] + holes[2*i-1]))
+            {   errprintf("invalid hole map for file [%s]\n", relpath);
+                holecount=0;
+                minorerr=true;
+                break;
+            }
+        }
+    }
+    
     msgprintf(MSG_DEBUG2, "restore_obj_regfile_unique(file=%s, size=%lld)\n", relpath, (long long)filesize);
     for (filepos=0; (minorerr==false) && (filesize>0) && (filepos < filesize) && (get_interrupted()==false); filepos+=blkinfo.blkrealsize)
     {
+        if ((curhole < holecount) && (holes[2*curhole]==filepos)) // recreate the hole
+        {
+            if (datafile_write_hole(datafile, holes[2*curhole+1])!=FSAERR_SUCCESS)
+            {   delfile=true;
+                minorerr=true;
+                fatalerr=true;
+                break;
+            }
+            blkinfo.blkrealsize=holes[2*curhole+1]; // so that filepos moves to the end of the hole
+            curhole++;
+            continue;
+        }
+        
         if ((lres=queue_dequeue_block(&g_queue, &blkinfo))<=0)
         {   errprintf("queue_dequeue_block()=%ld=%s for file(%s) failed\n", (long)lres, error_int_to_string(lres), relpath);
             delfile=true;
@@ -814,7 +866,19 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
             break;
         }
         
-        if (datafile_write(datafile, blkinfo.blkdata, blkinfo.blkrealsize)!=FSAERR_SUCCESS)
+        if (blkinfo.blkflags&FSA_BLKFLAGS_ZERO) // zero block: recreated as a hole or as zeros
+            res=datafile_write_hole(datafile, blkinfo.blkrealsize);
+        else
+            res=datafile_write(datafile, blkinfo.blkdata, blkinfo.blkrealsize);
+        
+        // the digest of the block has normally been computed by the decompression thread
+        if ((res==FSAERR_SUCCESS) && !(blkinfo.blkflags&FSA_BLKFLAGS_ZERO))
+        {   if (digestalgo!=DIGEST_MD5 && blkinfo.blkdigestalgo==digestalgo)
+                filedigest_add_leaf(&filedigest, blkinfo.blkoffset, blkinfo.blkrealsize, blkinfo.blkdigest);
+            else
+                filedigest_add_data(&filedigest, blkinfo.blkoffset, (u8*)blkinfo.blkdata, blkinfo.blkrealsize);
+        }
+        if (res!=FSAERR_SUCCESS)
         {   free(blkinfo.blkdata);
             delfile=true;
             minorerr=true;
@@ -825,9 +889,15 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
         free(blkinfo.blkdata);
     }
     
-    if ((minorerr==false) && (datafile_close(datafile, md5sumcalc, sizeof(md5sumcalc))!=0))
+    if ((minorerr==false) && (datafile_close(datafile)!=0))
         minorerr=true;
     
+    if (digestopen==true)
+    {   digestopen=false;
+        if (((digestsize=filedigest_close(&filedigest, digestcalc, sizeof(digestcalc)))<0))
+            minorerr=true;
+    }
+    
     if ((minorerr==false) && (excluded==false))
     {
         if (extractar_restore_attr_everything(exar, objtype, fullpath, relpath, d)!=0)
@@ -859,13 +929,13 @@ int extractar_restore_obj_regfile_unique(cextractar *exar, char *fullpath, char
                 goto restore_obj_regfile_unique_end;
             }
             
-            if (dico_get_data(footerdico, 0, BLOCKFOOTITEMKEY_MD5SUM, md5sumorig, 16, NULL))
-            {   errprintf("cannot get md5sum from file footer for file=[%s]\n", relpath);
+            if (dico_get_data(footerdico, 0, (digestalgo==DIGEST_MD5)?BLOCKFOOTITEMKEY_MD5SUM:BLOCKFOOTITEMKEY_DIGEST, digestorig, sizeof(digestorig), NULL))
+            {   errprintf("cannot get %s digest from file footer for file=[%s]\n", digestalgostr(digestalgo), relpath);
                 minorerr=true;
                 goto restore_obj_regfile_unique_end;
             }
             
-            if (memcmp(md5sumcalc, md5sumorig, 16)!=0)
+            if ((digestsize>0) && (memcmp(digestcalc, digestorig, digestsize)!=0))
             {   errprintf("cannot restore file %s, file is corrupt\n", relpath);
                 delfile=true; // don't leave corrupt data in the file
                 minorerr=true;
@@ -1041,15 +1111,17 @@ int extractar_extract_read_objects(cextractar *exar, int *errors, char *destdir,
 
 int extractar_read_mainhead(cextractar *exar, cdico **dicomainhead)
 {
-    u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+8];
-    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+8];
+    u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+FSA_AEAD_OVERHEAD];
+    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+FSA_AEAD_OVERHEAD];
     char magic[FSA_SIZEOF_MAGIC+1];
     u16 cryptbufsize;
     u8 md5sumar[16];
     u8 md5sumnew[16];
     u64 clearsize;
+    u64 solidsize;
     int passlen;
     u32 temp32;
+    int res;
     
     assert(exar);
     assert(dicomainhead);
@@ -1139,6 +1211,10 @@ int extractar_read_mainhead(cextractar *exar, cdico **dicomainhead)
     if (dico_get_u64(*dicomainhead, 0, MAINHEADKEY_MINFSAVERSION, &exar->ai.minfsaver)!=0)
         exar->ai.minfsaver=FSA_VERSION_BUILD(0, 0, 0, 0); // not defined
     
+    // MAINHEADKEY_SOLIDSIZE is set in solid mode: the decompression threads can work on several segments at once
+    if (dico_get_u64(*dicomainhead, 0, MAINHEADKEY_SOLIDSIZE, &solidsize)==0 && solidsize>0 && solidsize<=FSA_MAX_SOLIDSIZE)
+        queue_set_blkmax(&g_queue, solid_queue_size(solidsize));
+    
     // if encryption is enabled, check the password is correct using the encrypted random buffer saved in the archive
     if (exar->ai.cryptalgo!=ENCRYPT_NONE)
     {
@@ -1159,7 +1235,12 @@ int extractar_read_mainhead(cextractar *exar, cdico **dicomainhead)
             return -1;
         }
         
-        if (crypto_blowfish(cryptbufsize, &clearsize, bufcheckcrypt, bufcheckclear, g_options.encryptpass, strlen((char*)g_options.encryptpass), false)==0)
+        // with an aead algorithm the reader thread has already derived the key from the password
+        if (crypto_is_aead(exar->ai.cryptalgo))
+            res=crypto_aead(exar->ai.cryptalgo, NULL, 0, cryptbufsize, &clearsize, bufcheckcrypt, bufcheckclear, false);
+        else
+            res=crypto_blowfish(cryptbufsize, &clearsize, bufcheckcrypt, bufcheckclear, g_options.encryptpass, strlen((char*)g_options.encryptpass), false);
+        if (res==0)
             gcry_md_hash_buffer(GCRY_MD_MD5, md5sumnew, bufcheckclear, clearsize);
         
         if (memcmp(md5sumar, md5sumnew, 16)!=0)
@@ -1521,7 +1602,7 @@ int oper_restore(char *archive, int argc, char **argv, int oper)
     
     if ((oper==OPER_RESTFS) || (oper==OPER_RESTDIR))
     {
-        if ((exar.ai.cryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo!=ENCRYPT_BLOWFISH))
+        if ((exar.ai.cryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo==ENCRYPT_NONE))
         {   errprintf("this archive has been encrypted, you have to provide a password on the command line using option '-c'\n");
             goto do_extract_error;
         }
@@ -1633,7 +1714,13 @@ do_extract_success:
     if (totalerr>0)
         ret=-1;
     
+    if (dirsinfo!=NULL)
+        dico_destroy(dirsinfo);
     dico_destroy(dicomainhead);
     archreader_destroy(&exar.ai);
+    solid_destroy_all();
+#ifdef OPTION_ZSTD_SUPPORT
+    zstd_dict_destroy_all();
+#endif // OPTION_ZSTD_SUPPORT
     return ret;
 }
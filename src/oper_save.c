@@ -56,9 +56,14 @@
 #include "thread_archio.h"
 #include "syncthread.h"
 #include "regmulti.h"
+#include "filereader.h"
+#include "digest.h"
 #include "crypto.h"
 #include "error.h"
 #include "queue.h"
+#include "dedup.h"
+#include "comp_zstd.h"
+#include "comp_solid.h"
 
 #ifndef ENOATTR
 #define ENOATTR ENODATA
@@ -67,6 +72,7 @@
 typedef struct s_savear
 {   carchwriter ai;
     cregmulti   regmulti;
+    cfilepool   *filepool;
     cdichl      *dichardlinks;
     cstats      stats;
     int         fstype;
@@ -74,6 +80,9 @@ typedef struct s_savear
     u64         objectid;
     u64         cost_global;
     u64         cost_current;
+#ifdef OPTION_ZSTD_SUPPORT
+    czstdsamples *samples; // small files which can be used to train the dictionary (option -T)
+#endif // OPTION_ZSTD_SUPPORT
 } csavear;
 
 typedef struct s_devinfo
@@ -83,46 +92,39 @@ typedef struct s_devinfo
     int         fstype;
 } cdevinfo;
 
-int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char *fullpath, u64 filesize)
+int createar_obj_regfile_multi_pack(csavear *save, cfilepoolitem *item)
 {
-    char databuf[FSA_MAX_SMALLFILESIZE];
-    u8 md5sum[16];
     int ret=0;
-    int res;
-    int fd;
     
-    // The checksum will be in the obj-header not in a file footer
-    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
-    {   sysprintf("Cannot open small file %s for reading\n", relpath);
+    if (item->readsize<0)
+    {   errno=item->readerr;
+        if (item->openfailed)
+            sysprintf("Cannot open small file %s for reading\n", item->relpath);
+        else
+            sysprintf("Cannot read data block size=%ld from small file %s, res=%ld\n", (long)item->filesize, item->relpath, (long)item->readsize);
+        dico_destroy(item->header);
         return -1;
     }
-    
-    msgprintf(MSG_DEBUG1, "backup_obj_regfile_multi(file=%s, size=%lld)\n", relpath, (long long)filesize);
-    
-    res=read(fd, databuf, (long)filesize);
-    close(fd);
-    if (res!=filesize)
-    {   
-        if (res>=0 && res<filesize) // file has been truncated: pad with zeros
-        {   ret=-1;
-            errprintf("file [%s] has been truncated to %lld bytes (original size: %lld): padding with zeros\n", 
-                relpath, (long long)res, (long long)filesize);
-            memset(databuf+res, 0, filesize-res); // zero out remaining bytes
-        }
-        else // read error
-        {   sysprintf("Cannot read data block size=%ld from small file %s, res=%ld\n", (long)filesize, relpath, (long)res);
-            return -1;
-        }
+    else if (item->readsize<item->filesize) // file has been truncated: the reader padded it with zeros
+    {   ret=-1;
+        errprintf("file [%s] has been truncated to %lld bytes (original size: %lld): padding with zeros\n", 
+            item->relpath, (long long)item->readsize, (long long)item->filesize);
     }
     
-    gcry_md_hash_buffer(GCRY_MD_MD5, md5sum, databuf, filesize);
-    dico_add_data(header, 0, DISKITEMKEY_MD5SUM, md5sum, 16);
+    // The checksum will be in the obj-header not in a file footer
+    if (g_options.digestalgo==DIGEST_MD5)
+        dico_add_data(item->header, 0, DISKITEMKEY_MD5SUM, item->digest, 16);
+    else
+    {   dico_add_u16(item->header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_DIGESTALGO, g_options.digestalgo);
+        dico_add_data(item->header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_DIGEST, item->digest, digest_size(g_options.digestalgo));
+    }
     
     // if shared-block with many small files is full, push it to queue and make a new one
-    if (regmulti_save_enough_space_for_new_file(&save->regmulti, filesize)==false)
+    if (regmulti_save_enough_space_for_new_file(&save->regmulti, item->filesize)==false)
     {
         if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid)!=0)
         {   errprintf("Cannot queue last block of small-files\n");
+            dico_destroy(item->header);
             return -1;
         }
         
@@ -130,111 +132,264 @@ int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char
     }
     
     // copy current small file to the shared-block
-    if (regmulti_save_addfile(&save->regmulti, header, databuf, filesize)!=0)
-    {   errprintf("Cannot add small-file %s to regmulti structure\n", relpath);
+    if (regmulti_save_addfile(&save->regmulti, item->header, (char*)item->data, item->filesize)!=0)
+    {   errprintf("Cannot add small-file %s to regmulti structure\n", item->relpath);
+        dico_destroy(item->header);
         return -1;
     }
     
+    // with deduplication the shared-block also ends after the files selected by their digest:
+    // the copies of a directory then produce identical shared-blocks once they reach such a file
+    if (g_options.dedup==true && (item->digest[0]%FSA_DEDUP_SMALLFILES)==0 &&
+        save->regmulti.usedsize >= save->regmulti.maxblksize/FSA_DEDUP_SMALLFILES)
+    {
+        if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid)!=0)
+        {   errprintf("Cannot queue last block of small-files\n");
+            return -1;
+        }
+        regmulti_empty(&save->regmulti);
+    }
+    
     return ret;
 }
 
+// pack the small files which have been read (wait for all of them if flush is true)
+int createar_obj_regfile_multi_flush(csavear *save, bool flush)
+{
+    cfilepoolitem *item;
+    int res;
+    
+    while ((res=filepool_get(save->filepool, &item, flush || filepool_full(save->filepool)))==0)
+    {
+        if ((res=createar_obj_regfile_multi_pack(save, item))!=0)
+        {   msgprintf(MSG_STACK, "backup_obj_regfile_multi(%s)=%d failed\n", item->relpath, res);
+            save->stats.err_regfile++;
+        }
+        else
+        {   save->stats.cnt_regfile++;
+        }
+        filepool_item_free(item);
+    }
+    
+    return (res<0) ? -1 : 0;
+}
+
+int createar_obj_regfile_multi(csavear *save, cdico *header, char *relpath, char *fullpath, u64 filesize)
+{
+    msgprintf(MSG_DEBUG1, "backup_obj_regfile_multi(file=%s, size=%lld)\n", relpath, (long long)filesize);
+    
+    // small files are read in advance by the filepool and packed in the shared-block in the same order
+    if (createar_obj_regfile_multi_flush(save, false)!=0)
+    {   errprintf("createar_obj_regfile_multi_flush() failed\n");
+        return -1;
+    }
+    
+    if (filepool_add(save->filepool, header, relpath, fullpath, filesize)!=0)
+    {   errprintf("filepool_add(%s) failed\n", relpath);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// the blocks of the large files are made bigger when they are compressed with a fast algorithm
+// to reduce the overhead of each block: the queue limits the size of the data it holds as well
+static u32 createar_file_blocksize(u64 filesize, u64 flags)
+{
+    u32 blksize=g_options.datablocksize;
+    u64 maxsize;
+    
+    // sparse files keep small blocks so that the holes can be skipped, and identical
+    // data are only found by the deduplication when the blocks are aligned the same way
+    if ((flags&FSA_FILEFLAGS_SPARSE) || g_options.dedup==true)
+        return blksize;
+    
+    switch (g_options.compressalgo)
+    {
+        case COMPRESS_LZO:
+        case COMPRESS_LZ4:
+        case COMPRESS_ZSTD:
+            break;
+        default:
+            return blksize;
+    }
+    
+    // each compression thread must still get at least two blocks from the queue
+    maxsize=min((u64)FSA_MAX_LARGEBLKSIZE, ((u64)FSA_MAX_QUEUESIZE*FSA_MAX_BLKSIZE)/(2*max(g_options.compressjobs, 1)));
+    while (((u64)blksize*2 <= maxsize) && (filesize >= (u64)blksize*2*FSA_LARGEBLK_MINCOUNT))
+        blksize*=2;
+    
+    return blksize;
+}
+
 int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, char *fullpath, u64 filesize) // large or empty files
 {
     cdico *footerdico=NULL;
+    cfilereader *reader=NULL;
     struct s_blockinfo blkinfo;
-    gcry_md_hd_t md5ctx;
+    cfiledigest filedigest;
+    bool md5open=false;
+    bool incompressible=false;
+    bool haspolicy=false;
+    u16 compalgo=COMPRESS_NULL;
+    int complevel=0;
     u32 curblocksize;
+    u32 blksize;
     bool eof=false;
-    u64 remaining;
     char text[256];
     u8 *origblock;
-    u8 *md5tmp;
     u8 md5sum[16];
     u64 filepos;
+    u64 holes[2*FSA_MAX_HOLEMAPCOUNT];
+    int holecount=0;
+    u64 flags=0;
+    s64 readsize;
+    int readerr;
+    int readjobs;
+    int blkstatus;
+    u64 blkcount=0;
     int ret=0;
-    int res;
+    int res=0;
     int fd;
+    int i;
     
-    if (gcry_md_open(&md5ctx, GCRY_MD_MD5, 0) != GPG_ERR_NO_ERROR)
-    {   errprintf("gcry_md_open() failed\n");
+    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
+    {   sysprintf("Cannot open %s for reading\n", relpath);
         return -1;
     }
     
-    if ((fd=open64(fullpath, O_RDONLY|O_LARGEFILE))<0)
-    {   sysprintf("Cannot open %s for reading\n", relpath);
+    // md5 is computed here as a stream, the other digests are computed by the compression
+    // threads for each block and combined by the writer thread which completes the footer
+    if (g_options.digestalgo==DIGEST_MD5)
+    {   if (filedigest_open(&filedigest, DIGEST_MD5)!=0)
+        {   close(fd);
+            return -1;
+        }
+        md5open=true;
+    }
+    else if (filesize>0)
+    {
+        dico_add_u16(header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_DIGESTALGO, g_options.digestalgo);
+    }
+    
+    // the blocks which are entirely in a hole of a sparse file are not stored
+    if ((dico_get_u64(header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_FLAGS, &flags)==0) && (flags&FSA_FILEFLAGS_SPARSE))
+        holecount=filereader_find_holes(fd, filesize, g_options.datablocksize, holes, FSA_MAX_HOLEMAPCOUNT);
+    blksize=createar_file_blocksize(filesize, flags);
+    
+    // very large files are read by several threads using pread(): blocks are still returned in the right order
+    readjobs=(filesize >= FSA_MIN_PARREADSIZE) ? g_options.compressjobs : 1;
+    if ((reader=filereader_alloc(fd, filesize, blksize, readjobs, holes, holecount))==NULL)
+    {   errprintf("filereader_alloc(%s) failed\n", relpath);
+        if (md5open==true)
+            filedigest_close(&filedigest, NULL, 0);
+        close(fd);
         return -1;
     }
     
+    // the holes are listed in the header so that they can be recreated without storing zeros
+    if (holecount>0)
+    {
+        msgprintf(MSG_DEBUG1, "file=%s has %d holes which will not be read\n", relpath, holecount);
+        for (i=0; i < 2*holecount; i++)
+            holes[i]=cpu_to_le64(holes[i]);
+        dico_add_data(header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_HOLEMAP, holes, 2*holecount*sizeof(u64));
+        dico_add_u32(header, DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_HOLEBLKSIZE, g_options.datablocksize);
+    }
+    
     // write header with file attributes (only if open64() works)
     queue_add_header(&g_queue, header, FSA_MAGIC_OBJT, save->fsid);
     
-    msgprintf(MSG_DEBUG1, "backup_obj_regfile_unique(file=%s, size=%lld)\n", relpath, (long long)filesize);
-    for (filepos=0; (filesize>0) && (filepos < filesize) && (get_interrupted()==false); filepos+=curblocksize)
+    msgprintf(MSG_DEBUG1, "backup_obj_regfile_unique(file=%s, size=%lld, blksize=%ld)\n", relpath, (long long)filesize, (long)blksize);
+    while ((get_interrupted()==false) && ((res=filereader_next(reader, &origblock, &curblocksize, &filepos, &readsize, &readerr))==0))
     {
-        remaining=filesize-filepos;
-        curblocksize=min(remaining, g_options.datablocksize);
-        msgprintf(MSG_DEBUG2, "----> filepos=%lld, remaining=%lld, curblocksize=%lld\n", (long long)filepos, (long long)remaining, (long long)curblocksize);
+        msgprintf(MSG_DEBUG2, "----> filepos=%lld, remaining=%lld, curblocksize=%lld\n", (long long)filepos, (long long)(filesize-filepos), (long long)curblocksize);
         
-        origblock=malloc(curblocksize);
-        if (!origblock)
-        {   errprintf("malloc(%ld) failed: cannot allocate data block\n", (long)origblock);
+        if (readsize<0) // read error
+        {   errno=readerr;
+            sysprintf("Cannot read data block from %s, block=%ld and res=%ld\n", relpath, (long)curblocksize, (long)readsize);
+            free(origblock);
             ret=-1;
             goto backup_obj_regfile_unique_error;
         }
-        
-        if (eof==false) // file has not been truncated: read the next block
-        {
-            if ((res=read(fd, origblock, (long)curblocksize))!=curblocksize)
-            {   ret=-1;
-                if (res>=0 && res<curblocksize) // file has been truncated: pad with zeros
-                {   errprintf("file [%s] has been truncated to %lld bytes (original size: %lld): padding with zeros\n", 
-                        relpath, (long long)(filepos+res), (long long)filesize);
-                    eof=true; // set oef to true so that we don't try to read the next blocks
-                    memset(origblock+res, 0, curblocksize-res); // zero out remaining bytes
-                }
-                else if (res<0) // read error
-                {   sysprintf("Cannot read data block from %s, block=%ld and res=%ld\n", relpath, (long)curblocksize, (long)res);
-                    ret=-1;
-                    goto backup_obj_regfile_unique_error;
-                }
-            }
-        }
-        else // file has been truncated: write zero so that the contents and the length in the header are consistent
-        {
-            memset(origblock, 0, curblocksize);
+        else if (readsize<curblocksize && eof==false) // file has been truncated: the reader padded the block with zeros
+        {   errprintf("file [%s] has been truncated to %lld bytes (original size: %lld): padding with zeros\n", 
+                relpath, (long long)(filepos+readsize), (long long)filesize);
+            eof=true; // only report the truncation once: the next blocks are zeros as well
+            ret=-1;
         }
         
-        gcry_md_write(md5ctx, origblock, curblocksize);
-        
         // add block to the queue
         memset(&blkinfo, 0, sizeof(blkinfo));
         blkinfo.blkrealsize=curblocksize;
-        blkinfo.blkdata=(char*)origblock;
         blkinfo.blkoffset=filepos;
         blkinfo.blkfsid=save->fsid;
-        if (queue_add_block(&g_queue, &blkinfo, QITEM_STATUS_TODO)!=0)
+        if (is_buffer_zero(origblock, curblocksize)) // zero block: not compressed and no payload in the archive
+        {
+            free(origblock);
+            blkinfo.blkdata=NULL;
+            blkinfo.blkflags=FSA_BLKFLAGS_ZERO;
+            blkinfo.blkcompalgo=COMPRESS_NONE;
+            blkinfo.blkcryptalgo=ENCRYPT_NONE;
+            blkstatus=QITEM_STATUS_DONE;
+        }
+        else // the digest only covers the blocks which have a payload
+        {
+            if (md5open==true)
+                filedigest_add_data(&filedigest, filepos, origblock, curblocksize);
+            else
+                blkinfo.blkdigestalgo=g_options.digestalgo;
+            // when the first blocks of a file are incompressible the compression threads store the
+            // next ones as they are, but the data are probed again from time to time
+            if (blkcount < FSA_PROBE_FIRSTBLOCKS)
+                incompressible=(blkcount==0 || incompressible==true) && is_buffer_incompressible(origblock, curblocksize);
+            else if (incompressible==true && ((filepos/blksize)%FSA_PROBE_INTERVAL)==0)
+                incompressible=is_buffer_incompressible(origblock, curblocksize);
+            blkinfo.blkincompressible=incompressible;
+            // the compression policy is applied to the whole file once its first bytes are known
+            if (blkcount==0 && g_options.comppolicy.count>0)
+                haspolicy=comppolicy_select(&g_options.comppolicy, relpath, origblock, curblocksize, &compalgo, &complevel);
+            if (haspolicy==true)
+            {   blkinfo.blkcompalgo=compalgo;
+                blkinfo.blkcomplevel=complevel;
+                blkinfo.blkincompressible=(incompressible==true || compalgo==COMPRESS_NONE);
+            }
+            // the blocks of the files which use the default compression are compressed as a stream in solid mode
+            if (g_options.solidsize>0 && haspolicy==false && blkinfo.blkincompressible==false)
+                blkinfo.blksegment=solid_segment_assign(SOLID_STREAM_LARGEFILES, save->fsid, curblocksize);
+            blkcount++;
+            blkinfo.blkdata=(char*)origblock;
+            blkstatus=QITEM_STATUS_TODO;
+        }
+        if (queue_add_block(&g_queue, &blkinfo, blkstatus)!=0)
         {   sysprintf("queue_add_block(%s) failed\n", relpath);
             ret=-1;
             goto backup_obj_regfile_unique_error;
         }
     }
     
-    if (get_interrupted()==true)
-    {   errprintf("operation has been interrupted\n");
+    if (get_interrupted()==false && res<0)
+    {   errprintf("filereader_next(%s) failed\n", relpath);
         ret=-1;
         goto backup_obj_regfile_unique_error;
     }
     
-    // write the footer with the global md5sum
-    if ((md5tmp=gcry_md_read(md5ctx, GCRY_MD_MD5))==NULL)
-    {   errprintf("gcry_md_read() failed\n");
+    if (get_interrupted()==true)
+    {   errprintf("operation has been interrupted\n");
         ret=-1;
         goto backup_obj_regfile_unique_error;
     }
-    memcpy(md5sum, md5tmp, 16);
-    gcry_md_close(md5ctx);
     
-    msgprintf(MSG_DEBUG1, "--> finished loop for file=%s, size=%lld, md5=[%s]\n", relpath, (long long)filesize, format_md5(text, sizeof(text), md5sum));
+    // write the footer with the global md5sum
+    if (md5open==true)
+    {
+        md5open=false;
+        if (filedigest_close(&filedigest, md5sum, sizeof(md5sum))<0)
+        {   ret=-1;
+            goto backup_obj_regfile_unique_error;
+        }
+        msgprintf(MSG_DEBUG1, "--> finished loop for file=%s, size=%lld, md5=[%s]\n", relpath, (long long)filesize, format_md5(text, sizeof(text), md5sum));
+    }
     
     // don't write the footer for empty files (checksum does not make sense --> don't waste space in the archive)
     if (filesize>0)
@@ -244,7 +399,8 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
             ret=-1;
             goto backup_obj_regfile_unique_error;
         }
-        dico_add_data(footerdico, 0, BLOCKFOOTITEMKEY_MD5SUM, md5sum, 16);
+        if (g_options.digestalgo==DIGEST_MD5) // else BLOCKFOOTITEMKEY_DIGEST is added by the writer thread
+            dico_add_data(footerdico, 0, BLOCKFOOTITEMKEY_MD5SUM, md5sum, 16);
         
         if (queue_add_header(&g_queue, footerdico, FSA_MAGIC_FILF, save->fsid)!=0)
         {   msgprintf(MSG_VERB2, "Cannot write footer for file %s\n", relpath);
@@ -254,6 +410,9 @@ int createar_obj_regfile_unique(csavear *save, cdico *header, char *relpath, cha
     }
     
 backup_obj_regfile_unique_error:
+    if (md5open==true)
+        filedigest_close(&filedigest, NULL, 0);
+    filereader_destroy(reader);
     close(fd);
     return ret;
 }
@@ -611,6 +770,10 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
     if (costeval!=NULL) 
     {   *costeval+=filecost;
         dico_destroy(dicoattr);
+#ifdef OPTION_ZSTD_SUPPORT
+        if (objtype==OBJTYPE_REGFILEMULTI && save->samples!=NULL && zstd_samples_add(save->samples, fullpath, statbuf->st_size)!=0)
+            return -1; // fatal error
+#endif // OPTION_ZSTD_SUPPORT
         return 0;
     }
     
@@ -631,14 +794,17 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
     // ---- file details and progress bar
     if (get_interrupted()==false) 
     {
-        memset(strprogress, 0, sizeof(strprogress));
         if (save->cost_global>0)
-        {   save->cost_current+=filecost;
-            progress=((save->cost_current)*100)/(save->cost_global);
-            if (progress>=0 && progress<=100)
-                snprintf(strprogress, sizeof(strprogress), "[%3d%%]", (int)progress);
+            save->cost_current+=filecost;
+        if (msglevel_enabled(MSG_VERB1))
+        {   memset(strprogress, 0, sizeof(strprogress));
+            if (save->cost_global>0)
+            {   progress=((save->cost_current)*100)/(save->cost_global);
+                if (progress>=0 && progress<=100)
+                    snprintf(strprogress, sizeof(strprogress), "[%3d%%]", (int)progress);
+            }
+            msgprintf(MSG_VERB1, "-[%.2d]%s[%s] %s\n", save->fsid, strprogress, get_objtype_name(objtype), relpath);
         }
-        msgprintf(MSG_VERB1, "-[%.2d]%s[%s] %s\n", save->fsid, strprogress, get_objtype_name(objtype), relpath);
     }
     
     // ---- backup file contents for regfiles
@@ -716,14 +882,12 @@ int createar_save_file(csavear *save, char *root, char *relpath, struct stat64 *
                 dico_destroy(dicoattr);
                 return 0; // error is not fatal, operation must continue
             }
+            // statistics are updated when the file has been read and packed
             if ((res=createar_obj_regfile_multi(save, dicoattr, relpath, fullpath, statbuf->st_size))!=0)
             {   msgprintf(MSG_STACK, "backup_obj_regfile_multi(%s)=%d failed\n", relpath, res);
                 save->stats.err_regfile++;
                 return 0; // not a fatal error, oper must continue
             }
-            else
-            {   save->stats.cnt_regfile++;
-            }
             break;
         default: // unknown type
             errprintf("invalid object type: %ld for file %s\n", (long)objtype, relpath);
@@ -776,6 +940,15 @@ int createar_save_directory(csavear *save, char *root, char *path, u64 *costeval
         concatenate_paths(relpath, sizeof(relpath), path, dir->d_name);
         concatenate_paths(fullpath, sizeof(fullpath), fulldirpath, dir->d_name);
         
+        // check the list of excluded files/dirs (before lstat64 so that excluded objects cost nothing)
+        if ((exclude_match(&g_options.excludematch, dir->d_name)==true) // is filename excluded ?
+            || (exclude_match(&g_options.excludematch, relpath)==true)) // is filepath excluded ?
+        {
+            if (costeval==NULL) // dont log twice (eval + real)
+                msgprintf(MSG_VERB2, "file/dir=[%s] excluded\n", relpath);
+            continue;
+        }
+        
         // ---- get details about current file
         if (lstat64(fullpath, &statbuf)!=0)
         {   sysprintf("cannot lstat64(%s)\n", fullpath);
@@ -783,15 +956,6 @@ int createar_save_directory(csavear *save, char *root, char *path, u64 *costeval
             goto backup_dir_err;
         }
         
-        // check the list of excluded files/dirs
-        if ((exclude_check(&g_options.exclude, dir->d_name)==true) // is filename excluded ?
-            || (exclude_check(&g_options.exclude, relpath)==true)) // is filepath excluded ?
-        {
-            if (costeval==NULL) // dont log twice (eval + real)
-                msgprintf(MSG_VERB2, "file/dir=[%s] excluded\n", relpath);
-            continue;
-        }
-        
         // backup contents before the directory itself so that the dir-attributes are written after the dir contents
         if (S_ISDIR(statbuf.st_mode))
         { 
@@ -830,8 +994,26 @@ int createar_save_directory_wrapper(csavear *save, char *root, char *path, u64 *
         return -1;
     }
     
+    // small files are only read during the real backup (not when the cost is evaluated)
+    save->filepool=NULL;
+    if (costeval==NULL && (save->filepool=filepool_alloc(g_options.compressjobs, g_options.digestalgo))==NULL)
+    {   errprintf("filepool_alloc() failed\n");
+        return -1;
+    }
+    
     ret=createar_save_directory(save, root, path, costeval);
     
+    // pack the small files which are still being read
+    if (save->filepool!=NULL)
+    {
+        if (get_interrupted()==false && createar_obj_regfile_multi_flush(save, true)!=0)
+        {   errprintf("createar_obj_regfile_multi_flush() failed\n");
+            ret=-1;
+        }
+        filepool_destroy(save->filepool);
+        save->filepool=NULL;
+    }
+    
     // put all small files that are in the last block to the queue
     if (regmulti_save_enqueue(&save->regmulti, &g_queue, save->fsid)!=0)
     {   errprintf("Cannot queue last block of small-files\n");
@@ -844,10 +1026,41 @@ int createar_save_directory_wrapper(csavear *save, char *root, char *path, u64 *
     return ret;
 }
 
+#ifdef OPTION_ZSTD_SUPPORT
+// train the dictionary used to compress the blocks of small files using the small files
+// seen during the analysis, and add it to the header of the filesystem
+int createar_train_zstddict(csavear *save, cdico *d, u16 key, u16 fsid)
+{
+    u32 dictsize=FSA_ZSTDDICT_SIZE;
+    u8 *dict;
+    int ret=0;
+    
+    if ((dict=malloc(dictsize))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)dictsize);
+        return -1;
+    }
+    
+    // not an error when there is not enough data: the small files are compressed without dictionary
+    if (zstd_samples_train(save->samples, dict, &dictsize)==0)
+    {
+        if (dico_add_data(d, 0, key, dict, (u16)dictsize)!=0 || zstd_dict_set(fsid, dict, dictsize)!=0)
+        {   errprintf("cannot add the zstd dictionary to the header of filesystem %d\n", (int)fsid);
+            ret=-1;
+        }
+    }
+    
+    zstd_samples_destroy(save->samples);
+    zstd_samples_init(save->samples);
+    free(dict);
+    return ret;
+}
+#endif // OPTION_ZSTD_SUPPORT
+
 int createar_write_mainhead(csavear *save, int archtype, int fscount)
 {
     u8 bufcheckclear[FSA_CHECKPASSBUF_SIZE+8];
-    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+8];
+    u8 bufcheckcrypt[FSA_CHECKPASSBUF_SIZE+FSA_AEAD_OVERHEAD];
+    u8 salt[FSA_KDF_SALTSIZE];
     u64 cryptsize;
     u8 md5sum[16];
     struct timeval now;
@@ -876,9 +1089,11 @@ int createar_write_mainhead(csavear *save, int archtype, int fscount)
     dico_add_u32(d, 0, MAINHEADKEY_ENCRYPTALGO, g_options.encryptalgo);
     dico_add_u32(d, 0, MAINHEADKEY_FSACOMPLEVEL, g_options.fsacomplevel);
     dico_add_u32(d, 0, MAINHEADKEY_HASDIRSINFOHEAD, true);
+    if (g_options.solidsize>0) // the restore can decompress several segments at once with a deeper queue
+        dico_add_u64(d, 0, MAINHEADKEY_SOLIDSIZE, g_options.solidsize);
     
     // minimum fsarchiver version required to restore that archive
-    dico_add_u64(d, 0, MAINHEADKEY_MINFSAVERSION, FSA_VERSION_BUILD(0, 6, 4, 0));
+    dico_add_u64(d, 0, MAINHEADKEY_MINFSAVERSION, FSA_VERSION_BUILD(0, 8, 6, 0)); // sparse files are stored with a hole map
     
     if (archtype==ARCHTYPE_FILESYSTEMS)
     {   
@@ -890,13 +1105,28 @@ int createar_write_mainhead(csavear *save, int archtype, int fscount)
     {
         memset(md5sum, 0, sizeof(md5sum));
         crypto_random(bufcheckclear, FSA_CHECKPASSBUF_SIZE);
-        crypto_blowfish(FSA_CHECKPASSBUF_SIZE, &cryptsize, bufcheckclear, bufcheckcrypt, 
-            g_options.encryptpass, strlen((char*)g_options.encryptpass), true);
+        if (crypto_is_aead(g_options.encryptalgo)) // the key is derived once before the first block is queued
+        {
+            crypto_random(salt, FSA_KDF_SALTSIZE);
+            if (crypto_derive_key(g_options.encryptpass, strlen((char*)g_options.encryptpass), salt, FSA_KDF_SALTSIZE, FSA_KDF_ITERATIONS, save->ai.archid)!=0 ||
+                crypto_aead(g_options.encryptalgo, NULL, 0, FSA_CHECKPASSBUF_SIZE, &cryptsize, bufcheckclear, bufcheckcrypt, true)!=0)
+            {   errprintf("cannot derive the encryption key from the password\n");
+                dico_destroy(d);
+                return -1;
+            }
+            dico_add_data(d, 0, MAINHEADKEY_KDFSALT, salt, FSA_KDF_SALTSIZE);
+            dico_add_u32(d, 0, MAINHEADKEY_KDFITERATIONS, FSA_KDF_ITERATIONS);
+        }
+        else
+        {
+            crypto_blowfish(FSA_CHECKPASSBUF_SIZE, &cryptsize, bufcheckclear, bufcheckcrypt, 
+                g_options.encryptpass, strlen((char*)g_options.encryptpass), true);
+        }
         
         gcry_md_hash_buffer(GCRY_MD_MD5, md5sum, bufcheckclear, FSA_CHECKPASSBUF_SIZE);
         
         assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCLEARMD5, md5sum, 16)==0);
-        assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, bufcheckcrypt, FSA_CHECKPASSBUF_SIZE)==0);
+        assert(dico_add_data(d, 0, MAINHEADKEY_BUFCHECKPASSCRYPTBUF, bufcheckcrypt, cryptsize)==0);
     }
     
     if (queue_add_header(&g_queue, d, FSA_MAGIC_MAIN, FSA_FILESYSID_NULL)!=0)
@@ -959,8 +1189,8 @@ int filesystem_mount_partition(cdevinfo *devinfo, cdico *dicofsinfo, u16 fsid)
         if (filesys[devinfo->fstype].reqmntopt(devinfo->devpath, &reqmntopt, &badmntopt)!=0)
         {
             errprintf("cannot get the required mount options for partition=[%s]\n", devinfo->devpath);
-            strlist_empty(&reqmntopt);
-            strlist_empty(&badmntopt);
+            strlist_destroy(&reqmntopt);
+            strlist_destroy(&badmntopt);
             return -1;
         }
         strlist_split(&curmntopt, optbuf, ',');
@@ -1010,9 +1240,9 @@ int filesystem_mount_partition(cdevinfo *devinfo, cdico *dicofsinfo, u16 fsid)
                 }
             }
         }
-        strlist_empty(&reqmntopt);
-        strlist_empty(&badmntopt);
-        strlist_empty(&curmntopt);
+        strlist_destroy(&reqmntopt);
+        strlist_destroy(&badmntopt);
+        strlist_destroy(&curmntopt);
         // create a "mount --bind" for that mounted partition (to see behind its mount points)
         mkdir_recursive(devinfo->partmount);
         if (mount(curmntdir, devinfo->partmount, NULL, MS_BIND|MS_RDONLY, NULL)!=0)
@@ -1129,6 +1359,7 @@ int createar_oper_savefs(csavear *save, cdevinfo *devinfo)
     }
     
     // TODO: add stats about files count in that dico
+    solid_segment_close_streams();
     queue_add_header(&g_queue, dicoend, FSA_MAGIC_DATF, save->fsid);
     
     return ret;
@@ -1175,6 +1406,24 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
     // init archive
     archwriter_init(&save.ai);
     archwriter_generate_id(&save.ai);
+    dedup_init(&g_dedupseen);
+    if (g_options.metablocks==true && queue_set_metablocks(&g_queue, save.ai.archid, FSA_DEF_METABLKSIZE)!=FSAERR_SUCCESS)
+    {   errprintf("queue_set_metablocks() failed\n");
+        return -1;
+    }
+    if (g_options.solidsize>0 && queue_set_blkmax(&g_queue, solid_queue_size(g_options.solidsize))!=FSAERR_SUCCESS)
+    {   errprintf("queue_set_blkmax() failed\n");
+        return -1;
+    }
+#ifdef OPTION_ZSTD_SUPPORT
+    if (g_options.zstddict==true)
+    {   if ((save.samples=malloc(sizeof(czstdsamples)))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)sizeof(czstdsamples));
+            return -1;
+        }
+        zstd_samples_init(save.samples);
+    }
+#endif // OPTION_ZSTD_SUPPORT
     
     // pass options to archive
     path_force_extension(save.ai.basepath, PATH_MAX, archive, ".fsa");
@@ -1273,6 +1522,10 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
                 goto do_create_error;
             }
             save.cost_global+=cost_evalfs;
+#ifdef OPTION_ZSTD_SUPPORT
+            if (save.samples!=NULL && createar_train_zstddict(&save, dicofsinfo[i], FSYSHEADKEY_ZSTDDICT, i)!=0)
+                goto do_create_error;
+#endif // OPTION_ZSTD_SUPPORT
             
             // write filesystem header
             if (queue_add_header(&g_queue, dicofsinfo[i], FSA_MAGIC_FSIN, FSA_FILESYSID_NULL)!=0)
@@ -1307,6 +1560,10 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
         {   errprintf("dico_add_u64(DIRSINFOKEY_TOTALCOST) failed\n");
             goto do_create_error;
         }
+#ifdef OPTION_ZSTD_SUPPORT
+        if (save.samples!=NULL && createar_train_zstddict(&save, dirsinfo, DIRSINFOKEY_ZSTDDICT, 0)!=0)
+            goto do_create_error;
+#endif // OPTION_ZSTD_SUPPORT
         
         if (queue_add_header(&g_queue, dirsinfo, FSA_MAGIC_DIRS, FSA_FILESYSID_NULL)!=0)
         {   errprintf("queue_add_header(FSA_MAGIC_DIRS) failed\n");
@@ -1362,6 +1619,7 @@ int oper_save(char *archive, int argc, char **argv, int archtype)
             }
             
             // TODO: add stats about files count in that dico
+            solid_segment_close_streams();
             queue_add_header(&g_queue, dicoend, FSA_MAGIC_DATF, FSA_FILESYSID_NULL);
             break;
             
@@ -1411,5 +1669,14 @@ do_create_success:
         ret=-1;
     
     archwriter_destroy(&save.ai);
+    dedup_destroy(&g_dedupseen);
+    solid_destroy_all();
+#ifdef OPTION_ZSTD_SUPPORT
+    if (save.samples!=NULL)
+    {   zstd_samples_destroy(save.samples);
+        free(save.samples);
+    }
+    zstd_dict_destroy_all();
+#endif // OPTION_ZSTD_SUPPORT
     return ret;
 }
@@ -32,6 +32,10 @@ int options_init()
     memset(&g_options, 0, sizeof(coptions));
     if (strlist_init(&g_options.exclude)!=0)
         return -1;
+    if (exclude_init(&g_options.excludematch)!=0)
+        return -1;
+    if (comppolicy_init(&g_options.comppolicy)!=0)
+        return -1;
     return 0;
 }
 
@@ -39,21 +43,40 @@ int options_destroy()
 {
     if (strlist_destroy(&g_options.exclude)!=0)
         return -1;
+    if (exclude_destroy(&g_options.excludematch)!=0)
+        return -1;
+    if (comppolicy_destroy(&g_options.comppolicy)!=0)
+        return -1;
     memset(&g_options, 0, sizeof(coptions));
     return 0;
 }
 
 int options_select_compress_level(int opt)
 {
+    // negative levels are lz4 with an acceleration factor: faster than level 0
+    if (opt<0 && opt>=FSA_MIN_LZ4_LEVEL)
+    {
+#ifdef OPTION_LZ4_SUPPORT
+        g_options.compressalgo=COMPRESS_LZ4;
+        g_options.compresslevel=opt;
+        return 0;
+#else
+        errprintf("compression level %d is not available: lz4 has been disabled at compilation time\n", opt);
+        return -1;
+#endif // OPTION_LZ4_SUPPORT
+    }
+    
     switch (opt)
     {
 #ifdef OPTION_LZ4_SUPPORT
 	case 0: // lz4
 	    g_options.compressalgo=COMPRESS_LZ4;
+	    g_options.compresslevel=0;
 	    break;
 #else
 	case 0: // lz4
             errprintf("compression level %d is not available: lz4 has been disabled at compilation time\n", opt);
+            return -1;
 #endif // OPTION_LZ4_SUPPORT
 #ifdef OPTION_LZO_SUPPORT
         case 1: // lzo
@@ -117,3 +140,31 @@ int options_select_compress_level(int opt)
     
     return 0;
 }
+
+// range of the compression levels which make sense for an algorithm, fails
+// when the algorithm does not have levels
+int options_get_compress_levels(int algo, int *minlevel, int *maxlevel)
+{
+    switch (algo)
+    {
+        case COMPRESS_GZIP:
+        case COMPRESS_BZIP2:
+            *minlevel=1;
+            *maxlevel=9;
+            return 0;
+        case COMPRESS_LZMA:
+            *minlevel=0;
+            *maxlevel=9;
+            return 0;
+        case COMPRESS_LZ4:
+            *minlevel=FSA_MIN_LZ4_LEVEL;
+            *maxlevel=FSA_MAX_LZ4_LEVEL;
+            return 0;
+        case COMPRESS_ZSTD:
+            *minlevel=FSA_MIN_ZSTD_LEVEL;
+            *maxlevel=FSA_MAX_ZSTD_LEVEL;
+            return 0;
+        default:
+            return -1;
+    }
+}
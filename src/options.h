@@ -19,6 +19,8 @@
 #define __OPTIONS_H__
 
 #include "strlist.h"
+#include "exclude.h"
+#include "comppolicy.h"
 
 struct s_options;
 typedef struct s_options coptions;
@@ -29,19 +31,30 @@ struct s_options
     bool     allowsaverw;
     bool     experimental;
     bool     dontcheckmountopts;
+    bool     metablocks;
+    bool     dedup;
+    bool     adapt;
+    bool     zstddict;
     int      verboselevel;
     int      debuglevel;
     int      compresslevel;
+    int      adaptminlevel; // bounds of the compression level when adapt is true
+    int      adaptmaxlevel;
     int      compressjobs;
     u16      compressalgo;
     u32      datablocksize;
     u32      smallfilethresh;
     u64      splitsize;
+    u64      solidsize; // size of the segments compressed as a single stream (0 when not in solid mode)
     u16      encryptalgo;
-    u16      fsacomplevel;
+    u16      csumalgo;
+    u16      digestalgo;
+    int      fsacomplevel;
 	char     archlabel[FSA_MAX_LABELLEN];
     u8       encryptpass[FSA_MAX_PASSLEN+1];
     cstrlist exclude;
+    cexclude excludematch; // compiled version of exclude
+    ccomppolicy comppolicy; // per file compression rules (option -P)
 };
 
 extern coptions g_options;
@@ -49,5 +62,6 @@ extern coptions g_options;
 int options_init();
 int options_destroy();
 int options_select_compress_level(int opt);
+int options_get_compress_levels(int algo, int *minlevel, int *maxlevel);
 
 #endif // __OPTIONS_H__
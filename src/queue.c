@@ -34,6 +34,7 @@
 #include "common.h"
 #include "syncthread.h"
 #include "error.h"
+#include "writebuf.h"
 
 struct timespec get_timeout()
 {
@@ -57,8 +58,10 @@ s64 queue_init(cqueue *q, s64 blkmax)
     q->curitemnum=1;
     q->itemcount=0;
     q->blkcount=0;
+    q->blkbytes=0;
     q->blkmax=blkmax;
     q->endofqueue=false;
+    q->metabuf=NULL;
     
     // ---- init pthread structures
     assert(pthread_mutexattr_init(&attr)==0);
@@ -98,12 +101,104 @@ s64 queue_destroy(cqueue *q)
     
     assert(pthread_mutex_unlock(&q->mutex)==0);
     
+    if (q->metabuf!=NULL) // object headers of an operation which has been interrupted
+    {   writebuf_destroy(q->metabuf);
+        q->metabuf=NULL;
+    }
+    
     assert(pthread_mutex_destroy(&q->mutex)==0);
     assert(pthread_cond_destroy(&q->cond)==0);
     
     return FSAERR_SUCCESS;
 }
 
+// the object headers are grouped in metadata blocks which are compressed and
+// encrypted like the data blocks (only used when the archive is created)
+s64 queue_set_metablocks(cqueue *q, u32 archid, u32 maxsize)
+{
+    if (!q)
+    {   errprintf("q is NULL\n");
+        return FSAERR_EINVAL;
+    }
+    
+    if ((q->metabuf=writebuf_alloc())==NULL)
+    {   errprintf("writebuf_alloc() failed\n");
+        return FSAERR_ENOMEM;
+    }
+    memset(&q->metapath, 0, sizeof(q->metapath));
+    q->metaarchid=archid;
+    q->metamaxsize=maxsize;
+    q->metafsid=FSA_FILESYSID_NULL;
+    
+    return FSAERR_SUCCESS;
+}
+
+// a deeper queue lets the compression threads work on several solid segments at once
+s64 queue_set_blkmax(cqueue *q, s64 blkmax)
+{
+    if (!q || blkmax<1)
+    {   errprintf("invalid param\n");
+        return FSAERR_EINVAL;
+    }
+    
+    assert(pthread_mutex_lock(&q->mutex)==0);
+    q->blkmax=blkmax;
+    assert(pthread_mutex_unlock(&q->mutex)==0);
+    pthread_cond_broadcast(&q->cond);
+    
+    return FSAERR_SUCCESS;
+}
+
+// queue the object headers which have been grouped so far as a metadata block
+static s64 queue_flush_metablock(cqueue *q)
+{
+    cblockinfo blkinfo;
+    s64 res;
+    
+    if (q->metabuf==NULL || q->metabuf->size==0)
+        return FSAERR_SUCCESS;
+    
+    memset(&blkinfo, 0, sizeof(blkinfo));
+    blkinfo.blkdata=q->metabuf->data;
+    blkinfo.blkrealsize=(u32)q->metabuf->size;
+    blkinfo.blkoffset=0;
+    blkinfo.blkfsid=q->metafsid;
+    blkinfo.blkflags=FSA_BLKFLAGS_METADATA;
+    blkinfo.blkdigestalgo=DIGEST_NULL;
+    
+    // the buffer now belongs to the block, and the next metadata block must
+    // start with a full path so that it can be read without this one
+    q->metabuf->data=NULL;
+    q->metabuf->size=0;
+    q->metabuf->maxsize=0;
+    q->metapath.valid=false;
+    
+    if ((res=queue_add_block(q, &blkinfo, QITEM_STATUS_TODO))!=FSAERR_SUCCESS)
+        free(blkinfo.blkdata);
+    return res;
+}
+
+// serialize an object header in the current metadata block: the dico is not needed any more
+static s64 queue_add_metaheader(cqueue *q, cdico *d, u16 fsid)
+{
+    s64 res;
+    
+    if (q->metabuf->size>0 && fsid!=q->metafsid && (res=queue_flush_metablock(q))!=FSAERR_SUCCESS)
+        return res;
+    
+    if (writebuf_add_objhead(q->metabuf, d, q->metaarchid, fsid, &q->metapath)!=0)
+    {   errprintf("writebuf_add_objhead() failed\n");
+        return FSAERR_UNKNOWN;
+    }
+    q->metafsid=fsid;
+    dico_destroy(d);
+    
+    if (q->metabuf->size>=q->metamaxsize)
+        return queue_flush_metablock(q);
+    
+    return FSAERR_SUCCESS;
+}
+
 s64 queue_set_end_of_queue(cqueue *q, bool state)
 {
     if (!q)
@@ -185,17 +280,29 @@ s64 queue_count_status(cqueue *q, int status)
     return count;
 }
 
+// the queue is full when it has too many blocks, or too much data since the blocks
+// of large files can be bigger than the others: the memory used stays the same
+static bool queuelocked_is_full(cqueue *q)
+{
+    return (q->blkcount > q->blkmax) || (q->blkcount > 0 && q->blkbytes > q->blkmax*FSA_MAX_BLKSIZE);
+}
+
 // add a block at the end of the queue
 s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
 {
     cqueueitem *item;
     cqueueitem *cur;
+    s64 res;
     
     if (!q || !blkinfo)
     {   errprintf("a parameter is NULL\n");
         return FSAERR_EINVAL;
     }
     
+    // the object headers of the files must be written before their data
+    if ((res=queue_flush_metablock(q))!=FSAERR_SUCCESS)
+        return res;
+    
     // create the new item in memory
     item=malloc(sizeof(cqueueitem));
     if (!item)
@@ -217,7 +324,7 @@ s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
     }
     
     // wait while (queue-is-full) to let the other threads remove items first
-    while (q->blkcount > q->blkmax)
+    while (queuelocked_is_full(q)==true)
     {
         struct timespec t=get_timeout();
         pthread_cond_timedwait(&q->cond, &q->mutex, &t);
@@ -234,6 +341,7 @@ s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
     }
     
     q->blkcount++;
+    q->blkbytes+=item->blkinfo.blkrealsize;
     q->itemcount++;
     item->itemnum=q->curitemnum++;
     
@@ -246,12 +354,19 @@ s64 queue_add_block(cqueue *q, cblockinfo *blkinfo, int status)
 s64 queue_add_header(cqueue *q, cdico *d, char *magic, u16 fsid)
 {
     cheadinfo headinfo;
+    s64 res;
     
     if (!q || !d || !magic)
     {   errprintf("parameter is null\n");
         return FSAERR_EINVAL;
     }
     
+    // other headers are written on their own: the writer completes the file footers
+    if (q->metabuf!=NULL && memcmp(magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)==0)
+        return queue_add_metaheader(q, d, fsid);
+    if ((res=queue_flush_metablock(q))!=FSAERR_SUCCESS)
+        return res;
+    
     memset(&headinfo, 0, sizeof(headinfo));
     memcpy(headinfo.magic, magic, FSA_SIZEOF_MAGIC);
     headinfo.fsid=fsid;
@@ -292,7 +407,7 @@ s64 queue_add_header_internal(cqueue *q, cheadinfo *headinfo)
     }
     
     // wait while (queue-is-full) to let the other threads remove items first
-    while (q->blkcount > q->blkmax)
+    while (queuelocked_is_full(q)==true)
     {
         struct timespec t=get_timeout();
         pthread_cond_timedwait(&q->cond, &q->mutex, &t);
@@ -339,6 +454,7 @@ s64 queue_replace_block(cqueue *q, s64 itemnum, cblockinfo *blkinfo, int newstat
         if (cur->itemnum==itemnum) // block found
         {
             cur->status=newstatus;
+            q->blkbytes+=(s64)blkinfo->blkrealsize-(s64)cur->blkinfo.blkrealsize;
             cur->blkinfo=*blkinfo;
             assert(pthread_mutex_unlock(&q->mutex)==0);
             pthread_cond_broadcast(&q->cond);
@@ -374,9 +490,52 @@ s64 queue_count_items_todo(cqueue *q)
     return count;
 }
 
+// state of the pipeline: how many blocks wait for a compression thread, how many blocks
+// have been compressed and wait for the writer, and if the writer waits for the first item
+s64 queue_get_pressure(cqueue *q, s64 *todo, s64 *ready, bool *writerwaits)
+{
+    cqueueitem *cur;
+    
+    if (!q || !todo || !ready || !writerwaits)
+    {   errprintf("a parameter is null\n");
+        return FSAERR_EINVAL;
+    }
+    
+    *todo=0;
+    *ready=0;
+    
+    assert(pthread_mutex_lock(&q->mutex)==0);
+    
+    for (cur=q->head; cur!=NULL; cur=cur->next)
+    {
+        if (cur->type==QITEM_TYPE_BLOCK && cur->status==QITEM_STATUS_TODO)
+            (*todo)++;
+        else if (cur->type==QITEM_TYPE_BLOCK && cur->status==QITEM_STATUS_DONE)
+            (*ready)++;
+    }
+    *writerwaits=(q->head!=NULL && q->head->type==QITEM_TYPE_BLOCK && q->head->status!=QITEM_STATUS_DONE);
+    
+    assert(pthread_mutex_unlock(&q->mutex)==0);
+    
+    return FSAERR_SUCCESS;
+}
+
+// the blocks of a solid segment go through the same stream: one at a time and in order
+static bool queuelocked_is_segment_busy(u32 *busy, int busycount, u32 segment)
+{
+    int i;
+    
+    for (i=0; i < busycount; i++)
+        if (busy[i]==segment)
+            return true;
+    return false;
+}
+
 // the compression thread requires the first block which has not yet been compressed
 s64 queue_get_first_block_todo(cqueue *q, cblockinfo *blkinfo)
 {
+    u32 busy[FSA_MAX_COMPJOBS]; // segments which have a block being processed
+    int busycount;
     cqueueitem *cur;
     s64 itemfound=-1;
     int res;
@@ -390,9 +549,13 @@ s64 queue_get_first_block_todo(cqueue *q, cblockinfo *blkinfo)
     
     while (queuelocked_get_end_of_queue(q)==false)
     {
+        busycount=0;
         for (cur=q->head; cur!=NULL; cur=cur->next)
         {
-            if ((cur->type==QITEM_TYPE_BLOCK) && (cur->status==QITEM_STATUS_TODO))
+            if ((cur->type==QITEM_TYPE_BLOCK) && (cur->blkinfo.blksegment!=0) && (cur->status==QITEM_STATUS_PROGRESS) && (busycount < FSA_MAX_COMPJOBS))
+                busy[busycount++]=cur->blkinfo.blksegment;
+            if ((cur->type==QITEM_TYPE_BLOCK) && (cur->status==QITEM_STATUS_TODO) && 
+                (cur->blkinfo.blksegment==0 || queuelocked_is_segment_busy(busy, busycount, cur->blkinfo.blksegment)==false))
             {
                 *blkinfo=cur->blkinfo;
                 cur->status=QITEM_STATUS_PROGRESS;
@@ -442,6 +605,7 @@ s64 queue_dequeue_first(cqueue *q, int *type, cheadinfo *headinfo, cblockinfo *b
             if (cur->type==QITEM_TYPE_BLOCK) // item to dequeue is a block
             {
                 q->blkcount--;
+                q->blkbytes-=cur->blkinfo.blkrealsize;
                 *type=cur->type;
                 itemfound=cur->itemnum;
                 *blkinfo=cur->blkinfo;
@@ -518,6 +682,7 @@ s64 queue_dequeue_block(cqueue *q, cblockinfo *blkinfo)
         *blkinfo=cur->blkinfo;
         q->head=cur->next;
         itemnum=cur->itemnum;
+        q->blkbytes-=cur->blkinfo.blkrealsize;
         free(cur);
         q->blkcount--;
         q->itemcount--;
@@ -719,6 +884,7 @@ s64 queue_destroy_first_item(cqueue *q)
     {
         case QITEM_TYPE_BLOCK:
             q->blkcount--;
+            q->blkbytes-=cur->blkinfo.blkrealsize;
             free(cur->blkinfo.blkdata);
             break;
         case QITEM_TYPE_HEADER:
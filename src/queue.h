@@ -19,11 +19,14 @@
 #define __QUEUE_H__
 
 #include <pthread.h>
+#include "objhead.h"
+#include "dedup.h"
 
 enum {QITEM_STATUS_NULL=0, QITEM_STATUS_TODO, QITEM_STATUS_PROGRESS, QITEM_STATUS_DONE};
 enum {QITEM_TYPE_NULL=0, QITEM_TYPE_BLOCK, QITEM_TYPE_HEADER};
 
 struct s_dico;
+struct s_writebuf;
 
 struct s_blockinfo;
 typedef struct s_blockinfo cblockinfo;
@@ -42,11 +45,24 @@ struct s_blockinfo // used when (type==QITEM_TYPE_BLOCK)
     u32                  blkrealsize; // size of the data in the normal state (not compressed and not crypted)
     u64                  blkoffset; // offset of the block in the normal file
     u32                  blkarcsum; // checksum of the block as it it when it's in the archive (compressed and encrypted)
+    u16                  blkcsumalgo; // algo used to compute blkarcsum (CSUM_XXX)
     u32                  blkarsize; // size of the block as it is in the archive (compressed and encrypted)
-    u16                  blkcompalgo; // algo used to compressed the block
+    u16                  blkcompalgo; // algo used to compressed the block (set before compression to override the default algo)
+    int                  blkcomplevel; // level to use with blkcompalgo when it is set before compression
     u32                  blkcompsize; // size of the block after compression and before encryption
     u16                  blkcryptalgo; // algo used to compressed the block
     u16                  blkfsid; // id of filesystem to which the block belongs
+    u16                  blkflags; // FSA_BLKFLAGS_XXX flags (zero block, ...)
+    u16                  blkdigestalgo; // DIGEST_XXX when the compression thread must compute blkdigest
+    bool                 blkincompressible; // set when the rest of the file is known to be incompressible
+    bool                 blksmallfiles; // set for the blocks of packed small files which can use the zstd dictionary
+    u8                   blkdigest[FSA_MAX_DIGESTLEN]; // digest of the uncompressed data (leaf of the file tree hash)
+    bool                 blkhasfprint; // true when blkfprint has been computed (option -D)
+    u8                   blkfprint[DEDUP_FPRINTLEN]; // fingerprint used to find identical blocks
+    u64                  blkrefoffset; // position of the identical block in the volume (FSA_BLKFLAGS_DEDUP)
+    u64                  blkcryptoffset; // offset of the identical block in its file: it is authenticated with its encrypted data
+    u32                  blksegment; // solid segment which the block belongs to (0 when it is compressed on its own)
+    u32                  blksegpos; // position of the block in the stream of its segment
     bool                 blklocked; // true if locked (being processed in the compress/crypt thread)
 };
 
@@ -73,7 +89,13 @@ struct s_queue
     u64                  itemcount; // how many items there are (headers + blocks)
     u64                  blkcount; // how many blocks items there are (items where type==QITEM_TYPE_BLOCK only)
     u64                  blkmax; // how many blocks items there can be before the queue is considered as full
+    u64                  blkbytes; // size of the data of these blocks (uncompressed)
     bool                 endofqueue; // set to true when no more data to put in queue (like eof): reader must stop
+    struct s_writebuf    *metabuf; // object headers waiting to be queued as a metadata block (NULL when disabled)
+    cobjpathref          metapath; // path of the last object header in metabuf
+    u32                  metaarchid; // archive id which is mixed with the checksum of the object headers
+    u32                  metamaxsize; // a metadata block is queued when it reaches that size
+    u16                  metafsid; // filesystem to which the object headers in metabuf belong
 };
 
 // ----return status
@@ -84,6 +106,8 @@ struct s_queue
 // init and destroy
 s64  queue_init(cqueue *l, s64 blkmax);
 s64  queue_destroy(cqueue *l);
+s64  queue_set_metablocks(cqueue *q, u32 archid, u32 maxsize);
+s64  queue_set_blkmax(cqueue *q, s64 blkmax);
 
 // information functions
 s64  queue_count(cqueue *l);
@@ -91,6 +115,7 @@ s64  queue_count_status(struct s_queue *l, int status);
 s64  queue_is_first_item_ready(struct s_queue *q);
 s64  queue_check_next_item(cqueue *q, int *type, char *magic);
 s64  queue_count_items_todo(cqueue *q);
+s64  queue_get_pressure(cqueue *q, s64 *todo, s64 *ready, bool *writerwaits);
 
 // modification functions
 s64  queue_add_block(cqueue *q, cblockinfo *blkinfo, int status);
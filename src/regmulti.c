@@ -28,6 +28,8 @@
 #include "regmulti.h"
 #include "common.h"
 #include "queue.h"
+#include "options.h"
+#include "comp_solid.h"
 #include "error.h"
 
 int regmulti_empty(cregmulti *m)
@@ -86,6 +88,8 @@ bool regmulti_save_enough_space_for_new_file(cregmulti *m, u32 filesize)
 
 int regmulti_save_addfile(cregmulti *m, cdico *header, char *data, u32 datsize)
 {
+    u32 i;
+    
     if (!m)
     {   errprintf("invalid param\n");
         return -1;
@@ -102,6 +106,19 @@ int regmulti_save_addfile(cregmulti *m, cdico *header, char *data, u32 datsize)
     }
     
     m->objhead[m->count]=header;
+    m->filesize[m->count]=datsize;
+    m->fileoffset[m->count]=m->usedsize;
+    
+    // identical small files share the same data in the block (option -D)
+    for (i=0; (g_options.dedup==true) && (i < m->count); i++)
+    {
+        if (m->filesize[i]==datsize && memcmp(m->data+m->fileoffset[i], data, datsize)==0)
+        {   m->fileoffset[m->count]=m->fileoffset[i];
+            m->count++;
+            return 0;
+        }
+    }
+    
     memcpy(m->data+m->usedsize, data, datsize);
     m->usedsize+=datsize;
     m->count++;
@@ -113,8 +130,6 @@ int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
 {
     cblockinfo blkinfo;
     char *dynblock;
-    u32 offset=0;
-    u64 filesize;
     int i;
     
     if (!m)
@@ -133,12 +148,6 @@ int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
             return -1;
         }
         
-        // get file size from header
-        if (dico_get_u64(m->objhead[i], DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_SIZE, &filesize)!=0)
-        {   errprintf("Cannot read filesize DISKITEMKEY_SIZE from archive\n");
-            return -1;
-        }
-        
         // the extraction function needs to know how many small-files are packed together
         if (dico_add_u32(m->objhead[i], DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MULTIFILESCOUNT, (u32)m->count)!=0)
         {   errprintf("dico_add_u32(DISKITEMKEY_MULTIFILESCOUNT) failed\n");
@@ -146,11 +155,10 @@ int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
         }
         
         // the extraction function needs to know where the data for this file are in the block
-        if (dico_add_u32(m->objhead[i], DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MULTIFILESOFFSET, (u32)offset)!=0)
+        if (dico_add_u32(m->objhead[i], DICO_OBJ_SECTION_STDATTR, DISKITEMKEY_MULTIFILESOFFSET, m->fileoffset[i])!=0)
         {   errprintf("dico_add_u32(DISKITEMKEY_MULTIFILESCOUNT) failed\n");
             return -1;
         }
-        offset+=(u32)filesize;
         
         if (queue_add_header(q, m->objhead[i], FSA_MAGIC_OBJT, fsid)!=0)
         {   errprintf("queue_add_header() failed\n");
@@ -170,6 +178,9 @@ int regmulti_save_enqueue(cregmulti *m, cqueue *q, int fsid)
     blkinfo.blkdata=(char*)dynblock;
     blkinfo.blkoffset=0; // no meaning for multi-regfiles
     blkinfo.blkfsid=fsid;
+    blkinfo.blksmallfiles=true;
+    if (g_options.solidsize>0) // the shared blocks are compressed as a separate stream in solid mode
+        blkinfo.blksegment=solid_segment_assign(SOLID_STREAM_SMALLFILES, fsid, m->usedsize);
     if (queue_add_block(q, &blkinfo, QITEM_STATUS_TODO)!=0)
     {   errprintf("queue_add_block() failed\n");
         return -1;
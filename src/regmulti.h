@@ -33,6 +33,8 @@ struct s_regmulti
     
     // linked list of headers
     struct s_dico  *objhead[FSA_MAX_SMALLFILECOUNT]; // worst case: each file is just one byte: this is how many files we can store in the block
+    u32            fileoffset[FSA_MAX_SMALLFILECOUNT]; // where the data of each file are in the block (when saving)
+    u32            filesize[FSA_MAX_SMALLFILECOUNT]; // size of the data of each file (when saving)
     
     // common block to be compressed
     char           data[FSA_MAX_BLKSIZE];
@@ -28,11 +28,83 @@
 #include "common.h"
 #include "error.h"
 
+// the hashset is only used when the list has at least this number of items
+#define STRLIST_HASH_MINCOUNT 16
+
+static u32 strlist_hash(char *str)
+{
+    u32 hash=2166136261U; // FNV-1a
+    
+    for (; *str; str++)
+    {   hash^=(u8)*str;
+        hash*=16777619U;
+    }
+    return hash;
+}
+
+static void strlist_hash_insert(cstrlist *l, int index)
+{
+    u32 pos;
+    
+    pos=strlist_hash(l->items[index]) & (l->hashsize-1);
+    while (l->hashset[pos]!=0)
+        pos=(pos+1) & (l->hashsize-1);
+    l->hashset[pos]=index+1;
+}
+
+// rebuild the hashset so that it is never more than half full
+static int strlist_hash_rebuild(cstrlist *l)
+{
+    u32 hashsize;
+    int i;
+    
+    free(l->hashset);
+    l->hashset=NULL;
+    l->hashsize=0;
+    
+    if (l->count < STRLIST_HASH_MINCOUNT)
+        return 0;
+    
+    for (hashsize=64; hashsize < 4*(u32)l->count; hashsize*=2);
+    if ((l->hashset=calloc(hashsize, sizeof(u32)))==NULL)
+    {   errprintf("calloc(%ld) failed\n", (long)(hashsize*sizeof(u32)));
+        return -1;
+    }
+    l->hashsize=hashsize;
+    for (i=0; i < l->count; i++)
+        strlist_hash_insert(l, i);
+    
+    return 0;
+}
+
+// returns the index of str in the list or -1 if it is not found
+static int strlist_find(cstrlist *l, char *str)
+{
+    u32 pos;
+    int i;
+    
+    if (l->hashsize>0)
+    {
+        pos=strlist_hash(str) & (l->hashsize-1);
+        for (; l->hashset[pos]!=0; pos=(pos+1) & (l->hashsize-1))
+            if (strcmp(l->items[l->hashset[pos]-1], str)==0)
+                return l->hashset[pos]-1;
+    }
+    else
+    {
+        for (i=0; i < l->count; i++)
+            if (strcmp(l->items[i], str)==0)
+                return i;
+    }
+    
+    return -1;
+}
+
 int strlist_init(cstrlist *l)
 {
     if (l==NULL)
         return -1;
-    l->head=NULL;
+    memset(l, 0, sizeof(cstrlist));
     return 0;
 }
 
@@ -42,30 +114,34 @@ int strlist_destroy(cstrlist *l)
         return -1;
     
     strlist_empty(l);
+    free(l->items);
+    memset(l, 0, sizeof(cstrlist));
     
     return 0;
 }
 
 int strlist_empty(cstrlist *l)
 {
-    cstrlistitem *item, *next;
+    int i;
     
     if (l==NULL)
         return -1;
     
-    for (item=l->head; item!=NULL; item=next)
-    {   next=item->next;
-        free(item->str);
-        free(item);
-    }
-    l->head=NULL;
+    for (i=0; i < l->count; i++)
+        free(l->items[i]);
+    l->count=0;
+    free(l->hashset);
+    l->hashset=NULL;
+    l->hashsize=0;
     
     return 0;
 }
 
 int strlist_add(cstrlist *l, char *str)
 {
-    cstrlistitem *item, *lnew;
+    char **newitems;
+    char *newstr;
+    int newsize;
     int len;
     
     if (!l || !str || !strlen(str))
@@ -73,35 +149,33 @@ int strlist_add(cstrlist *l, char *str)
         return -1;
     }
     
-    if (strlist_exists(l, str)==true)
+    if (strlist_find(l, str)>=0)
     {   errprintf("canot add dring: [%s] is already in the list\n", str);
         return -1;
     }
     
-    if ((lnew=malloc(sizeof(cstrlistitem)))==NULL)
-    {   errprintf("malloc() failed\n");
-        return -1;
+    if (l->count==l->size)
+    {   newsize=max(2*l->size, 16);
+        if ((newitems=realloc(l->items, newsize*sizeof(char*)))==NULL)
+        {   errprintf("realloc() failed\n");
+            return -1;
+        }
+        l->items=newitems;
+        l->size=newsize;
     }
-    memset(lnew, 0, sizeof(cstrlistitem));
-    lnew->next=NULL;    
     
     len=strlen(str);
-    if ((lnew->str=malloc(len+1))==NULL)
+    if ((newstr=malloc(len+1))==NULL)
     {   errprintf("malloc() failed\n");
-        free(lnew);
         return -1;
     }
-    memcpy(lnew->str, str, len+1);
+    memcpy(newstr, str, len+1);
+    l->items[l->count++]=newstr;
     
-    // go to the end of the item and check for duplicates
-    if (l->head==NULL) // item is empty
-    {   
-        l->head=lnew;
-    }
-    else // item is not empty
-    {
-        for (item=l->head; (item!=NULL) && (item->next!=NULL); item=item->next);
-        item->next=lnew;
+    if (l->count >= STRLIST_HASH_MINCOUNT)
+    {   if (2*(u32)l->count > l->hashsize)
+            return strlist_hash_rebuild(l);
+        strlist_hash_insert(l, l->count-1);
     }
     
     return 0;
@@ -109,19 +183,14 @@ int strlist_add(cstrlist *l, char *str)
 
 int strlist_getitem(cstrlist *l, int index, char *buf, int bufsize)
 {
-    cstrlistitem *item;
-    int pos=0;
-
     if (!l || !buf || bufsize<=0)
     {   errprintf("invalid param\n");
         return -1;
     }
     
-    for (item=l->head; (item!=NULL) && (pos++ < index); item=item->next);
-    
-    if (item!=NULL)
+    if (index>=0 && index < l->count)
     {
-        snprintf(buf, bufsize, "%s", item->str);
+        snprintf(buf, bufsize, "%s", l->items[index]);
         return 0;
     }
     else
@@ -130,45 +199,40 @@ int strlist_getitem(cstrlist *l, int index, char *buf, int bufsize)
     }
 }
 
+// returns the string at that index without copying it, or NULL if index is out of range
+char *strlist_get(cstrlist *l, int index)
+{
+    if (!l || index<0 || index>=l->count)
+        return NULL;
+    return l->items[index];
+}
+
 int strlist_remove(cstrlist *l, char *str)
 {
-    cstrlistitem *item, *next;
+    int index;
     
     if (!l || !str)
     {   errprintf("invalid param\n");
         return -1;
     }
     
-    if (!l->head)
+    if ((index=strlist_find(l, str))<0)
         return -1; // not found
-
-    // if item to remove found in first pos
-    item=l->head;
-    if (strcmp(item->str, str)==0)
-    {   free(item->str);
-        l->head=item->next;
-        free(item);
-        return 0; // item removed
-    }
     
-    // item to remove not in first pos
-    for (item=l->head; (item!=NULL) && (item->next!=NULL); item=item->next)
-    {   
-        next=item->next;
-        if (strcmp(next->str, str)==0)
-        {   free(next->str);
-            item->next=next->next;
-            free(next);
-            return 0; // item removed
-        }
-    }
+    free(l->items[index]);
+    memmove(&l->items[index], &l->items[index+1], (l->count-index-1)*sizeof(char*));
+    l->count--;
+    
+    // the index of the next items have changed
+    if (strlist_hash_rebuild(l)!=0)
+        return -1;
     
-    return -1; // not found
+    return 0; // item removed
 }
 
 char *strlist_merge(cstrlist *l, char *bufdat, int bufsize, char sep)
 {
-    cstrlistitem *item;
+    int i;
     
     if (!l || !bufdat || bufsize<=0)
     {   errprintf("invalid param\n");
@@ -178,12 +242,11 @@ char *strlist_merge(cstrlist *l, char *bufdat, int bufsize, char sep)
     // init
     memset(bufdat, 0, bufsize);
     
-    // item to remove not in first pos
-    for (item=l->head; item!=NULL; item=item->next)
+    for (i=0; i < l->count; i++)
     {   
-        if (item!=l->head) // not the first item: write separator
+        if (i>0) // not the first item: write separator
             strlcatf(bufdat, bufsize, "%c", sep);
-        strlcatf(bufdat, bufsize, "%s", item->str);
+        strlcatf(bufdat, bufsize, "%s", l->items[i]);
     }
     
     return bufdat;
@@ -191,22 +254,12 @@ char *strlist_merge(cstrlist *l, char *bufdat, int bufsize, char sep)
 
 int strlist_exists(cstrlist *l, char *str)
 {
-    cstrlistitem *item;
-    
     if (!l || !str)
     {   errprintf("invalid param\n");
         return -1; // error
     }
     
-    if (!l->head)
-        return false; // not found
-    
-    // item to remove not in first pos
-    for (item=l->head; item!=NULL; item=item->next)
-        if (strcmp(item->str, str)==0)
-            return true; // item found
-    
-    return false; // not found
+    return (strlist_find(l, str)>=0);
 }
 
 int strlist_split(cstrlist *l, char *text, char sep)
@@ -248,45 +301,31 @@ int strlist_split(cstrlist *l, char *text, char sep)
 
 int strlist_count(cstrlist *l)
 {
-    cstrlistitem *item;
-    int count=0;
-    
     if (!l)
     {   errprintf("invalid param\n");
         return -1; // error
     }
     
-    if (!l->head)
-    {   
-        return 0;
-    }
-    else
-    {
-        for (item=l->head; (item!=NULL); item=item->next)
-            count++;
-    }
-    
-    return count;
+    return l->count;
 }
 
 int strlist_show(cstrlist *l)
 {
-    cstrlistitem *item;
-    int count=0;
+    int i;
     
     if (!l)
     {   errprintf("invalid param\n");
         return -1; // error
     }
     
-    if (!l->head)
+    if (l->count==0)
     {   
         printf("list is empty");
     }
     else
     {
-        for (item=l->head; (item!=NULL); item=item->next)
-            printf("item[%d]: [%s]\n", count++, item->str);
+        for (i=0; i < l->count; i++)
+            printf("item[%d]: [%s]\n", i, l->items[i]);
     }
     
     return 0;
@@ -18,20 +18,19 @@
 #ifndef __STRLIST_H__
 #define __STRLIST_H__
 
+#include "types.h"
+
 struct s_strlist;
 typedef struct s_strlist cstrlist;
 
-struct s_strlistitem;
-typedef struct s_strlistitem cstrlistitem;
-
-struct s_strlistitem
-{   char         *str;
-    cstrlistitem *next;
-};
-
+// list of unique strings stored in an array in the order they were added: a hash set
+// is built to check if a string is in the list once the list has many items
 struct s_strlist
-{
-    cstrlistitem *head;
+{   char **items; // strings of the list
+    int  count; // number of strings in the list
+    int  size; // number of slots allocated in items
+    u32  *hashset; // index+1 of each item, 0 for an empty slot (open addressing)
+    u32  hashsize; // number of slots in hashset (power of two), 0 if there is no hashset
 };
 
 int  strlist_destroy(cstrlist *l);
@@ -41,6 +40,7 @@ int  strlist_add(cstrlist *l, char *str);
 int  strlist_remove(cstrlist *l, char *str);
 int  strlist_exists(cstrlist *l, char *str);
 int  strlist_getitem(cstrlist *l, int index, char *buf, int bufsize);
+char *strlist_get(cstrlist *l, int index);
 char *strlist_merge(cstrlist *l, char *bufdat, int bufsize, char sep);
 int  strlist_split(cstrlist *l, char *text, char sep);
 int  strlist_count(cstrlist *l);
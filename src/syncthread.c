@@ -25,10 +25,14 @@
 #include "fsarchiver.h"
 #include "syncthread.h"
 #include "queue.h"
+#include "dedup.h"
 
 // queue use to share data between the three sort of threads
 cqueue g_queue;
 
+// fingerprints of the blocks which have been seen by the compression threads (option -D)
+cdeduptable g_dedupseen;
+
 // filesystem bitmap used by do_extract() to say to threadio_readimg which filesystems to skip
 // eg: "g_fsbitmap[0]=1,g_fsbitmap[1]=0" means that we want to read filesystem 0 and skip fs 1
 u8 g_fsbitmap[FSA_MAX_FSPERARCH];
@@ -20,6 +20,7 @@
 
 // global threads sync data
 extern struct s_queue g_queue; // queue use to share data between the three sort of threads
+extern struct s_deduptable g_dedupseen; // fingerprints of the blocks seen by the compression threads
 
 // global threads sync functions
 int get_abort(); // returns true if threads must exit because an error or signal received
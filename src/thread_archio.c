@@ -31,11 +31,61 @@
 #include "error.h"
 #include "syncthread.h"
 #include "queue.h"
+#include "options.h"
+#include "digest.h"
+#include "thread_comp.h"
+#include "comp_zstd.h"
+#include "comp_solid.h"
+#include "crypto.h"
+
+// the writer receives the blocks of a file in order with the digest of their contents
+// computed by the compression threads: it combines them and completes the file footer
+static int thread_writer_filedigest(cfiledigest *filedigest, bool *digestopen, int type, struct s_headinfo *headinfo, struct s_blockinfo *blkinfo)
+{
+    u8 digest[FSA_MAX_DIGESTLEN];
+    int size;
+    
+    if (type==QITEM_TYPE_BLOCK && blkinfo->blkdigestalgo!=DIGEST_NULL)
+    {
+        if (*digestopen==false)
+        {   if (filedigest_open(filedigest, blkinfo->blkdigestalgo)!=0)
+                return -1;
+            *digestopen=true;
+        }
+        return filedigest_add_leaf(filedigest, blkinfo->blkoffset, blkinfo->blkrealsize, blkinfo->blkdigest);
+    }
+    
+    // a new object starts: drop what remains from a file which has been interrupted by an error
+    if (((type==QITEM_TYPE_HEADER && memcmp(headinfo->magic, FSA_MAGIC_OBJT, FSA_SIZEOF_MAGIC)==0) ||
+        (type==QITEM_TYPE_BLOCK && (blkinfo->blkflags&FSA_BLKFLAGS_METADATA))) && *digestopen==true)
+    {   filedigest_close(filedigest, NULL, 0);
+        *digestopen=false;
+    }
+    
+    // files saved with md5 already have their checksum in the footer
+    if (type==QITEM_TYPE_HEADER && memcmp(headinfo->magic, FSA_MAGIC_FILF, FSA_SIZEOF_MAGIC)==0 &&
+        dico_get_data(headinfo->dico, 0, BLOCKFOOTITEMKEY_MD5SUM, digest, sizeof(digest), NULL)!=0)
+    {
+        if (*digestopen==false) // the file only has holes and zero blocks
+        {   if (filedigest_open(filedigest, g_options.digestalgo)!=0)
+                return -1;
+        }
+        *digestopen=false;
+        if ((size=filedigest_close(filedigest, digest, sizeof(digest)))<0)
+            return -1;
+        if (dico_add_data(headinfo->dico, 0, BLOCKFOOTITEMKEY_DIGEST, digest, size)!=0)
+            return -1;
+    }
+    
+    return 0;
+}
 
 void *thread_writer_fct(void *args)
 {
     struct s_headinfo headinfo;
     struct s_blockinfo blkinfo;
+    cfiledigest filedigest;
+    bool digestopen=false;
     carchwriter *ai=NULL;
     s64 blknum;
     int type;
@@ -68,6 +118,10 @@ void *thread_writer_fct(void *args)
         }
         else if (blknum>0) // block or header found
         {
+            if (thread_writer_filedigest(&filedigest, &digestopen, type, &headinfo, &blkinfo)!=0)
+            {   msgprintf(MSG_STACK, "thread_writer_filedigest() failed\n");
+                goto thread_writer_fct_error;
+            }
             switch (type)
             {
                 case QITEM_TYPE_BLOCK:
@@ -96,6 +150,8 @@ void *thread_writer_fct(void *args)
     {   msgprintf(MSG_STACK, "cannot write volume footer: archio_write_volfooter() failed\n");
         goto thread_writer_fct_error;
     }
+    if (digestopen==true)
+        filedigest_close(&filedigest, NULL, 0);
     archwriter_close(ai);
     msgprintf(MSG_DEBUG1, "THREAD-WRITER: exit success\n");
     dec_secthreads();
@@ -106,11 +162,101 @@ thread_writer_fct_error:
     set_stopfillqueue(); // say to the create.c thread that it must stop
     while (queue_get_end_of_queue(&g_queue)==false) // wait until all the compression threads exit
         queue_destroy_first_item(&g_queue); // empty queue
+    if (digestopen==true)
+        filedigest_close(&filedigest, NULL, 0);
     archwriter_close(ai);
     dec_secthreads();
     return NULL;
 }
 
+// the object headers of a metadata block are queued as if they had been read one by one
+static int thread_reader_metablock(carchreader *ai, struct s_blockinfo *blkinfo, u64 *errors)
+{
+    char magic[FSA_SIZEOF_MAGIC];
+    cdico *dico=NULL;
+    u16 fsid;
+    s64 lres;
+    int res;
+    int ret=0;
+    
+    if (decompress_block_generic(blkinfo)!=0)
+    {   errprintf("cannot decompress the metadata block\n");
+        (*errors)++;
+        return 0;
+    }
+    
+    archreader_set_metablock(ai, (u8*)blkinfo->blkdata, blkinfo->blkrealsize);
+    while (archreader_metablock_left(ai)>0)
+    {
+        if ((res=archreader_read_header(ai, magic, &dico, false, &fsid))!=FSAERR_SUCCESS)
+        {   dico_destroy(dico);
+            msgprintf(MSG_STACK, "archreader_read_header() failed to read a header from the metadata block\n");
+            (*errors)++;
+            if (res==OLDERR_MINOR) // header is corrupt but the next one can be read
+                continue;
+            break; // the rest of the metadata block cannot be parsed
+        }
+        if (fsid<FSA_MAX_FSPERARCH && g_fsbitmap[fsid]==1)
+        {
+            if ((lres=queue_add_header(&g_queue, dico, magic, fsid))!=FSAERR_SUCCESS)
+            {   msgprintf(MSG_STACK, "queue_add_header()=%ld=%s failed\n", (long)lres, error_int_to_string(lres));
+                ret=-1;
+                break;
+            }
+        }
+        else // header not used
+        {
+            dico_destroy(dico);
+        }
+    }
+    archreader_set_metablock(ai, NULL, 0);
+    
+    return ret;
+}
+
+// the zstd dictionary used by the blocks of small files is in the header of the filesystem:
+// it is loaded by the reader so that it is known before the blocks which follow are decompressed
+static int thread_reader_zstddict(cdico *dico, u16 key, u16 fsid)
+{
+#ifdef OPTION_ZSTD_SUPPORT
+    u8 *dict;
+    u16 size;
+    int res=0;
+    
+    if ((dict=malloc(FSA_ZSTDDICT_SIZE))==NULL)
+    {   errprintf("malloc(%ld) failed: out of memory\n", (long)FSA_ZSTDDICT_SIZE);
+        return -1;
+    }
+    if (dico_get_data(dico, 0, key, dict, FSA_ZSTDDICT_SIZE, &size)==0 && size>0)
+        res=zstd_dict_set(fsid, dict, size);
+    free(dict);
+    return res;
+#else
+    return 0; // the blocks which use the dictionary cannot be decompressed anyway
+#endif // OPTION_ZSTD_SUPPORT
+}
+
+// the key of the aead algorithms is derived from the password and from the parameters
+// of the main header before the first encrypted block is given to the other threads
+static int thread_reader_cryptkey(cdico *dico, u32 archid)
+{
+    u8 salt[FSA_KDF_SALTSIZE];
+    u32 cryptalgo;
+    u32 iterations;
+    u16 saltsize;
+    
+    if (dico_get_u32(dico, 0, MAINHEADKEY_ENCRYPTALGO, &cryptalgo)!=0 || crypto_is_aead(cryptalgo)==false)
+        return 0;
+    if (g_options.encryptalgo==ENCRYPT_NONE) // no password: the main thread reports it
+        return 0;
+    if (dico_get_data(dico, 0, MAINHEADKEY_KDFSALT, salt, sizeof(salt), &saltsize)!=0 ||
+        dico_get_u32(dico, 0, MAINHEADKEY_KDFITERATIONS, &iterations)!=0)
+    {   errprintf("cannot find the parameters of the key derivation in the main header\n");
+        return -1;
+    }
+    return crypto_derive_key(g_options.encryptpass, strlen((char*)g_options.encryptpass), salt, saltsize, iterations, archid);
+}
+
 void *thread_reader_fct(void *args)
 {
     char magic[FSA_SIZEOF_MAGIC];
@@ -118,6 +264,7 @@ void *thread_reader_fct(void *args)
     u32 endofarchive=false;
     carchreader *ai=NULL;
     cdico *dico=NULL;
+    u16 fsinfocount=0;
     int skipblock;
     u16 fsid;
     int sumok;
@@ -163,6 +310,11 @@ void *thread_reader_fct(void *args)
         goto thread_reader_fct_error;
     }
     
+    if (thread_reader_cryptkey(dico, ai->archid)!=0)
+    {   errprintf("cannot derive the encryption key from the password\n");
+        goto thread_reader_fct_error;
+    }
+    
     if ((lres=queue_add_header(&g_queue, dico, magic, fsid))!=FSAERR_SUCCESS)
     {   errprintf("queue_add_header()=%ld=%s failed to add the archive header\n", (long)lres, error_int_to_string(lres));
         goto thread_reader_fct_error;
@@ -230,14 +382,30 @@ void *thread_reader_fct(void *args)
             {
                 skipblock=(g_fsbitmap[fsid]==0);
                 //errprintf("DEBUG: skipblock=%d g_fsbitmap[fsid=%d]=%d\n", skipblock, (int)fsid, (int)g_fsbitmap[fsid]);
-                if (archreader_read_block(ai, dico, skipblock, &sumok, &blkinfo)!=0)
+                if (archreader_read_block(ai, dico, fsid, skipblock, &sumok, &blkinfo)!=0)
                 {   msgprintf(MSG_STACK, "archreader_read_block() failed\n");
                     goto thread_reader_fct_error;
                 }
                 
-                if (skipblock==false)
+                if (skipblock==false && (blkinfo.blkflags&FSA_BLKFLAGS_METADATA))
                 {
-                    status=((sumok==true)?QITEM_STATUS_TODO:QITEM_STATUS_DONE);
+                    // the headers must be queued before the data blocks which follow
+                    res=(sumok==true)?thread_reader_metablock(ai, &blkinfo, &errors):0;
+                    if (sumok==false) errors++;
+                    free(blkinfo.blkdata);
+                    dico_destroy(dico);
+                    if (res!=0)
+                        goto thread_reader_fct_error;
+                }
+                else if (skipblock==false)
+                {
+                    // corrupt blocks and zero blocks must not be decompressed
+                    status=((sumok==true && !(blkinfo.blkflags&FSA_BLKFLAGS_ZERO))?QITEM_STATUS_TODO:QITEM_STATUS_DONE);
+                    // the decompression threads must know which blocks of a solid segment are coming
+                    if (blkinfo.blksegment!=0 && status==QITEM_STATUS_TODO && solid_segment_queued(blkinfo.blksegment, fsid)!=0)
+                        goto thread_reader_fct_error;
+                    else if (blkinfo.blksegment!=0 && status!=QITEM_STATUS_TODO)
+                        solid_segment_broken(blkinfo.blksegment, fsid);
                     if ((lres=queue_add_block(&g_queue, &blkinfo, status))!=FSAERR_SUCCESS)
                     {   if (lres!=FSAERR_NOTOPEN)
                             errprintf("queue_add_block()=%ld=%s failed\n", (long)lres, error_int_to_string(lres));
@@ -249,6 +417,13 @@ void *thread_reader_fct(void *args)
             }
             else // another higher level header
             {
+                if (strncmp(magic, FSA_MAGIC_FSIN, FSA_SIZEOF_MAGIC)==0 && thread_reader_zstddict(dico, FSYSHEADKEY_ZSTDDICT, fsinfocount++)!=0)
+                    goto thread_reader_fct_error;
+                if (strncmp(magic, FSA_MAGIC_DIRS, FSA_SIZEOF_MAGIC)==0 && thread_reader_zstddict(dico, DIRSINFOKEY_ZSTDDICT, 0)!=0)
+                    goto thread_reader_fct_error;
+                // the solid segments never continue after the end of a filesystem
+                if (strncmp(magic, FSA_MAGIC_DATF, FSA_SIZEOF_MAGIC)==0)
+                    solid_segment_close_fs(fsid);
                 // if it's a global header or a if this local header belongs to a filesystem that the main thread needs
                 if (fsid==FSA_FILESYSID_NULL || g_fsbitmap[fsid]==1)
                 {
@@ -24,9 +24,12 @@
 #include <pthread.h>
 #include <string.h>
 #include <pthread.h>
+#include <assert.h>
 
 #include "fsarchiver.h"
 #include "common.h"
+#include "checksum.h"
+#include "digest.h"
 #include "options.h"
 #include "comp_gzip.h"
 #include "comp_bzip2.h"
@@ -34,14 +37,110 @@
 #include "comp_lzo.h"
 #include "comp_lz4.h"
 #include "comp_zstd.h"
+#include "comp_solid.h"
 #include "crypto.h"
 #include "syncthread.h"
 #include "thread_comp.h"
 #include "error.h"
 #include "queue.h"
+#include "dedup.h"
+
+// state of the compression level when it adapts to the speed of the other threads (option --adapt):
+// the compression threads sample the queue before each block and the level moves by one step at
+// most every FSA_ADAPT_INTERVAL blocks towards the side which was seen in most samples
+static pthread_mutex_t adaptmutex=PTHREAD_MUTEX_INITIALIZER;
+static bool adaptstarted=false;
+static int  adaptlevel;
+static int  adaptsamples=0;
+static int  adaptlower=0; // the writer waits for the compression threads
+static int  adapthigher=0; // the compression threads wait for the reader or for the writer
+
+static int compress_adapt_level()
+{
+    bool writerwaits;
+    s64 todo, ready;
+    int step=0;
+    int level;
+    
+    if (queue_get_pressure(&g_queue, &todo, &ready, &writerwaits)!=FSAERR_SUCCESS)
+        return g_options.compresslevel;
+    
+    assert(pthread_mutex_lock(&adaptmutex)==0);
+    if (adaptstarted==false)
+    {   adaptlevel=max(g_options.adaptminlevel, min(g_options.compresslevel, g_options.adaptmaxlevel));
+        adaptstarted=true;
+    }
+    if (writerwaits==true && todo>=g_options.compressjobs) // compression is the bottleneck
+        adaptlower++;
+    else if (todo==0 || ready>=g_queue.blkmax/2) // the blocks are compressed faster than they are read or written
+        adapthigher++;
+    if (++adaptsamples>=FSA_ADAPT_INTERVAL)
+    {
+        if (adaptlower>adaptsamples/2 && adaptlevel>g_options.adaptminlevel)
+            step=-1;
+        else if (adapthigher>adaptsamples/2 && adaptlevel<g_options.adaptmaxlevel)
+            step=1;
+        adaptlevel+=step;
+        // zstd level 0 means the default level (3): it is skipped between -1 and 1
+        if (adaptlevel==0 && g_options.compressalgo==COMPRESS_ZSTD && step!=0 &&
+            adaptlevel+step>=g_options.adaptminlevel && adaptlevel+step<=g_options.adaptmaxlevel)
+            adaptlevel+=step;
+        msgprintf(MSG_DEBUG1, "adapt: lower=%d higher=%d --> level=%d\n", adaptlower, adapthigher, adaptlevel);
+        adaptsamples=adaptlower=adapthigher=0;
+    }
+    level=adaptlevel;
+    assert(pthread_mutex_unlock(&adaptmutex)==0);
+    
+    return level;
+}
+
+// the fields of the block header which are authenticated with the encrypted data by the aead
+// algorithms: a deduplicated block is decrypted with the fields of the block it references
+static int block_aad(struct s_blockinfo *blkinfo, u8 *aad)
+{
+    u64 offset;
+    u16 temp16;
+    u32 temp32;
+    u64 temp64;
+    u8 *bufpos=aad;
+    
+    offset=(blkinfo->blkflags&FSA_BLKFLAGS_DEDUP)?(blkinfo->blkcryptoffset):(blkinfo->blkoffset);
+    temp16=cpu_to_le16(blkinfo->blkfsid);
+    bufpos=mempcpy(bufpos, &temp16, sizeof(temp16));
+    temp64=cpu_to_le64(offset);
+    bufpos=mempcpy(bufpos, &temp64, sizeof(temp64));
+    temp32=cpu_to_le32(blkinfo->blkrealsize);
+    bufpos=mempcpy(bufpos, &temp32, sizeof(temp32));
+    temp16=cpu_to_le16(blkinfo->blkcompalgo);
+    bufpos=mempcpy(bufpos, &temp16, sizeof(temp16));
+    
+    return bufpos-aad;
+}
 
 int compress_block_generic(struct s_blockinfo *blkinfo)
 {
+    // digest of the uncompressed data for the tree hash of the file
+    if (blkinfo->blkdigestalgo!=DIGEST_NULL && digest_leaf(blkinfo->blkdigestalgo, blkinfo->blkdigest, (u8*)blkinfo->blkdata, blkinfo->blkrealsize)!=0)
+        return -1;
+
+    // a block which has already been seen is not compressed: the writer replaces it
+    // with a reference, or compresses it if the first copy is not in the same volume
+    if (g_options.dedup==true && !(blkinfo->blkflags&FSA_BLKFLAGS_METADATA))
+    {
+        if (dedup_fingerprint(blkinfo, blkinfo->blkfprint)!=0)
+            return -1;
+        blkinfo->blkhasfprint=true;
+        if (dedup_insert(&g_dedupseen, blkinfo->blkfprint, 0)>=0)
+            return 0;
+    }
+
+    return compress_block_data(blkinfo);
+}
+
+int compress_block_data(struct s_blockinfo *blkinfo)
+{
+    bool incompressible;
+    bool adapted=false;
     char *bufcomp=NULL;
     int attempt=0;
     int compalgo;
@@ -59,10 +158,34 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
     // compression level/algo to use for the first attempt
     compalgo=g_options.compressalgo;
     complevel=g_options.compresslevel;
+    if (blkinfo->blkcompalgo!=COMPRESS_NULL) // chosen by the compression policy (option -P)
+    {   compalgo=blkinfo->blkcompalgo;
+        complevel=blkinfo->blkcomplevel;
+    }
+
+    // blocks which look incompressible (media, compressed or encrypted data) are
+    // stored as they are without running the compressor
+    incompressible=(blkinfo->blkincompressible==true || is_buffer_incompressible((u8*)blkinfo->blkdata, blkinfo->blkrealsize));
+    
+    // the level depends on which thread is the bottleneck when option --adapt is used
+    if (g_options.adapt==true && blkinfo->blkcompalgo==COMPRESS_NULL && incompressible==false)
+    {   complevel=compress_adapt_level();
+        adapted=true;
+    }
 
     // compress the block
     do
     {
+        blkinfo->blkflags&=~FSA_BLKFLAGS_ZSTDDICT; // only set when the dictionary is used
+        if (incompressible==true)
+        {   res=FSAERR_SUCCESS;
+            compsize=blkinfo->blkrealsize; // the original block is kept
+            if (blkinfo->blksegment!=0) // it does not go through the stream of its segment
+            {   solid_segment_skip(blkinfo->blksegment);
+                blkinfo->blksegment=0;
+            }
+            break;
+        }
         switch (compalgo)
         {
 #ifdef OPTION_LZO_SUPPORT
@@ -81,7 +204,10 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
                 break;
 #ifdef OPTION_LZMA_SUPPORT
             case COMPRESS_LZMA:
-                res=compress_block_lzma(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                if (blkinfo->blksegment!=0) // option --solid
+                    res=compress_block_solid(blkinfo->blksegment, &blkinfo->blksegpos, compalgo, &complevel, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize);
+                else
+                    res=compress_block_lzma(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
                 blkinfo->blkcompalgo=COMPRESS_LZMA;
                 break;
 #endif // OPTION_LZMA_SUPPORT
@@ -93,7 +219,16 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
 #endif // OPTION_LZ4_SUPPORT
 #ifdef OPTION_ZSTD_SUPPORT
             case COMPRESS_ZSTD:
-                res=compress_block_zstd(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                if (blkinfo->blksegment!=0) // option --solid
+                {   res=compress_block_solid(blkinfo->blksegment, &blkinfo->blksegpos, compalgo, &complevel, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize);
+                }
+                else if (blkinfo->blksmallfiles==true && zstd_dict_exists(blkinfo->blkfsid)) // option -T
+                {   res=compress_block_zstd_dict(blkinfo->blkfsid, blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                    blkinfo->blkflags|=FSA_BLKFLAGS_ZSTDDICT;
+                }
+                else
+                {   res=compress_block_zstd(blkinfo->blkrealsize, &compsize, (u8*)blkinfo->blkdata, (void*)bufcomp, bufsize, complevel);
+                }
                 blkinfo->blkcompalgo=COMPRESS_ZSTD;
                 break;
 #endif // OPTION_ZSTD_SUPPORT
@@ -103,6 +238,13 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
                 return -1;
         }
 
+        // the stream of a solid segment cannot continue without this block
+        if ((res != FSAERR_SUCCESS) && (blkinfo->blksegment != 0))
+        {   errprintf("compress_block_solid()=%d failed\n", res);
+            free(bufcomp);
+            return -1;
+        }
+
         // retry if high compression was used and compression failed because of FSAERR_ENOMEM
         if ((res == FSAERR_ENOMEM) && (compalgo > FSA_DEF_COMPRESS_ALGO))
         {
@@ -113,12 +255,15 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
 
     } while ((res == FSAERR_ENOMEM) && (attempt++ == 0));
 
-    // check compression status and efficiency
-    if ((res==FSAERR_SUCCESS) && (compsize < blkinfo->blkrealsize)) // compression worked and saved space
+    // check compression status and efficiency: the blocks of a solid segment are always kept
+    // compressed since the next blocks of the stream depend on them
+    if ((res==FSAERR_SUCCESS) && (compsize < blkinfo->blkrealsize || blkinfo->blksegment!=0)) // compression worked and saved space
     {   free(blkinfo->blkdata); // free old buffer (with uncompressed data)
         blkinfo->blkdata=bufcomp; // new buffer (with compressed data)
         blkinfo->blkcompsize=compsize; // size after compression and before encryption
         blkinfo->blkarsize=compsize; // in case there is no encryption to set this
+        if (adapted==true) // written in the header of the block
+            blkinfo->blkcomplevel=complevel;
         //errprintf ("COMP_DBG: block successfully compressed using %s\n", compress_algo_int_to_string(compalgo));
     }
     else // compressed version is bigger or compression failed: keep the original block
@@ -128,26 +273,34 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
         blkinfo->blkcompsize=blkinfo->blkrealsize; // size after compression and before encryption
         blkinfo->blkarsize=blkinfo->blkrealsize;  // in case there is no encryption to set this
         blkinfo->blkcompalgo=COMPRESS_NONE;
+        blkinfo->blkflags&=~FSA_BLKFLAGS_ZSTDDICT;
         //errprintf ("COMP_DBG: block copied uncompressed, attempted using %s\n", compress_algo_int_to_string(compalgo));
     }
 
+    u8 aad[FSA_AEAD_MAXAADSIZE];
     u64 cryptsize;
     char *bufcrypt=NULL;
-    if (g_options.encryptalgo==ENCRYPT_BLOWFISH)
+    if (g_options.encryptalgo!=ENCRYPT_NONE)
     {
-        if ((bufcrypt=malloc(bufsize+8))==NULL)
-        {   errprintf("malloc(%ld) failed: out of memory\n", (long)bufsize+8);
+        if ((bufcrypt=malloc(bufsize+FSA_AEAD_OVERHEAD))==NULL)
+        {   errprintf("malloc(%ld) failed: out of memory\n", (long)bufsize+FSA_AEAD_OVERHEAD);
             return -1;
         }
-        if ((res=crypto_blowfish(blkinfo->blkcompsize, &cryptsize, (u8*)bufcomp, (u8*)bufcrypt,
-            g_options.encryptpass, strlen((char*)g_options.encryptpass), 1))!=0)
-        {   errprintf("crypt_block_blowfish() failed with res=%d\n", res);
+        if (g_options.encryptalgo==ENCRYPT_BLOWFISH)
+        {   if ((res=crypto_blowfish(blkinfo->blkcompsize, &cryptsize, (u8*)bufcomp, (u8*)bufcrypt,
+                g_options.encryptpass, strlen((char*)g_options.encryptpass), 1))!=0)
+            {   errprintf("crypt_block_blowfish() failed with res=%d\n", res);
+                return -1;
+            }
+        }
+        else if ((res=crypto_aead(g_options.encryptalgo, aad, block_aad(blkinfo, aad), blkinfo->blkcompsize, &cryptsize, (u8*)bufcomp, (u8*)bufcrypt, 1))!=0)
+        {   errprintf("crypto_aead() failed with res=%d\n", res);
             return -1;
         }
         free(bufcomp);
         blkinfo->blkdata=bufcrypt;
         blkinfo->blkarsize=cryptsize;
-        blkinfo->blkcryptalgo=ENCRYPT_BLOWFISH;
+        blkinfo->blkcryptalgo=g_options.encryptalgo;
     }
     else
     {
@@ -155,7 +308,8 @@ int compress_block_generic(struct s_blockinfo *blkinfo)
     }
 
     // calculates the final block checksum (block as it will be stored in the archive)
-    blkinfo->blkarcsum=fletcher32((void*)blkinfo->blkdata, blkinfo->blkarsize);
+    blkinfo->blkcsumalgo=g_options.csumalgo;
+    blkinfo->blkarcsum=block_checksum(blkinfo->blkcsumalgo, (u8*)blkinfo->blkdata, blkinfo->blkarsize);
 
     return 0;
 }
@@ -172,32 +326,40 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
         return -1;
     }
 
-    // check the block checksum
-    if (fletcher32((u8*)blkinfo->blkdata, blkinfo->blkarsize)!=(blkinfo->blkarcsum))
+    // check the block checksum again: not necessary with crc32c since archreader_read_block()
+    // already verified it and corrupt blocks are never passed to the decompression threads,
+    // nor with an aead algorithm since the decryption checks the tag of the block
+    if (blkinfo->blkcsumalgo==CSUM_FLETCHER32 && crypto_is_aead(blkinfo->blkcryptalgo)==false && fletcher32((u8*)blkinfo->blkdata, blkinfo->blkarsize)!=(blkinfo->blkarcsum))
     {   errprintf("block is corrupt at blockoffset=%ld, blksize=%ld\n", (long)blkinfo->blkoffset, (long)blkinfo->blkrealsize);
         memset(bufcomp, 0, blkinfo->blkrealsize);
     }
     else // data not corrupted, decompresses the block
     {
-        if ((blkinfo->blkcryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo!=ENCRYPT_BLOWFISH))
+        if ((blkinfo->blkcryptalgo!=ENCRYPT_NONE) && (g_options.encryptalgo==ENCRYPT_NONE))
         {   msgprintf(MSG_DEBUG1, "this archive has been encrypted, you have to provide a password "
                 "on the command line using option '-c'\n");
             free (bufcomp);
             return -1;
         }
 
+        u8 aad[FSA_AEAD_MAXAADSIZE];
         char *bufcrypt=NULL;
         u64 clearsize;
-        if (blkinfo->blkcryptalgo==ENCRYPT_BLOWFISH)
+        if (blkinfo->blkcryptalgo!=ENCRYPT_NONE)
         {
-            if ((bufcrypt=malloc(blkinfo->blkrealsize+8))==NULL)
-            {   errprintf("malloc(%ld) failed: out of memory\n", (long)blkinfo->blkrealsize+8);
+            if ((bufcrypt=malloc(blkinfo->blkarsize+8))==NULL) // the decrypted data are never bigger
+            {   errprintf("malloc(%ld) failed: out of memory\n", (long)blkinfo->blkarsize+8);
                 free(bufcomp);
                 return -1;
             }
-            if ((res=crypto_blowfish(blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)bufcrypt,
-                g_options.encryptpass, strlen((char*)g_options.encryptpass), 0))!=0)
-            {   errprintf("crypt_block_blowfish() failed\n");
+            if (blkinfo->blkcryptalgo==ENCRYPT_BLOWFISH)
+                res=crypto_blowfish(blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)bufcrypt,
+                    g_options.encryptpass, strlen((char*)g_options.encryptpass), 0);
+            else
+                res=crypto_aead(blkinfo->blkcryptalgo, aad, block_aad(blkinfo, aad), blkinfo->blkarsize, &clearsize, (u8*)blkinfo->blkdata, (u8*)bufcrypt, 0);
+            if (res!=0)
+            {   errprintf("cannot decrypt the block at blockoffset=%ld: it has been modified\n", (long)blkinfo->blkoffset);
+                free(bufcrypt);
                 free(bufcomp);
                 return -1;
             }
@@ -213,8 +375,8 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
 
         switch (blkinfo->blkcompalgo)
         {
-            case COMPRESS_NONE:
-                memcpy(bufcomp, blkinfo->blkdata, blkinfo->blkarsize);
+            case COMPRESS_NONE: // the encrypted block has the nonce and the tag as well with an aead algorithm
+                memcpy(bufcomp, blkinfo->blkdata, min(blkinfo->blkcompsize, blkinfo->blkrealsize));
                 res=0;
                 break;
 #ifdef OPTION_LZO_SUPPORT
@@ -245,7 +407,11 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
                 break;
 #ifdef OPTION_LZMA_SUPPORT
             case COMPRESS_LZMA:
-                if ((res=uncompress_block_lzma(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+                if (blkinfo->blksegment!=0)
+                    res=uncompress_block_solid(blkinfo->blksegment, blkinfo->blksegpos, COMPRESS_LZMA, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata);
+                else
+                    res=uncompress_block_lzma(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata);
+                if (res!=0)
                 {   errprintf("uncompress_block_lzma()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
                         res, (long)blkinfo->blkarsize, (long)checkorigsize);
                     memset(bufcomp, 0, blkinfo->blkrealsize);
@@ -265,7 +431,13 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
 #endif // OPTION_LZ4_SUPPORT
 #ifdef OPTION_ZSTD_SUPPORT
             case COMPRESS_ZSTD:
-                if ((res=uncompress_block_zstd(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata))!=0)
+                if (blkinfo->blksegment!=0)
+                    res=uncompress_block_solid(blkinfo->blksegment, blkinfo->blksegpos, COMPRESS_ZSTD, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata);
+                else if (blkinfo->blkflags&FSA_BLKFLAGS_ZSTDDICT)
+                    res=uncompress_block_zstd_dict(blkinfo->blkfsid, blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata);
+                else
+                    res=uncompress_block_zstd(blkinfo->blkcompsize, &checkorigsize, (void*)bufcomp, blkinfo->blkrealsize, (u8*)blkinfo->blkdata);
+                if (res!=0)
                 {   errprintf("uncompress_block_zstd()=%d failed: finalsize=%ld and checkorigsize=%ld\n",
                         res, (long)blkinfo->blkarsize, (long)checkorigsize);
                     memset(bufcomp, 0, blkinfo->blkrealsize);
@@ -279,6 +451,10 @@ int decompress_block_generic(struct s_blockinfo *blkinfo)
         }
         free(blkinfo->blkdata); // free old buffer (with compressed data)
         blkinfo->blkdata=bufcomp; // pointer to new buffer with uncompressed data
+
+        // digest of the uncompressed data: the main thread only has to combine it with the others
+        if (blkinfo->blkdigestalgo!=DIGEST_NULL && digest_leaf(blkinfo->blkdigestalgo, blkinfo->blkdigest, (u8*)blkinfo->blkdata, blkinfo->blkrealsize)!=0)
+            return -1;
     }
     return 0;
 }
@@ -20,6 +20,11 @@
 
 enum {COMPTHR_COMPRESS=1, COMPTHR_DECOMPRESS=2};
 
+struct s_blockinfo;
+
+int compress_block_generic(struct s_blockinfo *blkinfo);
+int compress_block_data(struct s_blockinfo *blkinfo);
+int decompress_block_generic(struct s_blockinfo *blkinfo);
 void *thread_comp_fct(void *args);
 void *thread_decomp_fct(void *args);
 
@@ -27,9 +27,11 @@
 #include "fsarchiver.h"
 #include "writebuf.h"
 #include "common.h"
+#include "checksum.h"
 #include "error.h"
 #include "queue.h"
 #include "dico.h"
+#include "objhead.h"
 
 cwritebuf *writebuf_alloc()
 {
@@ -39,6 +41,7 @@ cwritebuf *writebuf_alloc()
         return NULL;
     }
     wb->size=0;
+    wb->maxsize=0;
     wb->data=NULL;
     return wb;
 }
@@ -56,13 +59,38 @@ int writebuf_destroy(cwritebuf *wb)
         wb->data=NULL;
     }
     wb->size=0;
+    wb->maxsize=0;
     free(wb);
     return 0;
 }
 
+// returns a pointer to size bytes at the end of the buffer where the caller can write directly
+// the buffer grows geometrically so that many small additions don't realloc() every time
+char *writebuf_reserve(cwritebuf *wb, u64 size)
+{
+    u64 newmax;
+    char *res;
+    
+    if (wb->size+size > wb->maxsize)
+    {
+        newmax=max(max(2*wb->maxsize, wb->size+size), 4096);
+        res=realloc(wb->data, newmax+4); // "+4" required else the last byte of the buffer may be alterred (see release-0.3.3)
+        if (!res)
+        {   errprintf("realloc(oldsize=%ld, newsize=%ld) failed\n", (long)wb->maxsize, (long)newmax+4);
+            return NULL;
+        }
+        wb->data=res;
+        wb->maxsize=newmax;
+    }
+    
+    res=wb->data+wb->size;
+    wb->size+=size;
+    return res;
+}
+
 int writebuf_add_data(cwritebuf *wb, void *data, u64 size)
 {
-    u64 newsize;
+    char *dest;
     
     if (wb==NULL)
     {   errprintf("wb is NULL\n");
@@ -74,29 +102,25 @@ int writebuf_add_data(cwritebuf *wb, void *data, u64 size)
         return -1;
     }
     
-    newsize=wb->size+size;
-    wb->data=realloc(wb->data, newsize+4); // "+4" required else the last byte of the buffer may be alterred (see release-0.3.3)
-    if (!wb->data)
-    {   errprintf("realloc(oldsize=%ld, newsize=%ld) failed\n", (long)wb->size, (long)newsize+4);
+    if ((dest=writebuf_reserve(wb, size))==NULL)
         return -1;
-    }
-    memcpy(wb->data+wb->size, data, size);
+    memcpy(dest, data, size);
     
-    wb->size+=size;
     return 0;
 }
 
+// the dico is serialized directly in the writebuf: header-len, header-data, header-checksum
 int writebuf_add_dico(cwritebuf *wb, cdico *d, char *magic)
 {
     struct s_dicoitem *item;
-    int itemnum;
     u32 headerlen;
     u32 checksum;
-    u8 *buffer;
+    u64 maxlen;
+    char *start;
+    u8 *header;
     u8 *bufpos;
     u16 temp16;
     u32 temp32;
-    u16 count;
     
     if (!wb || !d)
     {   errprintf("a parameter is null\n");
@@ -104,86 +128,49 @@ int writebuf_add_dico(cwritebuf *wb, cdico *d, char *magic)
     }
     
     // 0. debugging
-    msgprintf(MSG_DEBUG2, "archio_write_dico(wb=%p, dico=%p, magic=[%c%c%c%c])\n", wb, d, magic[0], magic[1], magic[2], magic[3]);
-    for (item=d->head; item!=NULL; item=item->next)
-        if ((item->section==DICO_OBJ_SECTION_STDATTR) && (item->key==DISKITEMKEY_PATH) && (memcmp(magic, "ObJt", 4)==0))
-            msgprintf(MSG_DEBUG2, "filepath=[%s]\n", item->data);
-    
-    // 1. how many valid items there are
-    count=dico_count_all_sections(d);
-    msgprintf(MSG_DEBUG2, "dico_count_all_sections(dico=%p)=%d\n", d, (int)count);
-    
-    // 2. calculate len of header
-    headerlen=sizeof(u16); // count
-    for (item=d->head; item!=NULL; item=item->next)
-    {
-        headerlen+=sizeof(u8); // type
-        headerlen+=sizeof(u8); // section
-        headerlen+=sizeof(u16); // key
-        headerlen+=sizeof(u16); // data size
-        headerlen+=item->size; // data
+    if (msglevel_enabled(MSG_DEBUG2))
+    {   msgprintf(MSG_DEBUG2, "archio_write_dico(wb=%p, dico=%p, magic=[%c%c%c%c])\n", wb, d, magic[0], magic[1], magic[2], magic[3]);
+        for (item=d->items; item < d->items+d->count; item++)
+            if ((item->section==DICO_OBJ_SECTION_STDATTR) && (item->key==DISKITEMKEY_PATH) && (memcmp(magic, "ObJt", 4)==0))
+                msgprintf(MSG_DEBUG2, "filepath=[%s]\n", dico_item_data(d, item));
     }
-    msgprintf(MSG_DEBUG2, "calculated headerlen for that dico: headerlen=%d\n", (int)headerlen);
     
-    // 3. allocate memory for header
-    bufpos=buffer=malloc(headerlen);
-    if (!buffer)
-    {   errprintf("cannot allocate memory for buffer");
+    // 1. reserve enough space: the data of all the items are in the arena of the dico
+    maxlen=sizeof(u32) + sizeof(u16) + d->count*(2*sizeof(u8)+2*sizeof(u16)) + d->datused + sizeof(u32);
+    if ((start=writebuf_reserve(wb, maxlen))==NULL)
         return -1;
-    }
+    bufpos=header=(u8*)start+sizeof(u32); // header-len is written when it's known
     
-    // 4. write items count in buffer
-    temp16=cpu_to_le16(count);
-    msgprintf(MSG_DEBUG2, "mempcpy items count to buffer: u16 count=%d\n", (int)count);
+    // 2. write items count
+    temp16=cpu_to_le16(d->count);
     bufpos=mempcpy(bufpos, &temp16, sizeof(temp16));
     
-    // 5. write all items in buffer
-    for (item=d->head, itemnum=0; item!=NULL; item=item->next, itemnum++)
+    // 3. write all items
+    for (item=d->items; item < d->items+d->count; item++)
     {
-        msgprintf(MSG_DEBUG2, "itemnum=%d (type=%d, section=%d, key=%d, size=%d)\n", 
-            (int)itemnum++, (int)item->type, (int)item->section, (int)item->key, (int)item->size);
-        
-        // a. write data type buffer
-        bufpos=mempcpy(bufpos, &item->type, sizeof(item->type));
-        
-        // b. write section to buffer
-        bufpos=mempcpy(bufpos, &item->section, sizeof(item->section));
-        
-        // c. write key to buffer
+        *bufpos++=item->type;
+        *bufpos++=item->section;
         temp16=cpu_to_le16(item->key);
         bufpos=mempcpy(bufpos, &temp16, sizeof(temp16));
-        
-        // d. write sizeof(data) to buffer
         temp16=cpu_to_le16(item->size);
         bufpos=mempcpy(bufpos, &temp16, sizeof(temp16));
-        
-        // e. write data to buffer
         if (item->size>0)
-            bufpos=mempcpy(bufpos, item->data, item->size);
+            bufpos=mempcpy(bufpos, dico_item_data(d, item), item->size);
     }
-    msgprintf(MSG_DEBUG2, "all %d items mempcopied to buffer\n", (int)itemnum);
     
-    // 6. write header-len, header-data, header-checksum
+    // 4. patch header-len and write the checksum of the data which have just been written
+    headerlen=bufpos-header;
     temp32=cpu_to_le32(headerlen);
-    if (writebuf_add_data(wb, &temp32, sizeof(temp32))!=0)
-    {   free(buffer);
-        return -1;
-    }
-    
-    if (writebuf_add_data(wb, buffer, headerlen)!=0)
-    {   free(buffer);
-        return -1;
-    }
-    
-    checksum=fletcher32(buffer, headerlen);
+    memcpy(start, &temp32, sizeof(temp32));
+    checksum=fletcher32(header, headerlen);
     temp32=cpu_to_le32(checksum);
-    if (writebuf_add_data(wb, &temp32, sizeof(temp32))!=0)
-    {   free(buffer);
-        return -1;
-    }
+    bufpos=mempcpy(bufpos, &temp32, sizeof(temp32));
+    
+    // 5. give back the space which has not been used
+    wb->size-=maxlen-(bufpos-(u8*)start);
     
-    free(buffer);
-    msgprintf(MSG_DEBUG2, "end of archio_write_dico(wb=%p, dico=%p, magic=[%c%c%c%c])\n", wb, d, magic[0], magic[1], magic[2], magic[3]);
+    msgprintf(MSG_DEBUG2, "end of archio_write_dico(wb=%p, dico=%p, magic=[%c%c%c%c]): %d items, headerlen=%d\n", 
+        wb, d, magic[0], magic[1], magic[2], magic[3], (int)d->count, (int)headerlen);
     
     return 0;
 }
@@ -227,6 +214,51 @@ int writebuf_add_header(cwritebuf *wb, cdico *d, char *magic, u32 archid, u16 fs
     return 0;
 }
 
+// object headers are written in a compact form: magic, payload-len, payload, payload-checksum
+// the archive id is not stored but it is mixed with the checksum to ignore nested archives
+int writebuf_add_objhead(cwritebuf *wb, cdico *d, u32 archid, u16 fsid, cobjpathref *ref)
+{
+    u32 payloadlen;
+    u32 checksum;
+    u64 maxlen;
+    char *start;
+    u8 *payload;
+    u8 *bufpos;
+    u32 temp32;
+    
+    if (!wb || !d || !ref)
+    {   errprintf("a parameter is null\n");
+        return -1;
+    }
+    
+    // the reader rejects compact headers which are larger than OBJHEAD_MAXSIZE
+    if (objhead_maxsize(d) > OBJHEAD_MAXSIZE)
+        return writebuf_add_header(wb, d, FSA_MAGIC_OBJT, archid, fsid);
+    
+    maxlen=FSA_SIZEOF_MAGIC + sizeof(u32) + objhead_maxsize(d) + sizeof(u32);
+    if ((start=writebuf_reserve(wb, maxlen))==NULL)
+        return -1;
+    memcpy(start, FSA_MAGIC_OBJC, FSA_SIZEOF_MAGIC);
+    payload=(u8*)start+FSA_SIZEOF_MAGIC+sizeof(u32); // payload-len is written when it's known
+    
+    if (objhead_encode(d, fsid, ref, payload, &bufpos)!=0)
+    {   errprintf("objhead_encode() failed\n");
+        return -1;
+    }
+    
+    payloadlen=bufpos-payload;
+    temp32=cpu_to_le32(payloadlen);
+    memcpy(start+FSA_SIZEOF_MAGIC, &temp32, sizeof(temp32));
+    checksum=fletcher32(payload, payloadlen)^archid;
+    temp32=cpu_to_le32(checksum);
+    bufpos=mempcpy(bufpos, &temp32, sizeof(temp32));
+    
+    // give back the space which has not been used
+    wb->size-=maxlen-(bufpos-(u8*)start);
+    
+    return 0;
+}
+
 int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u16 fsid)
 {
     cdico *blkdico; // header written in file
@@ -242,7 +274,7 @@ int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u
         return -1;
     }
     
-    if (blkinfo->blkarsize==0)
+    if (blkinfo->blkarsize==0 && !(blkinfo->blkflags&(FSA_BLKFLAGS_ZERO|FSA_BLKFLAGS_DEDUP)))
     {   errprintf("blkinfo->blkarsize=0: block is empty\n");
         return -1;
     }
@@ -255,6 +287,20 @@ int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u
     dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_ARCSUM, blkinfo->blkarcsum);
     dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_COMPRESSALGO, blkinfo->blkcompalgo);
     dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_ENCRYPTALGO, blkinfo->blkcryptalgo);
+    if (blkinfo->blkflags!=0) // only in archives where the feature is used
+        dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_FLAGS, blkinfo->blkflags);
+    if (blkinfo->blkarsize>0 && blkinfo->blkcsumalgo!=CSUM_FLETCHER32) // old archives always use fletcher32
+        dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_CSUMALGO, blkinfo->blkcsumalgo);
+    if (blkinfo->blkdigestalgo!=DIGEST_NULL) // the block is a leaf of the tree hash of the file
+        dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_DIGESTALGO, blkinfo->blkdigestalgo);
+    if (blkinfo->blkflags&FSA_BLKFLAGS_DEDUP) // the payload is the one of the block written at that position
+        dico_add_u64(blkdico, 0, BLOCKHEADITEMKEY_REFOFFSET, blkinfo->blkrefoffset);
+    else if (blkinfo->blkcomplevel!=0 && blkinfo->blkcompalgo!=COMPRESS_NONE) // level chosen for this block (informational)
+        dico_add_u16(blkdico, 0, BLOCKHEADITEMKEY_COMPLEVEL, (u16)(s16)blkinfo->blkcomplevel);
+    if (blkinfo->blksegment!=0) // the block continues the compression stream of its solid segment
+    {   dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_SEGMENT, blkinfo->blksegment);
+        dico_add_u32(blkdico, 0, BLOCKHEADITEMKEY_SEGMENTPOS, blkinfo->blksegpos);
+    }
     
     // write block header
     res=writebuf_add_header(wb, blkdico, FSA_MAGIC_BLKH, archid, fsid);
@@ -264,8 +310,8 @@ int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u
         return -1;
     }
     
-    // write block data
-    if (writebuf_add_data(wb, blkinfo->blkdata, blkinfo->blkarsize)!=0)
+    // write block data (zero blocks and references to identical blocks have no payload)
+    if ((blkinfo->blkarsize>0) && (writebuf_add_data(wb, blkinfo->blkdata, blkinfo->blkarsize)!=0))
     {   msgprintf(MSG_STACK, "cannot write data block: writebuf_add_data() failed\n");
         return -1;
     }
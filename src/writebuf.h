@@ -20,20 +20,24 @@
 
 struct s_dico;
 struct s_blockinfo;
+struct s_objpathref;
 
 struct s_writebuf;
 typedef struct s_writebuf cwritebuf;
 
 struct s_writebuf
 {   char *data;
-    u64  size;
+    u64  size; // how many bytes are used in data
+    u64  maxsize; // how many bytes have been allocated (not including the extra bytes at the end)
 };
 
 cwritebuf *writebuf_alloc();
 int writebuf_destroy(cwritebuf *wb);
+char *writebuf_reserve(cwritebuf *wb, u64 size);
 int writebuf_add_data(cwritebuf *wb, void *data, u64 size);
 int writebuf_add_dico(cwritebuf *wb, struct s_dico *d, char *magic);
 int writebuf_add_header(cwritebuf *wb, struct s_dico *d, char *magic, u32 archid, u16 fsid);
+int writebuf_add_objhead(cwritebuf *wb, struct s_dico *d, u32 archid, u16 fsid, struct s_objpathref *ref);
 int writebuf_add_block(cwritebuf *wb, struct s_blockinfo *blkinfo, u32 archid, u16 fsid);
 
 #endif // __WRITEBUF_H__